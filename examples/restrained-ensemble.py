@@ -82,6 +82,15 @@ potential2 = gmx.workflow.WorkElement(
 )
 potential2.name = "ensemble_restraint_2"
 
+# Each ensemble_restraint performs its own ensemble reduction at every window update. With many
+# restraints, an "ensemble_restraint_set" element performs a single reduction per window for all of
+# them. Its params have a 'restraints' key with a list of parameter dictionaries like the ones above,
+# and all of them must use the same 'nsamples', 'sample_period', and 'dt'.
+#
+# Either element accepts 'reduce_backend': 'mpi' to reduce directly with MPI from C++ instead of calling
+# back into Python. This requires a plugin built with MPI and a Context providing the mpi4py
+# communicator for the ensemble as its 'ensemble_communicator' attribute.
+
 
 # Settings for a 20 core HPC node. Use 18 threads for domain decomposition for pair potentials
 # and the remaining 2 threads for PME electrostatics.
@@ -0,0 +1,37 @@
+/*! \file
+ * \brief Definitions for the arena declared in alignedarena.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "alignedarena.h"
+
+#include <cstdint>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+constexpr size_t AlignedArena::alignment;
+
+AlignedArena::AlignedArena(size_t capacity) :
+    storage_{new char[capacity + alignment - 1]()},
+    capacity_{capacity}
+{
+    const auto address = reinterpret_cast<uintptr_t>(storage_.get());
+    begin_ = storage_.get() + (alignment - address % alignment) % alignment;
+}
+
+void* AlignedArena::allocateBytes(size_t bytes)
+{
+    if (bytes > capacity_ - used_)
+    {
+        throw gmxapi::ProtocolError("AlignedArena is too small for the requested allocation.");
+    }
+    void* const block = begin_ + used_;
+    used_ += bytes;
+    return block;
+}
+
+} // end namespace plugin
@@ -0,0 +1,102 @@
+#ifndef RESTRAINT_ALIGNEDARENA_H
+#define RESTRAINT_ALIGNEDARENA_H
+
+/*! \file
+ * \brief Fixed-size arena of cache-line aligned storage.
+ *
+ * A restraint knows the size of all of its window buffers at construction. Allocating them from
+ * one arena keeps them contiguous and aligned for the vectorized kernels, and guarantees that
+ * window updates do not touch the heap.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cstddef>
+
+#include <memory>
+#include <type_traits>
+
+namespace plugin
+{
+
+/*!
+ * \brief Bump allocator over a single zero-initialized block of memory.
+ *
+ * Every allocation starts on a 64-byte boundary. Memory is only released when the arena is
+ * destroyed, so the arena must outlive everything allocated from it.
+ */
+class AlignedArena
+{
+    public:
+        /// Alignment of each allocation, in bytes.
+        static constexpr size_t alignment = 64;
+
+        /*!
+         * \brief Space taken in an arena by an allocation of count objects of type T.
+         */
+        template<class T>
+        static constexpr size_t bytesFor(size_t count)
+        {
+            return (count * sizeof(T) + alignment - 1) / alignment * alignment;
+        }
+
+        /*!
+         * \brief Construct an empty arena, from which nothing can be allocated.
+         */
+        AlignedArena() = default;
+
+        /*!
+         * \brief Allocate the storage of the arena.
+         *
+         * \param capacity size in bytes. Use bytesFor() to account for the padding of each allocation.
+         */
+        explicit AlignedArena(size_t capacity);
+
+        AlignedArena(const AlignedArena&) = delete;
+        AlignedArena& operator=(const AlignedArena&) = delete;
+
+        /*!
+         * \brief Allocate zero-initialized storage for count objects.
+         *
+         * \tparam T trivial type.
+         * \param count number of objects.
+         * \return pointer to storage aligned to alignment bytes.
+         * \throws gmxapi::ProtocolError if the arena does not have enough space left.
+         */
+        template<class T>
+        T* allocate(size_t count)
+        {
+            static_assert(std::is_trivial<T>::value, "AlignedArena only holds trivial types.");
+            return static_cast<T*>(allocateBytes(bytesFor<T>(count)));
+        }
+
+        /*!
+         * \brief Size of the arena in bytes.
+         */
+        size_t capacity() const
+        {
+            return capacity_;
+        }
+
+        /*!
+         * \brief Bytes allocated so far, including padding.
+         */
+        size_t used() const
+        {
+            return used_;
+        }
+
+    private:
+        void* allocateBytes(size_t bytes);
+
+        /// Storage with room to align the start of the arena.
+        std::unique_ptr<char[]> storage_;
+        /// First aligned byte of storage_.
+        char* begin_{nullptr};
+        size_t capacity_{0};
+        size_t used_{0};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_ALIGNEDARENA_H
@@ -0,0 +1,33 @@
+/*! \file
+ * \brief Definitions for the tabulated bias potential declared in biastable.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "biastable.h"
+
+#include <cassert>
+#include <cmath>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+BiasTable::BiasTable(double low,
+                     double high,
+                     double spacing)
+{
+    if (!(spacing > 0) || !(high > low))
+    {
+        throw gmxapi::ProtocolError("BiasTable requires high > low and a positive node spacing.");
+    }
+    numIntervals_ = static_cast<size_t>(std::ceil((high - low) / spacing));
+    assert(numIntervals_ > 0);
+    low_ = low;
+    spacing_ = (high - low) / numIntervals_;
+    inverseSpacing_ = 1.0 / spacing_;
+    nodes_.resize(numIntervals_ + 1);
+}
+
+} // end namespace plugin
@@ -0,0 +1,148 @@
+#ifndef RESTRAINT_BIASTABLE_H
+#define RESTRAINT_BIASTABLE_H
+
+/*! \file
+ * \brief Tabulated representation of a one-dimensional bias potential.
+ *
+ * Pair restraints whose potential only changes occasionally (such as the
+ * EnsemblePotential, which is updated at window boundaries) can sample the
+ * potential on a fine grid once per update and interpolate between grid
+ * points when the force is needed, instead of re-evaluating an expensive
+ * expression on every MD step.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cmath>
+
+#include <vector>
+
+namespace plugin
+{
+
+/*!
+ * \brief Value, force and force derivative of a bias potential at one distance.
+ *
+ * force is the negative derivative of energy with respect to the pair distance, and
+ * forceDerivative is the derivative of force with respect to the pair distance.
+ */
+struct BiasPoint
+{
+    double energy{0};
+    double force{0};
+    double forceDerivative{0};
+};
+
+/*!
+ * \brief Piecewise cubic Hermite table of a bias potential over a closed interval.
+ *
+ * The table stores the energy, force, and force derivative at evenly spaced nodes.
+ * Force is interpolated with the cubic Hermite polynomial matching the force and its
+ * derivative at the bracketing nodes. Energy is interpolated with the cubic Hermite
+ * polynomial matching the energy and its derivative (the negative force), so the
+ * interpolated energy and force are consistent to the order of the interpolation.
+ *
+ * For node spacing h, the interpolation error of a function f is bounded by
+ * h^4 / 384 * max|f''''| on each interval.
+ *
+ * Lookups are O(1) and do not allocate. Lookups outside the tabulated interval are
+ * clamped to the nearest end point.
+ */
+class BiasTable
+{
+    public:
+        /*!
+         * \brief Construct an empty table.
+         *
+         * An empty table must be filled with fill() before lookup() can be used.
+         */
+        BiasTable() = default;
+
+        /*!
+         * \brief Allocate a table for the interval [low, high].
+         *
+         * \param low first node of the table.
+         * \param high last node of the table.
+         * \param spacing maximum distance between nodes. The actual spacing is reduced slightly, if
+         * necessary, so that an integer number of intervals spans [low, high].
+         */
+        BiasTable(double low,
+                  double high,
+                  double spacing);
+
+        /*!
+         * \brief Sample a potential at every node.
+         *
+         * \tparam F callable with signature BiasPoint(double distance)
+         * \param evaluate exact evaluation of the potential.
+         */
+        template<class F>
+        void fill(F&& evaluate)
+        {
+            for (size_t i = 0; i < nodes_.size(); ++i)
+            {
+                nodes_[i] = evaluate(low_ + i * spacing_);
+            }
+        }
+
+        /*!
+         * \brief Interpolate the tabulated potential.
+         *
+         * \param distance pair distance at which to evaluate the potential.
+         * \return interpolated energy and force. forceDerivative is not interpolated and is set to zero.
+         */
+        BiasPoint lookup(double distance) const
+        {
+            double x = (distance - low_) * inverseSpacing_;
+            x = x < 0 ? 0 : (x > numIntervals_ ? numIntervals_ : x);
+            auto i = static_cast<size_t>(x);
+            // The last node belongs to the last interval.
+            if (i == numIntervals_)
+            {
+                --i;
+            }
+            const double t = x - i;
+            const BiasPoint& a = nodes_[i];
+            const BiasPoint& b = nodes_[i + 1];
+
+            // Cubic Hermite basis functions on the unit interval.
+            const double t2 = t * t;
+            const double t3 = t2 * t;
+            const double h00 = 2 * t3 - 3 * t2 + 1;
+            const double h10 = t3 - 2 * t2 + t;
+            const double h01 = -2 * t3 + 3 * t2;
+            const double h11 = t3 - t2;
+
+            BiasPoint point;
+            point.force = h00 * a.force + h01 * b.force
+                          + spacing_ * (h10 * a.forceDerivative + h11 * b.forceDerivative);
+            point.energy = h00 * a.energy + h01 * b.energy
+                           - spacing_ * (h10 * a.force + h11 * b.force);
+            return point;
+        }
+
+        /*!
+         * \brief Check whether the table has been allocated.
+         *
+         * \return true if the table has no nodes.
+         */
+        bool empty() const
+        {
+            return nodes_.empty();
+        }
+
+    private:
+        /// Position of the first node.
+        double low_{0};
+        /// Distance between nodes.
+        double spacing_{0};
+        double inverseSpacing_{0};
+        /// Number of intervals between nodes.
+        size_t numIntervals_{0};
+        /// Tabulated values, one per node.
+        std::vector<BiasPoint> nodes_;
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_BIASTABLE_H
@@ -0,0 +1,120 @@
+/*! \file
+ * \brief Definitions for the binned blur declared in binnedblur.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "binnedblur.h"
+
+#include <cmath>
+
+#include <algorithm>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+namespace
+{
+
+/*!
+ * \brief Approximate cost of a Gaussian term of the exact blur, in convolution multiply-adds.
+ *
+ * Measured with the vectorized kernels of kernels.h, which spend about as long on an exponential
+ * as the convolution spends on a few multiply-adds.
+ */
+constexpr double exactTermCost = 4.;
+
+/// Approximate cost of binning a sample, in convolution multiply-adds.
+constexpr double binningCost = 8.;
+
+} // end anonymous namespace
+
+BinnedBlur::BinnedBlur(double low,
+                       double gridSpacing,
+                       size_t numPoints,
+                       double sigma,
+                       double cutoff,
+                       double tolerance) :
+    numPoints_{numPoints}
+{
+    if (!(cutoff > 0) || !(tolerance > 0))
+    {
+        throw gmxapi::ProtocolError("BinnedBlur requires a positive kernel cutoff and error tolerance.");
+    }
+    // Interpolation error h^2 / (8 sigma^2) <= tolerance.
+    const double maxSpacing = sigma * std::sqrt(8 * tolerance);
+    subdivisions_ = std::max(static_cast<size_t>(std::ceil(gridSpacing / maxSpacing)),
+                             size_t{1});
+    spacing_ = gridSpacing / subdivisions_;
+    radius_ = static_cast<size_t>(std::ceil(cutoff / spacing_));
+    fineLow_ = low - radius_ * spacing_;
+    // Grid point j is fine grid point j * subdivisions_ + radius_, and the kernel spans 2 * radius_ + 1
+    // fine grid points. One more point per phase leaves room for the upper neighbor of every sample.
+    phaseLength_ = numPoints_ + 2 * radius_ / subdivisions_ + 1;
+    weights_.resize(phaseLength_ * subdivisions_);
+
+    const double normalization = 1.0 / std::sqrt(2.0 * M_PI * sigma * sigma);
+    kernel_.resize(2 * radius_ + 1);
+    for (size_t i = 0;i < kernel_.size();++i)
+    {
+        const double offset = (static_cast<double>(i) - radius_) * spacing_;
+        kernel_[i] = normalization * std::exp(-offset * offset / (2 * sigma * sigma));
+    }
+
+    const double c = cutoff / sigma;
+    errorBound_ = spacing_ * spacing_ / (8 * sigma * sigma) + std::exp(-c * c / 2);
+    exactPointsPerSample_ = std::min(2 * cutoff / gridSpacing + 1,
+                                     static_cast<double>(numPoints_));
+}
+
+void BinnedBlur::operator()(const std::vector<double>& samples,
+                            double* grid)
+{
+    std::fill(weights_.begin(),
+              weights_.end(),
+              0.);
+    const double weight = 1.0 / samples.size();
+    const double inverseSpacing = 1.0 / spacing_;
+    const size_t numFinePoints = weights_.size();
+    for (const auto sample : samples)
+    {
+        const double position = (sample - fineLow_) * inverseSpacing;
+        if (!(position >= 0) || position >= numFinePoints - 1)
+        {
+            continue;
+        }
+        const auto lower = static_cast<size_t>(position);
+        const auto upper = lower + 1;
+        const double fraction = position - lower;
+        weights_[(lower % subdivisions_) * phaseLength_ + lower / subdivisions_] += (1 - fraction) * weight;
+        weights_[(upper % subdivisions_) * phaseLength_ + upper / subdivisions_] += fraction * weight;
+    }
+
+    // Grid point j sums kernel_[i] times fine grid point j * subdivisions_ + i. For each i, those
+    // fine grid points are contiguous in weights_, so the inner loop vectorizes.
+    std::fill(grid,
+              grid + numPoints_,
+              0.);
+    for (size_t i = 0;i < kernel_.size();++i)
+    {
+        const double coefficient = kernel_[i];
+        const double* fine = weights_.data() + (i % subdivisions_) * phaseLength_ + i / subdivisions_;
+        for (size_t j = 0;j < numPoints_;++j)
+        {
+            grid[j] += coefficient * fine[j];
+        }
+    }
+}
+
+bool BinnedBlur::fasterThanExact(size_t numSamples) const
+{
+    const double exactCost = exactTermCost * exactPointsPerSample_ * numSamples;
+    const double binnedCost = static_cast<double>(kernel_.size()) * numPoints_
+                              + binningCost * numSamples
+                              + weights_.size();
+    return binnedCost < exactCost;
+}
+
+} // end namespace plugin
@@ -0,0 +1,145 @@
+#ifndef RESTRAINT_BINNEDBLUR_H
+#define RESTRAINT_BINNEDBLUR_H
+
+/*! \file
+ * \brief Gaussian blur of many samples by linear binning and convolution.
+ *
+ * Blurring each sample onto the histogram grid costs an exponential per sample and grid point in
+ * the kernel support, so window updates become expensive for large numbers of samples. Binning the
+ * samples onto a fine grid first makes the cost of the Gaussian convolution independent of the
+ * number of samples.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cstddef>
+
+#include <vector>
+
+namespace plugin
+{
+
+/*!
+ * \brief How the samples of a window are blurred onto the histogram grid.
+ */
+enum class BlurMethod
+{
+    /// BinnedBlur if it is expected to be faster than the exact blur for the problem size.
+    Automatic,
+    /// Evaluate the Gaussian of every sample at every grid point in its support.
+    Exact,
+    /// Linear binning followed by convolution with a tabulated Gaussian (see BinnedBlur).
+    Binned
+};
+
+/*!
+ * \brief Blur samples onto a grid by linear binning and convolution with a truncated Gaussian.
+ *
+ * The samples are first distributed onto a fine grid with spacing h = gridSpacing / s, splitting
+ * each sample between its two neighboring fine grid points in proportion to its distance from
+ * them (linear binning, which conserves the number and the mean of the samples). The fine grid is
+ * then convolved with the Gaussian, sampled once at construction, at the points of the histogram
+ * grid. The convolution costs O(numPoints * cutoff / h), independent of the number of samples.
+ *
+ * Linear binning is equivalent to replacing the Gaussian of each sample with its linear
+ * interpolation between fine grid points, which differs from the Gaussian by at most
+ * h^2 / (8 sigma^2) times its peak. The kernel is truncated at the first fine grid point beyond
+ * the cutoff instead of at the cutoff, which adds terms smaller than exp(-c^2 / 2) times the peak
+ * for a cutoff of c sigma. Each value of the blurred grid therefore differs from the exact blur
+ * with the same cutoff by at most
+ *
+ *     (h^2 / (8 sigma^2) + exp(-c^2 / 2)) / (sqrt(2 pi) sigma),
+ *
+ * where 1 / (sqrt(2 pi) sigma) is the peak of a normalized Gaussian. The subdivision s is chosen as
+ * the smallest that makes h^2 / (8 sigma^2) no larger than the requested tolerance.
+ *
+ * Memory is allocated at construction only, so blurring does not touch the heap.
+ */
+class BinnedBlur
+{
+    public:
+        /*!
+         * \brief Prepare the fine grid and the Gaussian kernel.
+         *
+         * \param low coordinate of grid point zero.
+         * \param gridSpacing distance between grid points.
+         * \param numPoints number of grid points.
+         * \param sigma Gaussian parameter for blurring the samples.
+         * \param cutoff support radius of the Gaussian. Must be positive.
+         * \param tolerance bound on the binning error relative to the peak of a normalized Gaussian.
+         * \throws gmxapi::ProtocolError if the cutoff or tolerance is not positive.
+         */
+        BinnedBlur(double low,
+                   double gridSpacing,
+                   size_t numPoints,
+                   double sigma,
+                   double cutoff,
+                   double tolerance);
+
+        /*!
+         * \brief Overwrite a grid with the normalized blurred density of samples.
+         *
+         * Samples farther than the cutoff from the grid are ignored, as they are by the exact blur.
+         *
+         * \param samples values to be blurred onto the grid.
+         * \param grid destination for numPoints values.
+         */
+        void operator()(const std::vector<double>& samples,
+                        double* grid);
+
+        /*!
+         * \brief Number of fine grid intervals per grid spacing.
+         */
+        size_t subdivisions() const
+        {
+            return subdivisions_;
+        }
+
+        /*!
+         * \brief Bound on the difference from the exact blur, relative to the peak of a normalized Gaussian.
+         */
+        double errorBound() const
+        {
+            return errorBound_;
+        }
+
+        /*!
+         * \brief Whether blurring numSamples samples is expected to be faster than the exact blur.
+         *
+         * The exact blur evaluates an exponential for each sample and grid point in the kernel
+         * support. The binned blur costs a multiply-add for each grid point and fine grid point in
+         * the kernel support, which vectorizes well, plus a little work per sample.
+         */
+        bool fasterThanExact(size_t numSamples) const;
+
+    private:
+        size_t numPoints_;
+        size_t subdivisions_;
+        /// Number of fine grid points per phase (see weights_).
+        size_t phaseLength_;
+        /// Fine grid spacing.
+        double spacing_;
+        /// Coordinate of fine grid point zero, a kernel radius below grid point zero.
+        double fineLow_;
+        /// Kernel radius in fine grid points.
+        size_t radius_;
+        double errorBound_;
+        /// Number of grid points within the cutoff of a sample, as visited by the exact blur.
+        double exactPointsPerSample_;
+
+        /*!
+         * \brief Binned sample weights, stored by phase.
+         *
+         * Fine grid point m is stored at (m % subdivisions_) * phaseLength_ + m / subdivisions_, so
+         * that the fine grid points contributing to consecutive grid points with the same kernel
+         * value are contiguous.
+         */
+        std::vector<double> weights_;
+
+        /// Normalized Gaussian at fine grid offsets -radius_ through radius_.
+        std::vector<double> kernel_;
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_BINNEDBLUR_H
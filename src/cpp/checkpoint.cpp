@@ -0,0 +1,124 @@
+/*! \file
+ * \brief Implement the checkpoint file helpers declared in checkpoint.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+namespace
+{
+
+//! Length of the identifier at the start of a checkpoint.
+constexpr size_t magicLength = 8;
+
+//! Reads back as a different value if the file was written with a different byte order.
+constexpr uint32_t byteOrderMarker = 0x01020304;
+
+} // end anonymous namespace
+
+CheckpointWriter::CheckpointWriter(std::string filename,
+                                   const char* magic,
+                                   uint32_t version) :
+    filename_{std::move(filename)},
+    temporaryName_{filename_ + ".tmp"},
+    file_{temporaryName_.c_str(),
+          "wb"}
+{
+    if (file_.fh() == nullptr)
+    {
+        throw gmxapi::ProtocolError("Could not open checkpoint file " + temporaryName_ + " for writing.");
+    }
+    char header[magicLength] = {};
+    memcpy(header,
+           magic,
+           std::min(strlen(magic),
+                    magicLength));
+    write(header,
+          magicLength);
+    write(version);
+    write(byteOrderMarker);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    if (!committed_)
+    {
+        file_.close();
+        std::remove(temporaryName_.c_str());
+    }
+}
+
+void CheckpointWriter::writeBytes(const void* data,
+                                  size_t size)
+{
+    if (fwrite(data,
+               1,
+               size,
+               file_.fh()) != size)
+    {
+        throw gmxapi::ProtocolError("Could not write checkpoint file " + temporaryName_ + ".");
+    }
+}
+
+void CheckpointWriter::commit()
+{
+    const bool flushed = fflush(file_.fh()) == 0;
+    file_.close();
+    if (!flushed || std::rename(temporaryName_.c_str(),
+                                filename_.c_str()) != 0)
+    {
+        throw gmxapi::ProtocolError("Could not complete checkpoint file " + filename_ + ".");
+    }
+    committed_ = true;
+}
+
+CheckpointReader::CheckpointReader(const std::string& filename,
+                                   const char* magic) :
+    filename_{filename},
+    file_{filename.c_str(),
+          "rb"}
+{
+    if (file_.fh() == nullptr)
+    {
+        throw gmxapi::ProtocolError("Could not open checkpoint file " + filename_ + " for reading.");
+    }
+    char header[magicLength] = {};
+    read(header,
+         magicLength);
+    if (strncmp(header,
+                magic,
+                magicLength) != 0)
+    {
+        throw gmxapi::ProtocolError(filename_ + " is not a checkpoint of the expected kind.");
+    }
+    version_ = read<uint32_t>();
+    if (read<uint32_t>() != byteOrderMarker)
+    {
+        throw gmxapi::ProtocolError(filename_ + " was written on a machine with a different byte order.");
+    }
+}
+
+void CheckpointReader::readBytes(void* data,
+                                 size_t size)
+{
+    if (fread(data,
+              1,
+              size,
+              file_.fh()) != size)
+    {
+        throw gmxapi::ProtocolError("Checkpoint file " + filename_ + " is truncated.");
+    }
+}
+
+} // end namespace plugin
@@ -0,0 +1,162 @@
+#ifndef RESTRAINT_CHECKPOINT_H
+#define RESTRAINT_CHECKPOINT_H
+
+/*! \file
+ * \brief Binary checkpoint files for restraint state.
+ *
+ * A checkpoint file starts with an 8 character magic string identifying the kind of state, a
+ * 32-bit format version, and a 32-bit byte order marker, followed by the state as fixed-width
+ * values in native byte order. Files are written to a temporary name and renamed when complete,
+ * so an interrupted write never replaces the previous checkpoint.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cstdint>
+#include <cstdio>
+
+#include <string>
+#include <type_traits>
+
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Write a checkpoint file.
+ *
+ * Usage:
+ *
+ *     CheckpointWriter writer{filename, "ENSEMBLE", 1};
+ *     writer.write(value);
+ *     writer.write(array, count);
+ *     writer.commit();
+ *
+ * If commit() is not called, the destructor removes the temporary file and the previous
+ * checkpoint is left in place.
+ */
+class CheckpointWriter
+{
+    public:
+        /*!
+         * \brief Start a new checkpoint.
+         *
+         * \param filename name of the checkpoint file.
+         * \param magic 8 character identifier of the contents.
+         * \param version format version of the contents.
+         * \throws gmxapi::ProtocolError if the temporary file cannot be opened.
+         */
+        CheckpointWriter(std::string filename,
+                         const char* magic,
+                         uint32_t version);
+
+        ~CheckpointWriter();
+
+        CheckpointWriter(const CheckpointWriter&) = delete;
+
+        CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+        /*!
+         * \brief Write an array of fixed-width values.
+         *
+         * \throws gmxapi::ProtocolError on write failure.
+         */
+        template<typename T>
+        void write(const T* values,
+                   size_t count)
+        {
+            static_assert(std::is_arithmetic<T>::value, "Checkpoints only contain arithmetic values.");
+            writeBytes(values,
+                       sizeof(T) * count);
+        }
+
+        /*!
+         * \brief Write a fixed-width value.
+         */
+        template<typename T>
+        void write(const T& value)
+        {
+            write(&value,
+                  1);
+        }
+
+        /*!
+         * \brief Close the temporary file and move it to the checkpoint file name.
+         *
+         * \throws gmxapi::ProtocolError if the file cannot be completed.
+         */
+        void commit();
+
+    private:
+        void writeBytes(const void* data,
+                        size_t size);
+
+        std::string filename_;
+        std::string temporaryName_;
+        RAIIFile file_;
+        bool committed_{false};
+};
+
+/*!
+ * \brief Read a checkpoint file written by CheckpointWriter.
+ */
+class CheckpointReader
+{
+    public:
+        /*!
+         * \brief Open a checkpoint and check its header.
+         *
+         * \param filename name of the checkpoint file.
+         * \param magic expected 8 character identifier of the contents.
+         * \throws gmxapi::ProtocolError if the file cannot be read or has a different identifier or byte order.
+         */
+        CheckpointReader(const std::string& filename,
+                         const char* magic);
+
+        /*!
+         * \brief Format version of the checkpoint.
+         */
+        uint32_t version() const
+        {
+            return version_;
+        }
+
+        /*!
+         * \brief Read an array of fixed-width values.
+         *
+         * \throws gmxapi::ProtocolError if the file is too short.
+         */
+        template<typename T>
+        void read(T* values,
+                  size_t count)
+        {
+            static_assert(std::is_arithmetic<T>::value, "Checkpoints only contain arithmetic values.");
+            readBytes(values,
+                      sizeof(T) * count);
+        }
+
+        /*!
+         * \brief Read a fixed-width value.
+         */
+        template<typename T>
+        T read()
+        {
+            T value{};
+            read(&value,
+                 1);
+            return value;
+        }
+
+    private:
+        void readBytes(void* data,
+                       size_t size);
+
+        std::string filename_;
+        RAIIFile file_;
+        uint32_t version_{0};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_CHECKPOINT_H
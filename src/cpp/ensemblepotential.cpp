@@ -14,24 +14,163 @@
 
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 
+#include <algorithm>
+#include <chrono>
+#include <iostream>
 #include <memory>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "gmxapi/context.h"
+#include "gmxapi/exceptions.h"
 #include "gmxapi/session.h"
 #include "gmxapi/md/mdsignals.h"
 
+#include "checkpoint.h"
+#include "kernels.h"
 #include "sessionresources.h"
 
 namespace plugin
 {
 
+namespace
+{
+
+/*!
+ * \brief Find the grid points within a distance of a point.
+ *
+ * \param center coordinate around which to find grid points.
+ * \param halfWidth maximum distance from center.
+ * \param low coordinate of grid point zero.
+ * \param gridSpacing distance between grid points.
+ * \param numPoints number of grid points.
+ * \param first first grid point in [center - halfWidth, center + halfWidth]
+ * \param end one past the last grid point in [center - halfWidth, center + halfWidth]
+ *
+ * If no grid points are in range, *first == *end.
+ */
+void gridRange(double center,
+               double halfWidth,
+               double low,
+               double gridSpacing,
+               size_t numPoints,
+               size_t* first,
+               size_t* end)
+{
+    const double lower = std::ceil((center - halfWidth - low) / gridSpacing);
+    const double upper = std::floor((center + halfWidth - low) / gridSpacing) + 1;
+    *first = lower > 0 ? std::min(static_cast<size_t>(lower), numPoints) : 0;
+    *end = upper > 0 ? std::min(static_cast<size_t>(upper), numPoints) : 0;
+    *end = std::max(*first, *end);
+}
+
+/// Identifies EnsemblePotential checkpoints.
+const char* const checkpointMagic = "ENSEMBLE";
+
+/*!
+ * \brief Version of the EnsemblePotential checkpoint format.
+ *
+ * Increment when the layout written by EnsemblePotential::writeCheckpoint() changes.
+ */
+constexpr uint32_t checkpointVersion = 3;
+
+/*!
+ * \brief Mean time of a call, in nanoseconds.
+ *
+ * The number of calls is doubled until they take at least 100 microseconds, and the best of three
+ * such runs is returned, to reduce the influence of interrupts and frequency changes.
+ */
+template<class Function>
+double timeCall(Function&& function)
+{
+    using clock = std::chrono::steady_clock;
+    const std::chrono::duration<double> minTime{1e-4};
+    double best{0};
+    for (int run = 0;run < 3;++run)
+    {
+        size_t calls{1};
+        while (true)
+        {
+            const auto start = clock::now();
+            for (size_t i = 0;i < calls;++i)
+            {
+                function();
+            }
+            const std::chrono::duration<double> elapsed = clock::now() - start;
+            if (elapsed >= minTime)
+            {
+                const double nanoseconds = 1e9 * elapsed.count() / calls;
+                best = run == 0 ? nanoseconds : std::min(best, nanoseconds);
+                break;
+            }
+            calls *= 2;
+        }
+    }
+    return best;
+}
+
+/*!
+ * \brief Index of the fastest candidate.
+ */
+size_t fastest(const std::vector<AutotuneReport::Timing>& timings)
+{
+    return std::min_element(timings.begin(),
+                            timings.end(),
+                            [](const AutotuneReport::Timing& a, const AutotuneReport::Timing& b)
+                            {
+                                return a.nanoseconds < b.nanoseconds;
+                            }) - timings.begin();
+}
+
+} // end anonymous namespace
+
+std::string AutotuneReport::summary() const
+{
+    if (restored)
+    {
+        return "blur: " + chosenBlur + "; bias: " + chosenBias + " (restored from checkpoint)";
+    }
+    if (blur.empty() && bias.empty())
+    {
+        return {};
+    }
+    std::ostringstream stream;
+    const auto describe = [&stream](const char* label,
+                                    const std::string& chosen,
+                                    const std::vector<Timing>& timings)
+    {
+        stream << label << ": " << chosen << " (";
+        for (size_t i = 0;i < timings.size();++i)
+        {
+            stream << (i == 0 ? "" : ", ") << timings[i].name << " " << static_cast<long>(timings[i].nanoseconds) << " ns";
+        }
+        stream << ")";
+    };
+    if (!blur.empty())
+    {
+        describe("blur", chosenBlur, blur);
+    }
+    if (!bias.empty())
+    {
+        stream << (blur.empty() ? "" : "; ");
+        describe("bias", chosenBias, bias);
+    }
+    return stream.str();
+}
+
 /*!
  * \brief Discretize a density field on a grid.
  *
  * Apply a Gaussian blur when building a density grid for a list of values.
  * Normalize such that the area under each sample is 1.0/num_samples.
+ *
+ * If a cutoff is given, each sample only contributes to grid points within the cutoff
+ * distance. For a cutoff of c * sigma, each neglected contribution is smaller than
+ * exp(-c^2 / 2) times the peak contribution of the sample, and the total neglected
+ * density per sample is erfc(c / sqrt(2)) / num_samples (e.g. 3.7e-6 and 5.7e-7 for c = 5).
  */
 class BlurToGrid
 {
@@ -42,13 +181,23 @@ class BlurToGrid
          * \param low The coordinate value of the first grid point.
          * \param gridSpacing Distance between grid points.
          * \param sigma Gaussian parameter for blurring inputs onto the grid.
+         * \param cutoff Maximum distance between a sample and the grid points it contributes to,
+         * or zero to blur each sample onto the whole grid.
+         * \param accumulate kernel for double precision grids.
+         * \param accumulateFloat kernel for single precision grids.
          */
         BlurToGrid(double low,
                    double gridSpacing,
-                   double sigma) :
+                   double sigma,
+                   double cutoff = 0,
+                   GaussianAccumulateFunction accumulate = gaussianKernels().accumulate,
+                   GaussianAccumulateFloatFunction accumulateFloat = gaussianKernels().accumulateFloat) :
             low_{low},
             binWidth_{gridSpacing},
-            sigma_{sigma}
+            sigma_{sigma},
+            cutoff_{cutoff},
+            accumulate_{accumulate},
+            accumulateFloat_{accumulateFloat}
         {
         };
 
@@ -76,29 +225,68 @@ class BlurToGrid
         void operator()(const std::vector<double>& samples,
                         std::vector<double>* grid)
         {
-            const auto nbins = grid->size();
+            (*this)(samples,
+                    grid->data(),
+                    grid->size());
+        };
+
+        /*!
+         * \brief Accumulate a blurred histogram of samples into a grid of nbins points.
+         *
+         * \param samples A list of values to be blurred onto the grid.
+         * \param grid Destination for nbins values.
+         * \param nbins Number of grid points.
+         */
+        void operator()(const std::vector<double>& samples,
+                        double* grid,
+                        size_t nbins)
+        {
+            blur(samples, grid, nbins, accumulate_);
+        };
+
+        /*!
+         * \brief Accumulate a blurred histogram of samples into a single precision grid.
+         *
+         * \param samples A list of values to be blurred onto the grid.
+         * \param grid Destination for nbins values.
+         * \param nbins Number of grid points.
+         */
+        void operator()(const std::vector<double>& samples,
+                        float* grid,
+                        size_t nbins)
+        {
+            blur(samples, grid, nbins, accumulateFloat_);
+        };
+
+    private:
+        template<class Real, class Accumulate>
+        void blur(const std::vector<double>& samples,
+                  Real* grid,
+                  size_t nbins,
+                  Accumulate accumulate) const
+        {
             const double& dx{binWidth_};
             const auto num_samples = samples.size();
 
             const double denominator = 1.0 / (2 * sigma_ * sigma_);
             const double normalization = 1.0 / (num_samples * sqrt(2.0 * M_PI * sigma_ * sigma_));
-            // We aren't doing any filtering of values too far away to contribute meaningfully, which
-            // is admittedly wasteful for large sigma...
-            for (size_t i = 0;i < nbins;++i)
+
+            std::fill(grid, grid + nbins, Real(0));
+            for (const auto distance : samples)
             {
-                double bin_value{0};
-                const double bin_x{low_ + i * dx};
-                for (const auto distance : samples)
+                size_t first{0};
+                size_t end{nbins};
+                if (cutoff_ > 0)
                 {
-                    const double relative_distance{bin_x - distance};
-                    const auto numerator = -relative_distance * relative_distance;
-                    bin_value += normalization * exp(numerator * denominator);
+                    // Only visit the grid points within the kernel support of the sample.
+                    gridRange(distance, cutoff_, low_, dx, nbins, &first, &end);
                 }
-                grid->at(i) = bin_value;
+                // Without a cutoff, we aren't doing any filtering of values too far away to contribute
+                // meaningfully, which is admittedly wasteful for large sigma...
+                accumulate(distance, low_, dx, normalization, denominator, first, end, grid);
             }
-        };
+        }
 
-    private:
         /// Minimum value of bin zero
         const double low_;
 
@@ -107,6 +295,12 @@ class BlurToGrid
 
         /// Smoothing factor
         const double sigma_;
+
+        /// Kernel support radius, or zero for no cutoff.
+        const double cutoff_;
+
+        const GaussianAccumulateFunction accumulate_;
+        const GaussianAccumulateFloatFunction accumulateFloat_;
 };
 
 EnsemblePotential::EnsemblePotential(size_t nbins,
@@ -119,40 +313,113 @@ EnsemblePotential::EnsemblePotential(size_t nbins,
                                    unsigned int nWindows,
                                    double k,
                                    double sigma) :
-    nBins_{nbins},
-    binWidth_{binWidth},
-    minDist_{minDist},
-    maxDist_{maxDist},
-    histogram_(nbins,
-               0),
-    experimental_{std::move(experimental)},
-    nSamples_{nSamples},
-    currentSample_{0},
-    samplePeriod_{samplePeriod},
-    // In actuality, we have nsamples at (samplePeriod - dt), but we don't have access to dt.
-    nextSampleTime_{samplePeriod},
-    distanceSamples_(nSamples),
-    nWindows_{nWindows},
-    currentWindow_{0},
-    windowStartTime_{0},
-    nextWindowUpdateTime_{nSamples * samplePeriod},
-    windows_{},
-    k_{k},
-    sigma_{sigma}
+    EnsemblePotential(*makeEnsembleParams(nbins,
+                                          binWidth,
+                                          minDist,
+                                          maxDist,
+                                          experimental,
+                                          nSamples,
+                                          samplePeriod,
+                                          nWindows,
+                                          k,
+                                          sigma))
 {}
 
 EnsemblePotential::EnsemblePotential(const input_param_type& params) :
-    EnsemblePotential(params.nBins,
-                     params.binWidth,
-                     params.minDist,
-                     params.maxDist,
-                     params.experimental,
-                     params.nSamples,
-                     params.samplePeriod,
-                     params.nWindows,
-                     params.k,
-                     params.sigma)
+    nBins_{params.nBins},
+    binWidth_{params.binWidth},
+    gridOrigin_{params.gridOrigin},
+    minDist_{params.minDist},
+    maxDist_{params.maxDist},
+    histogram_(params.nBins,
+               0),
+    experimental_{params.experimental},
+    nSamples_{params.nSamples},
+    currentSample_{0},
+    samplePeriod_{params.samplePeriod},
+    distanceSamples_(params.nSamples),
+    nWindows_{params.nWindows},
+    currentWindow_{0},
+    averaging_{params.averaging},
+    arena_{WindowHistory::arenaBytes(numStoredWindows(params),
+                                     params.nBins)
+           + ExponentialAverage::arenaBytes(averaging_ == WindowAveraging::Exponential ? params.nBins : 0)
+           + 2 * AlignedArena::bytesFor<double>(params.nBins)},
+    windows_{numStoredWindows(params),
+             params.nBins,
+             0,
+             &arena_},
+    average_{params.nWindows,
+             averaging_ == WindowAveraging::Exponential ? params.nBins : 0,
+             &arena_},
+    localWindow_{1,
+                 params.nBins,
+                 &arena_},
+    reducedWindow_{1,
+                   params.nBins,
+                   &arena_},
+    k_{params.k},
+    sigma_{params.sigma}
 {
+    if (experimental_.size() != nBins_)
+    {
+        throw gmxapi::ProtocolError("The experimental distribution must have nbins values.");
+    }
+    sigmaCutoff_ = params.sigmaCutoff;
+    if (params.blurMethod == BlurMethod::Binned && !(sigmaCutoff_ > 0))
+    {
+        throw gmxapi::ProtocolError("The binned blur requires a positive sigmaCutoff.");
+    }
+    if (params.blurMethod != BlurMethod::Exact && sigmaCutoff_ > 0)
+    {
+        auto binned = std::make_unique<BinnedBlur>(gridOrigin_,
+                                                   binWidth_,
+                                                   nBins_,
+                                                   sigma_,
+                                                   sigmaCutoff_ * sigma_,
+                                                   params.blurTolerance);
+        // The autotuner times the binned blur even if the cost model prefers the exact blur.
+        if (params.blurMethod == BlurMethod::Binned || params.autotune || binned->fasterThanExact(nSamples_))
+        {
+            binnedBlur_ = std::move(binned);
+        }
+    }
+    kernelPrecision_ = params.kernelPrecision;
+    blurEvaluation_ = params.gaussianEvaluation;
+    biasEvaluation_ = params.gaussianEvaluation;
+    expAccuracy_ = params.expAccuracy;
+    if (params.gaussianEvaluation == GaussianEvaluation::Recurrence && kernelPrecision_ != KernelPrecision::Double)
+    {
+        throw gmxapi::ProtocolError("The Gaussian recurrence is only available in double precision.");
+    }
+    if (kernelPrecision_ == KernelPrecision::Single)
+    {
+        floatWindow_.resize(nBins_);
+    }
+    tablePointsPerBin_ = params.tablePointsPerBin;
+    reduceLag_ = params.reduceLag;
+    timeStep_ = params.timeStep;
+    checkpointFile_ = params.checkpointFile;
+    checkpointInterval_ = std::max(params.checkpointInterval, 1u);
+    autotune_ = params.autotune;
+    // The checkpoint may hold the decision of the autotuner.
+    if (!params.restartFile.empty())
+    {
+        restoreCheckpoint(params.restartFile);
+    }
+    if (autotune_ && !tuned_)
+    {
+        autotune(params.blurMethod);
+    }
+    if (!params.outputFile.empty())
+    {
+        // A restarted simulation continues the output of the run that wrote the checkpoint.
+        writer_ = std::make_unique<WindowWriter>(params.outputFile,
+                                                 nBins_,
+                                                 nSamples_,
+                                                 !params.restartFile.empty());
+    }
+    refreshHistogram();
 }
 
 //
@@ -170,14 +437,21 @@ void EnsemblePotential::callback(gmx::Vector v,
     const auto rdiff = v - v0;
     const auto Rsquared = dot(rdiff,
                               rdiff);
-    const auto R = sqrt(Rsquared);
+    callback(sqrt(Rsquared),
+             t,
+             resources);
+}
 
-    // Store historical data every sample_period steps
-    if (t >= nextSampleTime_)
+void EnsemblePotential::callback(double R,
+                                 double t,
+                                 const Resources& resources)
+{
+
+    // Apply a lagged reduction after exactly reduceLag_ steps.
+    if (reducePending_ && stepOf(t) >= applyStep_)
     {
-        distanceSamples_[currentSample_++] = R;
-        nextSampleTime_ = (currentSample_ + 1) * samplePeriod_ + windowStartTime_;
-    };
+        finishReduce();
+    }
 
     // Every nsteps:
     //   0. Drop oldest window
@@ -186,36 +460,17 @@ void EnsemblePotential::callback(gmx::Vector v,
     //   3. On update, checkpoint the historical data source.
     //   4. Update historic windows.
     //   5. Use handles retained from previous windows to reconstruct the smoothed working histogram
-    if (t >= nextWindowUpdateTime_)
+    if (sample(R,
+               t))
     {
-        // Get next histogram array, recycling old one if available.
-        std::unique_ptr<Matrix<double>> new_window = std::make_unique<Matrix<double>>(1,
-                                                                                              nBins_);
-        std::unique_ptr<Matrix<double>> temp_window;
-        if (windows_.size() == nWindows_)
+        // The pending reduction still uses localWindow_.
+        if (reducePending_)
         {
-            // Recycle the oldest window.
-            // \todo wrap this in a helper class that manages a buffer we can shuffle through.
-            windows_[0].swap(temp_window);
-            windows_.erase(windows_.begin());
-        }
-        else
-        {
-            auto new_temp_window = std::make_unique<Matrix<double>>(1,
-                                                                            nBins_);
-            assert(new_temp_window);
-            temp_window.swap(new_temp_window);
+            finishReduce();
         }
 
         // Reduce sampled data for this restraint in this simulation, applying a Gaussian blur to fill a grid.
-        auto blur = BlurToGrid(0.0,
-                               binWidth_,
-                               sigma_);
-        assert(new_window != nullptr);
-        assert(distanceSamples_.size() == nSamples_);
-        assert(currentSample_ == nSamples_);
-        blur(distanceSamples_,
-             new_window->vector());
+        blurWindow(localWindow_.data());
         // We can just do the blur locally since there aren't many bins. Bundling these operations for
         // all restraints could give us a chance at some parallelism. We should at least use some
         // threading if we can.
@@ -223,43 +478,604 @@ void EnsemblePotential::callback(gmx::Vector v,
         // We request a handle each time before using resources to make error handling easier if there is a failure in
         // one of the ensemble member processes and to give more freedom to how resources are managed from step to step.
         auto ensemble = resources.getHandle();
+        if (reduceLag_ > 0)
+        {
+            // Keep using the current bias while the ensemble catches up.
+            pendingReduce_ = ensemble.ireduce(localWindow_,
+                                              &reducedWindow_);
+            reducePending_ = true;
+            applyStep_ = stepOf(t) + reduceLag_;
+            startWindow(t);
+            return;
+        }
+
         // Get global reduction (sum) and checkpoint.
-        assert(temp_window != nullptr);
         // Todo: in reduce function, give us a mean instead of a sum.
-        ensemble.reduce(*new_window,
-                        temp_window.get());
+        ensemble.reduce(localWindow_,
+                        &reducedWindow_);
+
+        applyWindow(reducedWindow_.data(),
+                    t);
+    };
+
+}
+
+bool EnsemblePotential::updateDue(double t) const
+{
+    if (!scheduled_ || checkResumeStep_ || checkTimeStep_)
+    {
+        return true;
+    }
+    const auto step = stepOf(t);
+    return step >= nextSampleStep_ || step >= nextWindowStep_ || (reducePending_ && step >= applyStep_);
+}
 
-        // Update window list with smoothed data.
-        windows_.emplace_back(std::move(new_window));
+bool EnsemblePotential::schedule(double t)
+{
+    double startTime{t};
+    if (timeStep_ <= 0)
+    {
+        // Infer the time step from the first two updates.
+        if (!haveFirstUpdate_)
+        {
+            firstUpdateTime_ = t;
+            haveFirstUpdate_ = true;
+            return false;
+        }
+        if (!(t > firstUpdateTime_))
+        {
+            return false;
+        }
+        timeStep_ = t - firstUpdateTime_;
+        startTime = firstUpdateTime_;
+        // Two updates cannot tell whether steps were skipped between them.
+        checkTimeStep_ = true;
+        lastUpdateTime_ = t;
+    }
+    sampleSteps_ = std::max(1LL,
+                            llround(samplePeriod_ / timeStep_));
+    windowStartStep_ = stepOf(startTime);
+    nextSampleStep_ = windowStartStep_ + sampleSteps_;
+    nextWindowStep_ = windowStartStep_ + nSamples_ * sampleSteps_;
+    scheduled_ = true;
+    return true;
+}
 
-        // Get new histogram difference. Subtract the experimental distribution to get the values to use in our potential.
-        for (auto& bin : histogram_)
+bool EnsemblePotential::sample(double R,
+                               double t)
+{
+    if (!scheduled_ && !schedule(t))
+    {
+        return false;
+    }
+    if (checkTimeStep_ && t != lastUpdateTime_)
+    {
+        if (std::abs(t - lastUpdateTime_ - timeStep_) > 1e-3 * timeStep_)
         {
-            bin = 0;
+            throw gmxapi::ProtocolError("Could not infer the time step from updates that are not at consecutive steps. "
+                                        "Set the timeStep parameter.");
         }
-        for (const auto& window : windows_)
+        checkTimeStep_ = false;
+    }
+    const auto step = stepOf(t);
+    if (checkResumeStep_)
+    {
+        if (step < windowStartStep_ || step >= nextWindowStep_)
         {
-            for (size_t i = 0;i < window->cols();++i)
-            {
-                histogram_.at(i) += (window->vector()->at(i) - experimental_.at(i)) / windows_.size();
-            }
+            throw gmxapi::ProtocolError("The simulation resumed at step " + std::to_string(step)
+                                        + ", outside of the steps " + std::to_string(windowStartStep_)
+                                        + " to " + std::to_string(nextWindowStep_ - 1)
+                                        + " of the window in progress at the checkpoint.");
         }
+        checkResumeStep_ = false;
+    }
 
+    // Store historical data every sample_period steps. A window that is complete but not yet
+    // applied does not accept more samples.
+    if (currentSample_ < nSamples_ && step >= nextSampleStep_)
+    {
+        distanceSamples_[currentSample_++] = R;
+        nextSampleStep_ = windowStartStep_ + (currentSample_ + 1) * sampleSteps_;
+    };
 
-        // Note we do not have the integer timestep available here. Therefore, we can't guarantee that updates occur
-        // with the same number of MD steps in each interval, and the interval will effectively lose digits as the
-        // simulation progresses, so _update_period should be cleanly representable in binary. When we extract this
-        // to a facility, we can look for a part of the code with access to the current timestep.
-        windowStartTime_ = t;
-        nextWindowUpdateTime_ = nSamples_ * samplePeriod_ + windowStartTime_;
-        ++currentWindow_; // This is currently never used. I'm not sure it will be, either...
+    return step >= nextWindowStep_;
+}
 
-        // Reset sample bufering.
-        currentSample_ = 0;
-        // Reset sample times.
-        nextSampleTime_ = t + samplePeriod_;
-    };
+void EnsemblePotential::blurWindow(double* window)
+{
+    assert(distanceSamples_.size() == nSamples_);
+    assert(currentSample_ == nSamples_);
+    blurSamples(distanceSamples_,
+                window,
+                binnedBlur_.get(),
+                blurEvaluation_);
+
+    if (writer_)
+    {
+        // The samples are overwritten by the next window before a lagged reduction completes.
+        pendingRecord_.window = currentWindow_;
+        pendingRecord_.step = nextWindowStep_;
+        pendingRecord_.samples = distanceSamples_;
+        pendingRecord_.localHistogram.assign(window,
+                                             window + nBins_);
+    }
+}
+
+void EnsemblePotential::blurSamples(const std::vector<double>& samples,
+                                    double* window,
+                                    BinnedBlur* binned,
+                                    GaussianEvaluation evaluation)
+{
+    if (binned)
+    {
+        // The binned blur has no exponentials to evaluate in single precision.
+        (*binned)(samples,
+                  window);
+        return;
+    }
+    const auto& kernels = gaussianKernels(expAccuracy_);
+    auto blur = BlurToGrid(gridOrigin_,
+                           binWidth_,
+                           sigma_,
+                           sigmaCutoff_ * sigma_,
+                           evaluation == GaussianEvaluation::Recurrence
+                           ? &recurrenceAccumulate : kernels.accumulate,
+                           kernels.accumulateFloat);
+    if (kernelPrecision_ == KernelPrecision::Single)
+    {
+        // The ensemble reduction and window history stay in double precision.
+        blur(samples,
+             floatWindow_.data(),
+             nBins_);
+        std::copy(floatWindow_.begin(),
+                  floatWindow_.end(),
+                  window);
+    }
+    else
+    {
+        blur(samples,
+             window,
+             nBins_);
+    }
+}
+
+void EnsemblePotential::autotune(BlurMethod blurMethod)
+{
+    // Synthetic samples spread over the flat-bottom region (or the grid, without one), from the
+    // golden ratio sequence so that every window size covers the range evenly.
+    const bool flatBottom = maxDist_ > minDist_;
+    const double low = flatBottom ? minDist_ : gridOrigin_;
+    const double high = flatBottom ? maxDist_ : gridOrigin_ + (nBins_ - 1) * binWidth_;
+    const double goldenRatio = 0.5 * (std::sqrt(5.) - 1);
+    std::vector<double> samples(nSamples_);
+    for (size_t i = 0;i < samples.size();++i)
+    {
+        samples[i] = low + (high - low) * std::fmod((i + 1) * goldenRatio, 1.);
+    }
+    const bool recurrenceAvailable = kernelPrecision_ == KernelPrecision::Double;
+
+    std::vector<double> window(nBins_);
+    if (blurMethod != BlurMethod::Binned)
+    {
+        struct BlurCandidate
+        {
+            const char* name;
+            BinnedBlur* binned;
+            GaussianEvaluation evaluation;
+        };
+        std::vector<BlurCandidate> candidates{{"exact direct", nullptr, GaussianEvaluation::Direct}};
+        if (recurrenceAvailable)
+        {
+            candidates.push_back({"exact recurrence", nullptr, GaussianEvaluation::Recurrence});
+        }
+        if (binnedBlur_)
+        {
+            candidates.push_back({"binned", binnedBlur_.get(), GaussianEvaluation::Direct});
+        }
+        for (const auto& candidate : candidates)
+        {
+            autotuneReport_.blur.push_back({candidate.name,
+                                            timeCall([&]()
+                                                     {
+                                                         blurSamples(samples,
+                                                                     window.data(),
+                                                                     candidate.binned,
+                                                                     candidate.evaluation);
+                                                     })});
+        }
+        const auto& chosen = candidates[fastest(autotuneReport_.blur)];
+        autotuneReport_.chosenBlur = chosen.name;
+        blurEvaluation_ = chosen.evaluation;
+        if (!chosen.binned)
+        {
+            binnedBlur_.reset();
+        }
+    }
+
+    // Evaluate the bias of the synthetic window at distances across the same range.
+    blurSamples(samples,
+                window.data(),
+                binnedBlur_.get(),
+                blurEvaluation_);
+    BiasState state;
+    state.histogram.resize(nBins_);
+    for (size_t i = 0;i < nBins_;++i)
+    {
+        state.histogram[i] = window[i] - experimental_[i];
+    }
+    if (kernelPrecision_ == KernelPrecision::Single)
+    {
+        state.floatHistogram.assign(state.histogram.begin(),
+                                    state.histogram.end());
+    }
+    constexpr size_t numDistances{64};
+    std::vector<double> distances(numDistances);
+    for (size_t i = 0;i < numDistances;++i)
+    {
+        distances[i] = low + (high - low) * (i + 0.5) / numDistances;
+    }
+    // Keeps the evaluations from being optimized away.
+    volatile double sink{0};
+
+    std::vector<GaussianEvaluation> evaluations{GaussianEvaluation::Direct};
+    if (recurrenceAvailable)
+    {
+        evaluations.push_back(GaussianEvaluation::Recurrence);
+    }
+    for (const auto evaluation : evaluations)
+    {
+        biasEvaluation_ = evaluation;
+        const double nanoseconds = timeCall([&]()
+                                            {
+                                                for (const auto R : distances)
+                                                {
+                                                    sink += evaluateBias(state, R).force;
+                                                }
+                                            }) / numDistances;
+        autotuneReport_.bias.push_back({evaluation == GaussianEvaluation::Direct ? "direct" : "recurrence",
+                                        nanoseconds});
+    }
+    const size_t chosenEvaluation = fastest(autotuneReport_.bias);
+    biasEvaluation_ = evaluations[chosenEvaluation];
+    autotuneReport_.chosenBias = autotuneReport_.bias[chosenEvaluation].name;
+
+    // The table is rebuilt once per window, so its cost per step depends on the window length.
+    if (tabulated() && timeStep_ > 0)
+    {
+        const double fillTime = timeCall([&]() { updateTable(&state); });
+        const double lookupTime = timeCall([&]()
+                                           {
+                                               for (const auto R : distances)
+                                               {
+                                                   sink += state.table.lookup(R).force;
+                                               }
+                                           }) / numDistances;
+        const double stepsPerWindow = nSamples_ * std::max(llround(samplePeriod_ / timeStep_), 1LL);
+        autotuneReport_.bias.push_back({"table", lookupTime + fillTime / stepsPerWindow});
+        if (fastest(autotuneReport_.bias) == autotuneReport_.bias.size() - 1)
+        {
+            autotuneReport_.chosenBias = "table";
+        }
+        else
+        {
+            tablePointsPerBin_ = 0;
+        }
+    }
+    else if (tabulated())
+    {
+        // The rebuild cost per step is unknown until the time step is, so keep the requested table.
+        autotuneReport_.chosenBias = "table (untimed)";
+    }
+    tuned_ = true;
+    std::clog << "EnsemblePotential autotune: " << autotuneReport_.summary() << std::endl;
+}
+
+void EnsemblePotential::applyWindow(const double* window,
+                                    double t)
+{
+    updateHistogram(window);
+    startWindow(t);
+    checkpointIfDue();
+}
+
+void EnsemblePotential::updateHistogram(const double* window)
+{
+    // Get new histogram difference. Subtract the experimental distribution to get the values to use in our potential.
+    if (averaging_ == WindowAveraging::Exponential)
+    {
+        average_.push(window);
+        const double* mean = average_.mean();
+        for (size_t i = 0;i < nBins_;++i)
+        {
+            histogram_[i] = mean[i] - experimental_[i];
+        }
+    }
+    else
+    {
+        // Update window history with the ensemble data, replacing the oldest window if the history is full.
+        windows_.push(window);
+
+        const double* windowSum = windows_.sum();
+        const double numWindows = windows_.size();
+        for (size_t i = 0;i < nBins_;++i)
+        {
+            histogram_[i] = windowSum[i] / numWindows - experimental_[i];
+        }
+    }
+    refreshHistogram();
+
+    if (writer_)
+    {
+        pendingRecord_.reducedHistogram.assign(window,
+                                               window + nBins_);
+        pendingRecord_.difference = histogram_;
+        if (writer_->failed())
+        {
+            throw gmxapi::ProtocolError("Could not write the window output file.");
+        }
+        writer_->push(std::move(pendingRecord_));
+        pendingRecord_ = WindowRecord();
+    }
+}
+
+void EnsemblePotential::startWindow(double t)
+{
+    // Windows are scheduled in whole steps, so every ensemble member updates at the same step
+    // no matter how long the simulation runs.
+    windowStartStep_ = stepOf(t);
+    nextWindowStep_ = windowStartStep_ + nSamples_ * sampleSteps_;
+    ++currentWindow_; // This is currently never used. I'm not sure it will be, either...
+
+    // Reset sample bufering.
+    currentSample_ = 0;
+    // Reset sample times.
+    nextSampleStep_ = windowStartStep_ + sampleSteps_;
+}
+
+void EnsemblePotential::finishReduce()
+{
+    if (!pendingReduce_.test())
+    {
+        ++blockingWaits_;
+        pendingReduce_.wait();
+    }
+    reducePending_ = false;
+    updateHistogram(reducedWindow_.data());
+    checkpointIfDue();
+}
+
+void EnsemblePotential::checkpointIfDue()
+{
+    if (checkpointFile_.empty() || ++updatesSinceCheckpoint_ < checkpointInterval_)
+    {
+        return;
+    }
+    // Reset first, so that the checkpoint restores the count after this checkpoint.
+    updatesSinceCheckpoint_ = 0;
+    writeCheckpoint(checkpointFile_);
+}
+
+void EnsemblePotential::writeCheckpoint(const std::string& filename) const
+{
+    if (reducePending_)
+    {
+        throw gmxapi::ProtocolError("Cannot checkpoint an EnsemblePotential while a reduction is pending.");
+    }
+    CheckpointWriter writer{filename,
+                            checkpointMagic,
+                            checkpointVersion};
+
+    // Parameters that determine the layout and meaning of the state.
+    writer.write<uint64_t>(nBins_);
+    writer.write<uint32_t>(nSamples_);
+    writer.write<uint64_t>(nWindows_);
+    writer.write(binWidth_);
+    writer.write(gridOrigin_);
+    writer.write(samplePeriod_);
+
+    // Algorithms chosen by the autotuner, if it ran.
+    writer.write<uint8_t>(tuned_);
+    writer.write<uint8_t>(binnedBlur_ != nullptr);
+    writer.write<uint8_t>(static_cast<uint8_t>(blurEvaluation_));
+    writer.write<uint8_t>(static_cast<uint8_t>(biasEvaluation_));
+    writer.write<uint8_t>(tabulated());
+
+    // Update schedule.
+    writer.write<uint64_t>(currentWindow_);
+    writer.write(timeStep_);
+    writer.write(firstUpdateTime_);
+    writer.write<uint8_t>(haveFirstUpdate_);
+    writer.write<uint8_t>(scheduled_);
+    writer.write<int64_t>(sampleSteps_);
+    writer.write<int64_t>(windowStartStep_);
+    writer.write<int64_t>(nextSampleStep_);
+    writer.write<int64_t>(nextWindowStep_);
+    writer.write<uint32_t>(updatesSinceCheckpoint_);
+
+    // Samples of the current window.
+    writer.write<uint32_t>(currentSample_);
+    writer.write(distanceSamples_.data(),
+                 distanceSamples_.size());
+
+    // Window history, oldest first, or the running average, and the bias.
+    writer.write<uint8_t>(static_cast<uint8_t>(averaging_));
+    if (averaging_ == WindowAveraging::Exponential)
+    {
+        writer.write<uint64_t>(average_.updates());
+        writer.write(average_.mean(),
+                     nBins_);
+    }
+    else
+    {
+        writer.write<uint64_t>(windows_.size());
+        writer.write<uint64_t>(windows_.updatesSinceResync());
+        for (size_t age = 0;age < windows_.size();++age)
+        {
+            writer.write(windows_.window(age),
+                         nBins_);
+        }
+        writer.write(windows_.sum(),
+                     nBins_);
+    }
+    writer.write(histogram_.data(),
+                 nBins_);
+
+    writer.commit();
+}
+
+void EnsemblePotential::restoreCheckpoint(const std::string& filename)
+{
+    CheckpointReader reader{filename,
+                            checkpointMagic};
+    if (reader.version() != checkpointVersion)
+    {
+        throw gmxapi::ProtocolError("Unsupported EnsemblePotential checkpoint version in " + filename + ".");
+    }
+
+    const auto nBins = reader.read<uint64_t>();
+    const auto nSamples = reader.read<uint32_t>();
+    const auto nWindows = reader.read<uint64_t>();
+    const auto binWidth = reader.read<double>();
+    const auto gridOrigin = reader.read<double>();
+    const auto samplePeriod = reader.read<double>();
+    if (nBins != nBins_ || nSamples != nSamples_ || nWindows != nWindows_ || binWidth != binWidth_
+        || gridOrigin != gridOrigin_ || samplePeriod != samplePeriod_)
+    {
+        throw gmxapi::ProtocolError("Checkpoint " + filename + " was written for different restraint parameters.");
+    }
+
+    const bool tuned = reader.read<uint8_t>() != 0;
+    const bool binned = reader.read<uint8_t>() != 0;
+    const auto blurEvaluation = reader.read<uint8_t>();
+    const auto biasEvaluation = reader.read<uint8_t>();
+    const bool table = reader.read<uint8_t>() != 0;
+    const auto recurrence = static_cast<uint8_t>(GaussianEvaluation::Recurrence);
+    if (blurEvaluation > recurrence || biasEvaluation > recurrence)
+    {
+        throw gmxapi::ProtocolError("Checkpoint " + filename + " is corrupt.");
+    }
+    if (autotune_ && tuned)
+    {
+        restoreTuning(filename,
+                      binned,
+                      static_cast<GaussianEvaluation>(blurEvaluation),
+                      static_cast<GaussianEvaluation>(biasEvaluation),
+                      table);
+    }
+
+    currentWindow_ = reader.read<uint64_t>();
+    const auto timeStep = reader.read<double>();
+    if (timeStep_ > 0 && timeStep > 0 && timeStep != timeStep_)
+    {
+        throw gmxapi::ProtocolError("Checkpoint " + filename + " was written with a different time step.");
+    }
+    timeStep_ = timeStep > 0 ? timeStep : timeStep_;
+    firstUpdateTime_ = reader.read<double>();
+    haveFirstUpdate_ = reader.read<uint8_t>() != 0;
+    scheduled_ = reader.read<uint8_t>() != 0;
+    sampleSteps_ = reader.read<int64_t>();
+    windowStartStep_ = reader.read<int64_t>();
+    nextSampleStep_ = reader.read<int64_t>();
+    nextWindowStep_ = reader.read<int64_t>();
+    updatesSinceCheckpoint_ = reader.read<uint32_t>();
+
+    currentSample_ = reader.read<uint32_t>();
+    if (currentSample_ > nSamples_)
+    {
+        throw gmxapi::ProtocolError("Checkpoint " + filename + " is corrupt.");
+    }
+    reader.read(distanceSamples_.data(),
+                distanceSamples_.size());
+
+    if (reader.read<uint8_t>() != static_cast<uint8_t>(averaging_))
+    {
+        throw gmxapi::ProtocolError("Checkpoint " + filename + " was written for a different window averaging.");
+    }
+    if (averaging_ == WindowAveraging::Exponential)
+    {
+        const auto updates = reader.read<uint64_t>();
+        std::vector<double> mean(nBins_);
+        reader.read(mean.data(),
+                    mean.size());
+        average_.restore(updates,
+                         mean.data());
+    }
+    else
+    {
+        const auto numWindows = reader.read<uint64_t>();
+        const auto updatesSinceResync = reader.read<uint64_t>();
+        if (numWindows > nWindows_)
+        {
+            throw gmxapi::ProtocolError("Checkpoint " + filename + " is corrupt.");
+        }
+        std::vector<double> windows(numWindows * nBins_);
+        std::vector<double> sum(nBins_);
+        reader.read(windows.data(),
+                    windows.size());
+        reader.read(sum.data(),
+                    sum.size());
+        windows_.restore(numWindows,
+                         windows.data(),
+                         sum.data(),
+                         updatesSinceResync);
+    }
+    reader.read(histogram_.data(),
+                nBins_);
+
+    reducePending_ = false;
+    checkResumeStep_ = scheduled_;
+    refreshHistogram();
+}
+
+void EnsemblePotential::restoreTuning(const std::string& filename,
+                                      bool binned,
+                                      GaussianEvaluation blurEvaluation,
+                                      GaussianEvaluation biasEvaluation,
+                                      bool table)
+{
+    const bool recurrence = blurEvaluation == GaussianEvaluation::Recurrence
+                            || biasEvaluation == GaussianEvaluation::Recurrence;
+    if ((binned && !binnedBlur_) || (recurrence && kernelPrecision_ != KernelPrecision::Double)
+        || (table && tablePointsPerBin_ == 0))
+    {
+        throw gmxapi::ProtocolError("Checkpoint " + filename + " was tuned for algorithms that are not available with these parameters.");
+    }
+    if (!binned)
+    {
+        binnedBlur_.reset();
+    }
+    blurEvaluation_ = blurEvaluation;
+    biasEvaluation_ = biasEvaluation;
+    if (!table)
+    {
+        tablePointsPerBin_ = 0;
+    }
+    tuned_ = true;
 
+    autotuneReport_ = AutotuneReport();
+    autotuneReport_.restored = true;
+    autotuneReport_.chosenBlur = binned ? "binned"
+                                 : blurEvaluation == GaussianEvaluation::Direct ? "exact direct" : "exact recurrence";
+    autotuneReport_.chosenBias = tabulated() ? "table"
+                                 : biasEvaluation == GaussianEvaluation::Direct ? "direct" : "recurrence";
+}
+
+void EnsemblePotential::refreshHistogram()
+{
+    // Readers of the previously published state are done with it by the time a new window
+    // completes, so back() does not normally wait.
+    BiasState& next = bias_.back();
+    next.histogram = histogram_;
+    if (kernelPrecision_ == KernelPrecision::Single)
+    {
+        next.floatHistogram.assign(histogram_.begin(),
+                                   histogram_.end());
+    }
+    updateTable(&next);
+    bias_.publish();
+    histogramUpdated();
+    biasGeneration_.fetch_add(1,
+                              std::memory_order_release);
 }
 
 
@@ -275,51 +1091,89 @@ gmx::PotentialPointData EnsemblePotential::calculate(gmx::Vector v,
     // This is not the vector from v to v0. It is the position of a site
     // at v, relative to the origin v0. This is a potentially confusing convention...
     const auto rdiff = v - v0;
-    const auto Rsquared = dot(rdiff,
-                              rdiff);
-    const auto R = sqrt(Rsquared);
+    return calculateAt(rdiff,
+                       sqrt(dot(rdiff,
+                                rdiff)));
+}
 
+gmx::PotentialPointData EnsemblePotential::calculateAt(gmx::Vector rdiff,
+                                                      double R)
+{
+    return pairForce(rdiff,
+                     R,
+                     [this](double R)
+                     {
+                         const auto bias = bias_.read();
+                         // Use the table if it has been built for the current histogram.
+                         return bias->table.empty() ? evaluateBias(*bias, R) : bias->table.lookup(R);
+                     });
+}
 
-    // Compute output
-    gmx::PotentialPointData output;
-    // Energy not needed right now.
-//    output.energy = 0;
+BiasPoint EnsemblePotential::evaluateBias(double R) const
+{
+    return evaluateBias(*bias_.read(),
+                        R);
+}
 
-    if (R != 0) // Direction of force is ill-defined when v == v0
+BiasPoint EnsemblePotential::evaluateBias(const BiasState& state,
+                                          double R) const
+{
+    const PairHist& histogram = state.histogram;
+    // Only visit the bins within the kernel support, if a cutoff is set.
+    size_t first{0};
+    size_t end{histogram.size()};
+    if (sigmaCutoff_ > 0)
     {
+        gridRange(R, sigmaCutoff_ * sigma_, gridOrigin_, binWidth_, histogram.size(), &first, &end);
+    }
 
-        double f{0};
+    double sums[3];
+    if (kernelPrecision_ == KernelPrecision::Single)
+    {
+        gaussianKernels(expAccuracy_).momentsFloat(state.floatHistogram.data(), gridOrigin_, binWidth_, R, 0.5 / (sigma_ * sigma_), first, end, sums);
+    }
+    else
+    {
+        const auto moments = biasEvaluation_ == GaussianEvaluation::Recurrence
+                             ? &recurrenceMoments : gaussianKernels(expAccuracy_).moments;
+        moments(histogram.data(), gridOrigin_, binWidth_, R, 0.5 / (sigma_ * sigma_), first, end, sums);
+    }
+    return biasFromMoments(sums);
+}
 
-        if (R > maxDist_)
-        {
-            // apply a force to reduce R
-            f = k_ * (maxDist_ - R);
-        }
-        else if (R < minDist_)
-        {
-            // apply a force to increase R
-            f = k_ * (minDist_ - R);
-        }
-        else
-        {
-            double f_scal{0};
+BiasPoint EnsemblePotential::biasFromMoments(const double* sums) const
+{
+    // The bias energy is k times the sum of the histogram difference convolved with a
+    // normalized Gaussian, so the force is k times the sum of the Gaussian derivatives.
+    const double inverseVariance{1. / (sigma_ * sigma_)};
 
-            const size_t numBins = histogram_.size();
-            double normConst = sqrt(2 * M_PI) * sigma_ * sigma_ * sigma_;
+    // The sums are moments of x = gridOrigin_ + n * binWidth_ - R weighted by the Gaussian terms.
+    const double energy{sums[0]};
+    const double f_scal{sums[1]};
+    const double df_scal{sums[2] * inverseVariance - sums[0]};
 
-            for (size_t n = 0;n < numBins;n++)
-            {
-                const double x{n * binWidth_ - R};
-                const double argExp{-0.5 * x * x / (sigma_ * sigma_)};
-                f_scal += histogram_.at(n) * exp(argExp) * x / normConst;
-            }
-            f = -k_ * f_scal;
-        }
+    const double normConst = sqrt(2 * M_PI) * sigma_;
+    BiasPoint point;
+    point.energy = k_ * energy / normConst;
+    point.force = -k_ * f_scal * inverseVariance / normConst;
+    point.forceDerivative = -k_ * df_scal * inverseVariance / normConst;
+    return point;
+}
 
-        const auto magnitude = f / norm(rdiff);
-        output.force = rdiff * static_cast<decltype(rdiff[0])>(magnitude);
+void EnsemblePotential::updateTable(BiasState* state) const
+{
+    // The table only covers the interior of the flat-bottom potential.
+    if (!tabulated())
+    {
+        return;
+    }
+    if (state->table.empty())
+    {
+        state->table = BiasTable(minDist_,
+                                 maxDist_,
+                                 binWidth_ / tablePointsPerBin_);
     }
-    return output;
+    state->table.fill([this, state](double R) { return evaluateBias(*state, R); });
 }
 
 std::unique_ptr<ensemble_input_param_type>
@@ -346,10 +1200,31 @@ makeEnsembleParams(size_t nbins,
     params->nWindows = nWindows;
     params->k = k;
     params->sigma = sigma;
+    // Optional parameters keep the defaults from ensemble_input_param_type.
 
     return params;
 };
 
+PairHist experimentalOnGrid(const PairHist& experimental,
+                            size_t nBins,
+                            double binWidth,
+                            double gridOrigin)
+{
+    if (experimental.size() == nBins)
+    {
+        return experimental;
+    }
+    const double offset{gridOrigin / binWidth};
+    const long long skipped{llround(offset)};
+    if (skipped < 0 || std::abs(offset - skipped) > 1e-6
+        || experimental.size() != static_cast<size_t>(skipped) + nBins)
+    {
+        throw gmxapi::ProtocolError("The experimental distribution must have nbins values, or one value per bin from zero distance to the end of the grid.");
+    }
+    return PairHist(experimental.begin() + skipped,
+                    experimental.end());
+}
+
 // Important: Explicitly instantiate a definition for the templated class declared in ensemblepotential.h.
 // Failing to do this will cause a linker error.
 template
@@ -17,9 +17,14 @@
  * \author M. Eric Irrgang <ericirrgang@gmail.com>
  */
 
+#include <cmath>
+#include <cstdint>
+
 #include <array>
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include "gmxapi/gromacsfwd.h"
@@ -29,7 +34,15 @@
 #include "gromacs/restraint/restraintpotential.h"
 #include "gromacs/utility/real.h"
 
+#include "biastable.h"
+#include "binnedblur.h"
+#include "kernels.h"
+#include "pairevaluator.h"
 #include "sessionresources.h"
+#include "snapshotbuffer.h"
+#include "stepcache.h"
+#include "windowhistory.h"
+#include "windowwriter.h"
 
 namespace plugin
 {
@@ -37,11 +50,30 @@ namespace plugin
 // Histogram for a single restrained pair.
 using PairHist = std::vector<double>;
 
+/*!
+ * \brief How the ensemble-averaged windows are combined into the sampled distribution.
+ */
+enum class WindowAveraging
+{
+    /// Mean of the last nWindows windows, stored in a WindowHistory.
+    Sliding,
+    /// Exponentially weighted mean with the decay of an nWindows sliding window (see ExponentialAverage).
+    Exponential
+};
+
 struct ensemble_input_param_type
 {
     /// distance histogram parameters
     size_t nBins{0};
     double binWidth{0.};
+    /*!
+     * \brief Distance of the first histogram bin.
+     *
+     * Bin n is at gridOrigin + n * binWidth. The experimental distribution uses the same bins.
+     * Distances below minDist only feel the flat-bottom force, so the bins can start near minDist
+     * (less the kernel width) to save memory and blur and force work.
+     */
+    double gridOrigin{0.};
 
     /// Flat-bottom potential boundaries.
     double minDist{0};
@@ -57,11 +89,158 @@ struct ensemble_input_param_type
     /// Number of windows to use for smoothing histogram updates.
     unsigned int nWindows{0};
 
+    /*!
+     * \brief Smoothing of the histogram over windows.
+     *
+     * WindowAveraging::Sliding stores nWindows windows. WindowAveraging::Exponential only stores a
+     * running average, with the same mean age of the windows as a sliding window of nWindows, so
+     * memory per restraint does not depend on nWindows.
+     */
+    WindowAveraging averaging{WindowAveraging::Sliding};
+
     /// Harmonic force coefficient
     double k{0};
     /// Smoothing factor: width of Gaussian interpolation for histogram
     double sigma{0};
 
+    /*!
+     * \brief Support of the Gaussian kernels, in units of sigma.
+     *
+     * If non-zero, histogram blurring and the bias force sum only visit bins within
+     * sigmaCutoff * sigma of the sample or pair distance. Each neglected term is smaller than
+     * exp(-sigmaCutoff^2 / 2) times the peak term. For a cutoff c >= 1, the neglected bias force
+     * is bounded by 2 k max|h| exp(-c^2 / 2) (c + sigma / binWidth) / (sqrt(2 pi) sigma^2), where
+     * max|h| is the largest magnitude in the histogram difference. A cutoff of 5 to 6 makes the
+     * truncation error negligible compared to the statistical noise of the histogram.
+     * Zero disables truncation.
+     */
+    double sigmaCutoff{0};
+
+    /*!
+     * \brief Resolution of the tabulated bias force, in table nodes per histogram bin.
+     *
+     * If non-zero, the bias force and energy between minDist and maxDist are tabulated at each
+     * window update and interpolated in calculate(). If zero, the Gaussian sum over all histogram
+     * bins is evaluated directly for every force calculation.
+     */
+    unsigned int tablePointsPerBin{0};
+
+    /*!
+     * \brief Algorithm for blurring the samples of a window onto the histogram.
+     *
+     * BlurMethod::Binned bins the samples on a fine grid and convolves it with the Gaussian (see
+     * BinnedBlur), at a cost that does not depend on nSamples, and requires a sigmaCutoff.
+     * BlurMethod::Automatic uses it when a cutoff is set and it is expected to be faster than
+     * the exact blur for nSamples samples, which is typically when nSamples is several times
+     * larger than nBins.
+     */
+    BlurMethod blurMethod{BlurMethod::Automatic};
+
+    /*!
+     * \brief Bound on the binning error of BlurMethod::Binned, relative to the peak of a normalized Gaussian.
+     *
+     * Each blurred histogram value differs from the exact blur by at most
+     * (blurTolerance + exp(-sigmaCutoff^2 / 2)) / (sqrt(2 pi) sigma). The cost of the binned blur
+     * grows as 1 / sqrt(blurTolerance).
+     */
+    double blurTolerance{1e-5};
+
+    /*!
+     * \brief Precision of the histogram blur and the Gaussian sum for the bias force.
+     *
+     * With KernelPrecision::Single, the blurred windows and the bias are evaluated with single
+     * precision Gaussian terms, with compensated sums for the bias. The relative error of the bias
+     * force is about 1e-5 of the sum of the magnitudes of its terms, which is below the precision of
+     * the forces in a GROMACS mixed precision build. Window history and ensemble averages stay in
+     * double precision, so errors do not accumulate over windows.
+     */
+    KernelPrecision kernelPrecision{KernelPrecision::Double};
+
+    /*!
+     * \brief Accuracy of exp() in the histogram blur and the Gaussian sum for the bias force.
+     *
+     * ExpAccuracy::Relative1e7 and ExpAccuracy::Relative1e4 bound the relative error of each
+     * Gaussian term, and so of the blurred windows and of the bias energy and force relative to
+     * the sum of the magnitudes of their terms, by 1e-7 and 1e-4. Both are well below the
+     * statistical noise of the sampled histogram.
+     */
+    ExpAccuracy expAccuracy{ExpAccuracy::Full};
+
+    /*!
+     * \brief Evaluation of the Gaussian terms of the exact blur and of the bias force sum.
+     *
+     * GaussianEvaluation::Recurrence generates the terms over the bins with three exp() calls per
+     * sample or force evaluation instead of one per bin (see recurrenceAccumulate()), and stops
+     * where the terms become negligible. It is exact up to rounding, with a relative error of
+     * about 1e-13 for 100 bins. The recurrence is scalar, so it is faster than the vectorized
+     * direct kernels for narrow kernels without a sigmaCutoff (about 5x faster for 100 bins with
+     * sigma of half a bin) and slower for wide kernels. Only available with KernelPrecision::Double.
+     */
+    GaussianEvaluation gaussianEvaluation{GaussianEvaluation::Direct};
+
+    /*!
+     * \brief Time the candidate algorithms at construction and keep the fastest.
+     *
+     * The autotuner blurs a synthetic window of nSamples samples and evaluates the resulting bias
+     * across the flat-bottom region with each candidate, on the actual parameters and host:
+     *
+     *  - blur: the exact blur with direct and recurrence Gaussian terms, and the binned blur if
+     *    blurMethod is BlurMethod::Automatic and a sigmaCutoff is set. These replace blurMethod
+     *    and gaussianEvaluation.
+     *  - bias: the direct and recurrence Gaussian sums, replacing gaussianEvaluation, and, if
+     *    tablePointsPerBin and timeStep are set, the table with its rebuild cost spread over
+     *    the steps of a window.
+     *
+     * Every candidate meets the accuracy requested by the other parameters: the recurrence is
+     * exact up to rounding, the binned blur is bounded by blurTolerance, and the table is only a
+     * candidate if requested. The decision and the timings are written to std::clog and are
+     * available from EnsemblePotential::autotuneReport(). Tuning takes a few milliseconds.
+     *
+     * The decision is saved in checkpoints. A restraint restarted from a checkpoint of a tuned
+     * restraint reuses the saved decision instead of tuning again, so a restarted run applies the
+     * same algorithms as the run it continues. Each ensemble member times the candidates on its
+     * own host, so members may choose differently within the accuracies above.
+     */
+    bool autotune{false};
+
+    /*!
+     * \brief Number of steps between the end of a window and the update of the bias.
+     *
+     * If zero, the ensemble reduction at the end of a window blocks until all ensemble members
+     * arrive, and the new bias is used immediately. Otherwise, the reduction is started without
+     * blocking, the previous bias remains in effect, and the new bias is applied exactly
+     * reduceLag steps later, waiting for the reduction only if it has not completed by then.
+     * The trajectory therefore does not depend on communication timing. A new window boundary
+     * completes the pending update first.
+     */
+    unsigned int reduceLag{0};
+
+    /*!
+     * \brief MD time step (ps), used to schedule updates by step number.
+     *
+     * Sampling and window updates are scheduled in integer steps, with a sample every
+     * round(samplePeriod / timeStep) steps (at least one) starting from the first step at which
+     * the restraint is updated. If zero, the time step is the difference between the simulation
+     * times of the first two updates, which must be at consecutive steps. The third update must
+     * follow after the same interval, or sample() throws gmxapi::ProtocolError.
+     */
+    double timeStep{0};
+
+    /// Name of the checkpoint file written at window updates, or empty for no checkpoints.
+    std::string checkpointFile{};
+    /// Number of window updates between checkpoints.
+    unsigned int checkpointInterval{1};
+    /// Name of a checkpoint file from which to restore the state at construction, or empty to start fresh.
+    std::string restartFile{};
+
+    /*!
+     * \brief Name of a file for the samples and histograms of each window, or empty for no output.
+     *
+     * The file is written by a background thread (see WindowWriter), with an index in a second
+     * file with ".index" appended to the name. With a restartFile, the output is appended to the
+     * existing files.
+     */
+    std::string outputFile{};
 };
 
 // \todo We should be able to automate a lot of the parameter setting stuff
@@ -81,6 +260,52 @@ makeEnsembleParams(size_t nbins,
                    double k,
                    double sigma);
 
+/*!
+ * \brief Get the experimental distribution on the bins of a grid with an origin.
+ *
+ * Experimental distributions are often tabulated from zero distance. If experimental has nBins
+ * values, it is returned unchanged. Otherwise it must have one value per bin from zero distance
+ * through the last bin of the grid, and the values below gridOrigin are dropped.
+ *
+ * \param experimental distribution on the grid, or on the bins starting at zero distance.
+ * \param nBins number of bins of the grid.
+ * \param binWidth bin width of both grids.
+ * \param gridOrigin distance of the first bin of the grid, a multiple of binWidth if cropping is needed.
+ * \return nBins values.
+ * \throws gmxapi::ProtocolError if experimental does not match either grid.
+ */
+PairHist experimentalOnGrid(const PairHist& experimental,
+                            size_t nBins,
+                            double binWidth,
+                            double gridOrigin);
+
+/*!
+ * \brief Timings measured and algorithms chosen by the autotuner of an EnsemblePotential.
+ */
+struct AutotuneReport
+{
+    /// A candidate algorithm and its mean time per call.
+    struct Timing
+    {
+        std::string name;
+        double nanoseconds;
+    };
+
+    /// Blur candidates, timed per window.
+    std::vector<Timing> blur;
+    /// Bias candidates, timed per force evaluation.
+    std::vector<Timing> bias;
+    std::string chosenBlur;
+    std::string chosenBias;
+    /// Whether the choice was restored from a checkpoint rather than timed.
+    bool restored{false};
+
+    /*!
+     * \brief One line describing the decision and the timings, or an empty string if nothing was tuned.
+     */
+    std::string summary() const;
+};
+
 /*!
  * \brief a residue-pair bias calculator for use in restrained-ensemble simulations.
  *
@@ -113,6 +338,8 @@ class EnsemblePotential
          */
         explicit EnsemblePotential(const input_param_type& params);
 
+        virtual ~EnsemblePotential() = default;
+
         /*!
          * \brief Deprecated constructor taking a parameter list.
          *
@@ -146,18 +373,34 @@ class EnsemblePotential
          * update class member data (see ``ensemblepotential.cpp``. For a more controlled API hook
          * and to manage state in the object, use ``callback()``.
          *
+         * The bias is read from an immutable snapshot published by callback() (see SnapshotBuffer),
+         * so calculate() may be called from any number of threads, concurrently with callback(),
+         * without locks.
+         *
          * \param v position of the site for which force is being calculated.
          * \param v0 reference site (other member of the pair).
          * \param t current simulation time (ps).
          * \return container for force and potential energy data.
          */
-        // Implementation note for the future: If dispatching this virtual function is not fast
-        // enough, the compiler may be able to better optimize a free
-        // function that receives the current restraint as an argument.
+        // Implementation note: callers that find the virtual dispatch through
+        // gmx::IRestraintPotential::evaluate() too slow can use a PairEvaluator (see
+        // EnsembleRestraint::pairEvaluator()), a free function that receives the restraint as an argument.
         gmx::PotentialPointData calculate(gmx::Vector v,
                                           gmx::Vector v0,
                                           double t);
 
+        /*!
+         * \brief Evaluates the pair restraint potential for a separation whose length is known.
+         *
+         * Same as calculate(), for callers that already computed the distance (see StepCache).
+         *
+         * \param rdiff position of the site relative to the reference site (v - v0).
+         * \param R length of rdiff.
+         * \return container for force and potential energy data.
+         */
+        gmx::PotentialPointData calculateAt(gmx::Vector rdiff,
+                                            double R);
+
         /*!
          * \brief An update function to be called on the simulation master rank/thread periodically by the Restraint framework.
          *
@@ -174,16 +417,341 @@ class EnsemblePotential
                       double t,
                       const Resources& resources);
 
+        /*!
+         * \brief callback() for a pair distance that is already known.
+         *
+         * \param R pair separation distance.
+         * \param t current simulation time (ps).
+         * \param resources resources for the ensemble reduction.
+         */
+        void callback(double R,
+                      double t,
+                      const Resources& resources);
+
+        /*!
+         * \brief Check whether callback() has anything to do at time t.
+         *
+         * Sampling, window updates, and lagged reductions are scheduled by step number, so the
+         * restraint framework can skip callback() on steps for which this returns false.
+         *
+         * \param t current simulation time (ps).
+         */
+        bool updateDue(double t) const;
+
+        /*!
+         * \brief Record the pair distance if a sample is due.
+         *
+         * callback() is composed of sample(), blurWindow(), an ensemble reduction, and
+         * applyWindow(). The phases are exposed separately so that several restraints can share
+         * a single ensemble reduction (see EnsembleRestraintSet).
+         *
+         * \param R pair separation distance.
+         * \param t current simulation time (ps).
+         * \return true if the current window is complete and is ready to be blurred and reduced.
+         */
+        bool sample(double R,
+                    double t);
+
+        /*!
+         * \brief Blur the samples of the completed window onto the histogram grid.
+         *
+         * \param window destination for numBins() values.
+         */
+        void blurWindow(double* window);
+
+        /*!
+         * \brief Update the bias with the ensemble reduction of the completed window and start a new window.
+         *
+         * \param window numBins() values of the ensemble average of the blurred windows.
+         * \param t current simulation time (ps).
+         */
+        void applyWindow(const double* window,
+                         double t);
+
+        /*!
+         * \brief Save the state of the restraint.
+         *
+         * The checkpoint holds the window history, the current histogram, the samples of the current
+         * window, and the update schedule, so that a restored restraint applies exactly the same bias.
+         * The state is only consistent between steps, and a checkpoint cannot be written while a
+         * lagged reduction is pending.
+         *
+         * \param filename checkpoint file to (over)write.
+         * \throws gmxapi::ProtocolError if the file cannot be written or a reduction is pending.
+         */
+        void writeCheckpoint(const std::string& filename) const;
+
+        /*!
+         * \brief Restore the state saved by writeCheckpoint().
+         *
+         * The simulation must resume in the window that was in progress when the checkpoint was
+         * written. The first sample() after the restore throws gmxapi::ProtocolError otherwise.
+         *
+         * If the restraint autotunes (see ensemble_input_param_type::autotune) and the checkpoint
+         * was written by a tuned restraint, the algorithms chosen by that restraint replace the
+         * current ones.
+         *
+         * \param filename checkpoint file to read.
+         * \throws gmxapi::ProtocolError if the file cannot be read or was written for a restraint
+         * with different histogram or sampling parameters, or if the saved algorithms are not
+         * available with the current parameters.
+         */
+        void restoreCheckpoint(const std::string& filename);
+
+        /*!
+         * \brief The window output, if an output file was requested.
+         *
+         * \return non-owning pointer, or nullptr if there is no output.
+         */
+        WindowWriter* windowWriter() const
+        {
+            return writer_.get();
+        }
+
+        /*!
+         * \brief Number of times the bias has been published.
+         *
+         * Incremented after the new bias is published, so calculate() called after reading the
+         * generation uses the bias of that generation or a later one. Safe to call concurrently
+         * with callback().
+         */
+        uint64_t biasGeneration() const
+        {
+            return biasGeneration_.load(std::memory_order_acquire);
+        }
+
+        /*!
+         * \brief Number of window updates for which a lagged ensemble reduction was not complete when needed.
+         */
+        unsigned long blockingWaits() const
+        {
+            return blockingWaits_;
+        }
+
+        /*!
+         * \brief Current difference between the sampled and experimental histograms.
+         *
+         * This is the copy updated by callback(), so it must not be used concurrently with callback().
+         */
+        const PairHist& histogram() const
+        {
+            return histogram_;
+        }
+
+        /*!
+         * \brief Number of histogram bins.
+         */
+        size_t numBins() const
+        {
+            return nBins_;
+        }
+
+        /*!
+         * \brief The decision of the autotuner, if autotuning was requested.
+         */
+        const AutotuneReport& autotuneReport() const
+        {
+            return autotuneReport_;
+        }
+
+    protected:
+        /*!
+         * \brief Called after publishing a new bias, so that derived classes can update copies of histogram().
+         *
+         * The call made by the EnsemblePotential constructor does not reach a derived class, which
+         * must copy the histogram in its own constructor.
+         */
+        virtual void histogramUpdated()
+        {}
+
+        /*!
+         * \brief Whether calculate() sums the Gaussian terms of every bin in double precision with gaussianKernels().
+         *
+         * False if the bias is tabulated, has a kernel cutoff, is evaluated in single precision, or
+         * is evaluated with the recurrence.
+         */
+        bool fullGridBias() const
+        {
+            return !tabulated() && sigmaCutoff_ <= 0 && kernelPrecision_ == KernelPrecision::Double
+                   && biasEvaluation_ == GaussianEvaluation::Direct;
+        }
+
+        /// Distance of bin zero.
+        double gridOrigin() const
+        {
+            return gridOrigin_;
+        }
+
+        double binWidth() const
+        {
+            return binWidth_;
+        }
+
+        /// Exponent scale 1 / (2 sigma^2) of the Gaussian moments of the bias (see biasFromMoments()).
+        double exponentScale() const
+        {
+            return 0.5 / (sigma_ * sigma_);
+        }
+
+        ExpAccuracy expAccuracy() const
+        {
+            return expAccuracy_;
+        }
+
+        /*!
+         * \brief Evaluate the pair restraint with a given bias inside the flat-bottom region.
+         *
+         * \param rdiff position of the site for which force is being calculated, relative to the reference site.
+         * \param R length of rdiff.
+         * \param bias callable returning the BiasPoint for a pair distance in [minDist, maxDist].
+         * \return container for force and potential energy data.
+         */
+        template<class BiasFunction>
+        gmx::PotentialPointData pairForce(gmx::Vector rdiff,
+                                          double R,
+                                          const BiasFunction& bias) const;
+
+        /*!
+         * \brief Evaluate the Gaussian-sum bias from the current histogram.
+         *
+         * \param R pair separation distance.
+         * \return energy, force, and derivative of force with respect to R.
+         */
+        BiasPoint evaluateBias(double R) const;
+
+        /*!
+         * \brief Get the bias from the Gaussian moments of the histogram.
+         *
+         * \param sums moments of the histogram around R, as computed by GaussianMomentsFunction
+         * with an exponent scale of 1 / (2 sigma^2).
+         * \return energy, force, and derivative of force with respect to R.
+         */
+        BiasPoint biasFromMoments(const double* sums) const;
+
+        /// Whether calculate() uses the bias table.
+        bool tabulated() const
+        {
+            return tablePointsPerBin_ > 0 && maxDist_ > minDist_;
+        }
+
     private:
+        /*!
+         * \brief The state read by calculate(), published at each histogram update.
+         */
+        struct BiasState
+        {
+            /// Copy of histogram_.
+            PairHist histogram;
+            /// Single precision copy of histogram_, for KernelPrecision::Single.
+            std::vector<float> floatHistogram;
+            /// Tabulated bias between minDist_ and maxDist_, if tabulated().
+            BiasTable table;
+        };
+
+        /*!
+         * \brief Evaluate the Gaussian-sum bias from a published histogram.
+         */
+        BiasPoint evaluateBias(const BiasState& state,
+                               double R) const;
+
+        /*!
+         * \brief Blur samples onto the histogram grid.
+         *
+         * \param samples distances to blur.
+         * \param window destination for nBins_ values.
+         * \param binned binned blur to use, or nullptr for the exact blur.
+         * \param evaluation evaluation of the Gaussian terms of the exact blur.
+         */
+        void blurSamples(const std::vector<double>& samples,
+                         double* window,
+                         BinnedBlur* binned,
+                         GaussianEvaluation evaluation);
+
+        /*!
+         * \brief Choose the blur and bias algorithms by timing the candidates (see ensemble_input_param_type::autotune).
+         *
+         * \param blurMethod requested blur method.
+         */
+        void autotune(BlurMethod blurMethod);
+
+        /*!
+         * \brief Apply the algorithms chosen by the autotuner of the restraint that wrote a checkpoint.
+         *
+         * \throws gmxapi::ProtocolError if an algorithm is not available with the current parameters.
+         */
+        void restoreTuning(const std::string& filename,
+                           bool binned,
+                           GaussianEvaluation blurEvaluation,
+                           GaussianEvaluation biasEvaluation,
+                           bool table);
+
+        /*!
+         * \brief Rebuild the bias table from the histogram of a state, if tabulation is enabled.
+         */
+        void updateTable(BiasState* state) const;
+
+        /*!
+         * \brief Publish a new BiasState after histogram_ changes.
+         */
+        void refreshHistogram();
+
+        /*!
+         * \brief Capacity of the WindowHistory for a set of parameters.
+         */
+        static size_t numStoredWindows(const input_param_type& params)
+        {
+            return params.averaging == WindowAveraging::Sliding ? params.nWindows : 0;
+        }
+
+        /*!
+         * \brief Recompute the histogram difference after adding a window to the history.
+         *
+         * \param window numBins() values of the ensemble average of the blurred windows.
+         */
+        void updateHistogram(const double* window);
+
+        /*!
+         * \brief Reset the sampling schedule for a window starting at time t.
+         */
+        void startWindow(double t);
+
+        /*!
+         * \brief Set up the step schedule, inferring the time step if necessary.
+         *
+         * \param t time of the current update.
+         * \return true if the schedule is set up.
+         */
+        bool schedule(double t);
+
+        /*!
+         * \brief Step number of a simulation time.
+         */
+        long long stepOf(double t) const
+        {
+            return llround(t / timeStep_);
+        }
+
+        /*!
+         * \brief Complete the pending ensemble reduction and update the histogram.
+         */
+        void finishReduce();
+
+        /*!
+         * \brief Write a checkpoint if one is due after a histogram update.
+         */
+        void checkpointIfDue();
+
         /// Width of bins (distance) in histogram
         size_t nBins_;
         double binWidth_;
+        /// Distance of bin zero.
+        double gridOrigin_;
 
         /// Flat-bottom potential boundaries.
         double minDist_;
         double maxDist_;
         /// Smoothed historic distribution for this restraint. An element of the array of restraints in this simulation.
-        // Was `hij` in earlier code.
+        // Was `hij` in earlier code. Only used by callback(). calculate() reads the copy in bias_.
         PairHist histogram_;
         PairHist experimental_;
 
@@ -191,44 +759,157 @@ class EnsemblePotential
         unsigned int nSamples_;
         unsigned int currentSample_;
         double samplePeriod_;
-        double nextSampleTime_;
         /// Accumulated list of samples during a new window.
         std::vector<double> distanceSamples_;
 
         /// Number of windows to use for smoothing histogram updates.
         size_t nWindows_;
         size_t currentWindow_;
-        double windowStartTime_;
-        double nextWindowUpdateTime_;
-        /// The history of nwindows histograms for this restraint.
-        std::vector<std::unique_ptr<plugin::Matrix<double>>> windows_;
+        WindowAveraging averaging_;
+        /// Aligned storage for windows_, average_, localWindow_, and reducedWindow_, sized at construction.
+        AlignedArena arena_;
+        /// The history of nwindows histograms for this restraint. Empty unless averaging_ is Sliding.
+        WindowHistory windows_;
+        /// Running average of the windows. Empty unless averaging_ is Exponential.
+        ExponentialAverage average_;
+        /// Blurred samples from the current window in this simulation.
+        Matrix<double> localWindow_;
+        /// Ensemble reduction of localWindow_.
+        Matrix<double> reducedWindow_;
 
         /// Harmonic force coefficient
         double k_;
         /// Smoothing factor: width of Gaussian interpolation for histogram
         double sigma_;
+
+        /// Kernel support radius in units of sigma_, or zero for no cutoff.
+        double sigmaCutoff_{0};
+
+        /// Blur of the window samples by binning and convolution, or nullptr for the exact blur.
+        std::unique_ptr<BinnedBlur> binnedBlur_;
+
+        KernelPrecision kernelPrecision_{KernelPrecision::Double};
+        /// Evaluation of the Gaussian terms of the exact blur.
+        GaussianEvaluation blurEvaluation_{GaussianEvaluation::Direct};
+        /// Evaluation of the Gaussian sum for the bias force.
+        GaussianEvaluation biasEvaluation_{GaussianEvaluation::Direct};
+        ExpAccuracy expAccuracy_{ExpAccuracy::Full};
+        /// Single precision blur of the current window, for KernelPrecision::Single.
+        std::vector<float> floatWindow_;
+
+        /// Table nodes per histogram bin, or zero for direct evaluation of the bias.
+        unsigned int tablePointsPerBin_{0};
+
+        /// Bias published for calculate(). Rebuilt when histogram_ changes.
+        SnapshotBuffer<BiasState> bias_;
+        /// Number of publications of bias_ (see biasGeneration()).
+        std::atomic<uint64_t> biasGeneration_{0};
+
+        /// Steps between a window boundary and the use of its reduction, or zero to block.
+        unsigned int reduceLag_{0};
+        /// Reduction of localWindow_ into reducedWindow_, if reducePending_.
+        ReduceRequest pendingReduce_;
+        bool reducePending_{false};
+        /// Step at which to apply the pending reduction.
+        long long applyStep_{0};
+        unsigned long blockingWaits_{0};
+
+        /// MD time step, or zero until it is inferred.
+        double timeStep_{0};
+        /// Time of the first update, used to infer the time step.
+        double firstUpdateTime_{0};
+        bool haveFirstUpdate_{false};
+        /// Whether the next update must confirm the inferred time step.
+        bool checkTimeStep_{false};
+        /// Time of the update from which the time step was inferred.
+        double lastUpdateTime_{0};
+        /// Whether the step schedule below has been set up.
+        bool scheduled_{false};
+        long long sampleSteps_{0};
+        long long windowStartStep_{0};
+        long long nextSampleStep_{0};
+        long long nextWindowStep_{0};
+        /// Whether to check the step of the first update after restoring a checkpoint.
+        bool checkResumeStep_{false};
+
+        /// Checkpoint file name, or empty for no checkpoints.
+        std::string checkpointFile_;
+        unsigned int checkpointInterval_{1};
+        unsigned int updatesSinceCheckpoint_{0};
+
+        /// Output of per-window data, or nullptr.
+        std::unique_ptr<WindowWriter> writer_;
+
+        /// Whether the algorithms are to be chosen by the autotuner.
+        bool autotune_{false};
+        /// Whether the autotuner has chosen the algorithms, by timing them or from a checkpoint.
+        bool tuned_{false};
+        AutotuneReport autotuneReport_;
+        /// Output for the window being reduced, completed when the histogram is updated.
+        WindowRecord pendingRecord_;
 };
 
+template<class BiasFunction>
+gmx::PotentialPointData EnsemblePotential::pairForce(gmx::Vector rdiff,
+                                                     double R,
+                                                     const BiasFunction& bias) const
+{
+    // Compute output
+    gmx::PotentialPointData output;
+
+    if (R != 0) // Direction of force is ill-defined when v == v0
+    {
+
+        double f{0};
+
+        if (R > maxDist_)
+        {
+            // apply a force to reduce R
+            f = k_ * (maxDist_ - R);
+            output.energy = static_cast<real>(0.5 * k_ * (R - maxDist_) * (R - maxDist_));
+        }
+        else if (R < minDist_)
+        {
+            // apply a force to increase R
+            f = k_ * (minDist_ - R);
+            output.energy = static_cast<real>(0.5 * k_ * (minDist_ - R) * (minDist_ - R));
+        }
+        else
+        {
+            const BiasPoint point = bias(R);
+            f = point.force;
+            output.energy = static_cast<real>(point.energy);
+        }
+
+        const auto magnitude = f / R;
+        output.force = rdiff * static_cast<real>(magnitude);
+    }
+    return output;
+}
+
 /*!
  * \brief Use EnsemblePotential to implement a RestraintPotential
  *
  * This is boiler plate that will be templated and moved.
+ *
+ * \tparam Potential EnsemblePotential or a class derived from it, such as FixedEnsemblePotential.
  */
-class EnsembleRestraint : public ::gmx::IRestraintPotential, private EnsemblePotential
+template<class Potential>
+class BasicEnsembleRestraint : public ::gmx::IRestraintPotential, private Potential
 {
     public:
-        using EnsemblePotential::input_param_type;
+        using typename Potential::input_param_type;
 
-        EnsembleRestraint(std::vector<int> sites,
-                          const input_param_type& params,
-                          std::shared_ptr<Resources> resources
+        BasicEnsembleRestraint(std::vector<int> sites,
+                               const input_param_type& params,
+                               std::shared_ptr<Resources> resources
         ) :
-            EnsemblePotential(params),
+            Potential(params),
             sites_{std::move(sites)},
             resources_{std::move(resources)}
         {}
 
-        ~EnsembleRestraint() override = default;
+        ~BasicEnsembleRestraint() override = default;
 
         /*!
          * \brief Implement required interface of gmx::IRestraintPotential
@@ -246,7 +927,8 @@ class EnsembleRestraint : public ::gmx::IRestraintPotential, private EnsemblePot
         /*!
          * \brief Implement the interface gmx::IRestraintPotential
          *
-         * Dispatch to calculate() method.
+         * Dispatch to calculate() method. Repeated evaluations for the same time and positions are
+         * served from a StepCache, which also provides the pair distance computed by update().
          *
          * \param r1 coordinate of first site
          * \param r2 reference coordinate (second site)
@@ -259,9 +941,33 @@ class EnsembleRestraint : public ::gmx::IRestraintPotential, private EnsemblePot
                                          gmx::Vector r2,
                                          double t) override
         {
-            return calculate(r1,
-                             r2,
-                             t);
+            // Read before calculateAt() reads the bias, so the result is never tagged with a newer generation.
+            const uint64_t generation = this->biasGeneration();
+            StepCache::Entry entry;
+            const bool found = cache_.find(r1,
+                                           r2,
+                                           t,
+                                           generation,
+                                           &entry);
+            if (found && entry.hasResult)
+            {
+                return entry.result;
+            }
+            const auto rdiff = r1 - r2;
+            if (!found)
+            {
+                entry.R = sqrt(dot(rdiff,
+                                   rdiff));
+            }
+            entry.result = this->calculateAt(rdiff,
+                                             entry.R);
+            entry.hasResult = true;
+            entry.generation = generation;
+            cache_.store(r1,
+                         r2,
+                         t,
+                         entry);
+            return entry.result;
         };
 
         /*!
@@ -275,13 +981,52 @@ class EnsembleRestraint : public ::gmx::IRestraintPotential, private EnsemblePot
                     gmx::Vector v0,
                     double t) override
         {
-            // Todo: use a callback period to mostly bypass this and avoid excessive mutex locking.
-            callback(v,
-                     v0,
-                     t,
-                     *resources_);
+            // Skip steps on which nothing is scheduled.
+            if (!this->updateDue(t))
+            {
+                return;
+            }
+            const auto rdiff = v - v0;
+            StepCache::Entry entry;
+            entry.R = sqrt(dot(rdiff,
+                               rdiff));
+            this->callback(entry.R,
+                           t,
+                           *resources_);
+            // Lets evaluate() reuse the distance. Forces cached before a bias update are not
+            // reused, whenever they were stored, because their generation is out of date.
+            cache_.store(v,
+                         v0,
+                         t,
+                         entry);
         };
 
+        /*!
+         * \brief Get a function pointer evaluating this restraint without virtual dispatch.
+         *
+         * \return evaluator equivalent to evaluate(), valid for the lifetime of the restraint.
+         */
+        PairEvaluator pairEvaluator()
+        {
+            return makePairEvaluator(this);
+        }
+
+        /*!
+         * \brief Number of calls to evaluate().
+         */
+        uint64_t evaluations() const
+        {
+            return cache_.lookups();
+        }
+
+        /*!
+         * \brief Number of calls to evaluate() answered from the step cache without evaluating the bias.
+         */
+        uint64_t cacheHits() const
+        {
+            return cache_.hits();
+        }
+
         /*!
          * \brief Implement the binding protocol that allows access to Session resources.
          *
@@ -305,8 +1050,12 @@ class EnsembleRestraint : public ::gmx::IRestraintPotential, private EnsemblePot
 //        double callbackPeriod_;
 //        double nextCallback_;
         std::shared_ptr<Resources> resources_;
+        /// Distance and force for the most recent time and positions.
+        StepCache cache_;
 };
 
+/// Restraint with the bin count chosen at run time.
+using EnsembleRestraint = BasicEnsembleRestraint<EnsemblePotential>;
 
 // Important: Just declare the template instantiation here for client code.
 // We will explicitly instantiate a definition in the .cpp file where the input_param_type is defined.
@@ -0,0 +1,119 @@
+/*! \file
+ * \brief Code to implement the restraint set declared in ensemblerestraintset.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "ensemblerestraintset.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <memory>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+size_t EnsembleRestraintSet::addRestraint(const ensemble_input_param_type& params)
+{
+    if (numComplete_ > 0)
+    {
+        throw gmxapi::ProtocolError("Cannot add a restraint to an EnsembleRestraintSet during a window update.");
+    }
+    if (params.reduceLag > 0)
+    {
+        throw gmxapi::ProtocolError("Restraints in an EnsembleRestraintSet are reduced without lag. Set reduce_lag to 0.");
+    }
+    if (restraints_.empty())
+    {
+        nSamples_ = params.nSamples;
+        samplePeriod_ = params.samplePeriod;
+        timeStep_ = params.timeStep;
+    }
+    else if (params.nSamples != nSamples_ || params.samplePeriod != samplePeriod_ || params.timeStep != timeStep_)
+    {
+        throw gmxapi::ProtocolError("All restraints in an EnsembleRestraintSet must have the same nsamples, sample_period, and dt.");
+    }
+
+    const size_t index = restraints_.size();
+    restraints_.emplace_back(std::make_unique<EnsemblePotential>(params));
+    offsets_.push_back(localWindows_.cols());
+    windowComplete_.push_back(false);
+
+    // Windows are only exchanged at window boundaries, so any previous contents can be discarded.
+    const size_t totalBins = localWindows_.cols() + restraints_.back()->numBins();
+    localWindows_ = Matrix<double>(1,
+                                   totalBins);
+    reducedWindows_ = Matrix<double>(1,
+                                     totalBins);
+    return index;
+}
+
+gmx::PotentialPointData EnsembleRestraintSet::calculate(size_t index,
+                                                        gmx::Vector v,
+                                                        gmx::Vector v0,
+                                                        double t)
+{
+    return restraints_[index]->calculate(v,
+                                         v0,
+                                         t);
+}
+
+void EnsembleRestraintSet::update(size_t index,
+                                  gmx::Vector v,
+                                  gmx::Vector v0,
+                                  double t,
+                                  const Resources& resources)
+{
+    if (sample(index,
+               v,
+               v0,
+               t))
+    {
+        exchangeWindows(resources.getHandle(),
+                        t);
+    }
+}
+
+bool EnsembleRestraintSet::sample(size_t index,
+                                  gmx::Vector v,
+                                  gmx::Vector v0,
+                                  double t)
+{
+    const auto rdiff = v - v0;
+    const auto R = sqrt(dot(rdiff,
+                            rdiff));
+
+    auto& restraint = *restraints_[index];
+    if (restraint.sample(R,
+                         t) && !windowComplete_[index])
+    {
+        restraint.blurWindow(localWindows_.data() + offsets_[index]);
+        windowComplete_[index] = true;
+        ++numComplete_;
+    }
+    return numComplete_ == restraints_.size();
+}
+
+void EnsembleRestraintSet::exchangeWindows(const ResourcesHandle& ensemble,
+                                           double t)
+{
+    ensemble.reduce(localWindows_,
+                    &reducedWindows_);
+
+    for (size_t i = 0;i < restraints_.size();++i)
+    {
+        restraints_[i]->applyWindow(reducedWindows_.data() + offsets_[i],
+                                    t);
+    }
+    std::fill(windowComplete_.begin(), windowComplete_.end(), false);
+    numComplete_ = 0;
+}
+
+// Explicitly instantiate a definition for the templated class declared in ensemblerestraintset.h.
+template
+class ::plugin::RestraintModule<EnsembleSetRestraint>;
+
+} // end namespace plugin
@@ -0,0 +1,248 @@
+#ifndef RESTRAINT_ENSEMBLERESTRAINTSET_H
+#define RESTRAINT_ENSEMBLERESTRAINTSET_H
+
+/*! \file
+ * \brief Restrained-ensemble potentials for many pairs sharing one ensemble reduction.
+ *
+ * With one EnsembleRestraint per pair, each restraint calls the ensemble reduce separately at every
+ * window update. The EnsembleRestraintSet defined here owns the potentials for all of its pairs and
+ * packs their blurred windows into one contiguous Matrix, so each window update costs a single
+ * ensemble reduction regardless of the number of pairs.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <memory>
+#include <vector>
+
+#include "gmxapi/gromacsfwd.h"
+#include "gmxapi/session.h"
+#include "gmxapi/md/mdmodule.h"
+
+#include "gromacs/restraint/restraintpotential.h"
+
+#include "ensemblepotential.h"
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Collection of restrained-ensemble pair potentials with a combined window update.
+ *
+ * The blurred windows of all restraints are stored back to back in a single row Matrix, restraint i
+ * occupying the nBins values starting at offset(i). When every restraint has completed its window,
+ * the whole Matrix is reduced across the ensemble with one call and each restraint applies its
+ * slice of the result.
+ *
+ * All restraints in a set must have the same nSamples, samplePeriod, and timeStep, so that their
+ * windows end on the same step. GROMACS calls the update of each restraint once per step, so the
+ * reduction is issued from the update of the last restraint in the step at which the windows end.
+ * The reduction blocks, so the restraints must not request a lagged reduction (reduceLag).
+ *
+ * Restraints are added while the work is being built. The set must not be modified after the
+ * simulation starts.
+ */
+class EnsembleRestraintSet
+{
+    public:
+        EnsembleRestraintSet() = default;
+
+        /*!
+         * \brief Add a pair restraint to the set.
+         *
+         * \param params parameters of the new restraint.
+         * \return index of the restraint in the set.
+         * \throws gmxapi::ProtocolError if the window schedule differs from that of the restraints
+         * already in the set, if params.reduceLag is not zero, or if a window is already in progress.
+         */
+        size_t addRestraint(const ensemble_input_param_type& params);
+
+        /*!
+         * \brief Number of restraints in the set.
+         */
+        size_t size() const
+        {
+            return restraints_.size();
+        }
+
+        /*!
+         * \brief Offset of a restraint's window in the packed windows.
+         *
+         * \param index restraint index returned by addRestraint().
+         */
+        size_t offset(size_t index) const
+        {
+            return offsets_[index];
+        }
+
+        /*!
+         * \brief Evaluate the potential of one restraint.
+         *
+         * \param index restraint index returned by addRestraint().
+         * \param v position of the site for which force is being calculated.
+         * \param v0 reference site (other member of the pair).
+         * \param t current simulation time (ps).
+         * \return container for force and potential energy data.
+         */
+        gmx::PotentialPointData calculate(size_t index,
+                                          gmx::Vector v,
+                                          gmx::Vector v0,
+                                          double t);
+
+        /*!
+         * \brief Update the state of one restraint, reducing the windows of all restraints when they are complete.
+         *
+         * \param index restraint index returned by addRestraint().
+         * \param v position of the first site.
+         * \param v0 position of the reference site.
+         * \param t current simulation time (ps).
+         * \param resources provides the ensemble reduction.
+         */
+        void update(size_t index,
+                    gmx::Vector v,
+                    gmx::Vector v0,
+                    double t,
+                    const Resources& resources);
+
+        /*!
+         * \brief Check whether update() has anything to do for one restraint at time t.
+         *
+         * \param index restraint index returned by addRestraint().
+         * \param t current simulation time (ps).
+         */
+        bool updateDue(size_t index,
+                       double t) const
+        {
+            return restraints_[index]->updateDue(t);
+        }
+
+        /*!
+         * \brief Sample the pair distance for one restraint.
+         *
+         * When the window of the restraint is complete, its samples are blurred into the packed windows.
+         *
+         * \param index restraint index returned by addRestraint().
+         * \param v position of the first site.
+         * \param v0 position of the reference site.
+         * \param t current simulation time (ps).
+         * \return true if the windows of all restraints are complete and ready for exchangeWindows().
+         */
+        bool sample(size_t index,
+                    gmx::Vector v,
+                    gmx::Vector v0,
+                    double t);
+
+        /*!
+         * \brief Reduce the packed windows across the ensemble and start new windows for all restraints.
+         *
+         * \param ensemble active handle to the ensemble resources.
+         * \param t current simulation time (ps).
+         */
+        void exchangeWindows(const ResourcesHandle& ensemble,
+                             double t);
+
+    private:
+        std::vector<std::unique_ptr<EnsemblePotential>> restraints_;
+        /// Start of each restraint's window in the packed windows.
+        std::vector<size_t> offsets_;
+
+        /// Window schedule shared by all restraints.
+        unsigned int nSamples_{0};
+        double samplePeriod_{0};
+        double timeStep_{0};
+
+        /// Blurred windows of all restraints in this simulation.
+        Matrix<double> localWindows_{1,
+                                     0};
+        /// Ensemble reduction of localWindows_.
+        Matrix<double> reducedWindows_{1,
+                                       0};
+        /// Whether each restraint has blurred its completed window into localWindows_.
+        std::vector<bool> windowComplete_;
+        size_t numComplete_{0};
+};
+
+/*!
+ * \brief Parameters of a restraint in an EnsembleRestraintSet.
+ */
+struct ensemble_set_member_param_type
+{
+    /// Set owning the potential.
+    std::shared_ptr<EnsembleRestraintSet> set;
+    /// Index of the potential in the set.
+    size_t index{0};
+};
+
+/*!
+ * \brief Implement gmx::IRestraintPotential for one pair of an EnsembleRestraintSet.
+ *
+ * Every member of a set should be constructed with the same Resources.
+ */
+class EnsembleSetRestraint : public ::gmx::IRestraintPotential
+{
+    public:
+        using input_param_type = ensemble_set_member_param_type;
+
+        EnsembleSetRestraint(std::vector<int> sites,
+                             const input_param_type& params,
+                             std::shared_ptr<Resources> resources
+        ) :
+            sites_{std::move(sites)},
+            set_{params.set},
+            index_{params.index},
+            resources_{std::move(resources)}
+        {}
+
+        ~EnsembleSetRestraint() override = default;
+
+        std::vector<int> sites() const override
+        {
+            return sites_;
+        }
+
+        gmx::PotentialPointData evaluate(gmx::Vector r1,
+                                         gmx::Vector r2,
+                                         double t) override
+        {
+            return set_->calculate(index_,
+                                   r1,
+                                   r2,
+                                   t);
+        };
+
+        void update(gmx::Vector v,
+                    gmx::Vector v0,
+                    double t) override
+        {
+            if (!set_->updateDue(index_,
+                                 t))
+            {
+                return;
+            }
+            set_->update(index_,
+                         v,
+                         v0,
+                         t,
+                         *resources_);
+        };
+
+        void bindSession(gmxapi::SessionResources* session) override
+        {
+            resources_->setSession(session);
+        }
+
+    private:
+        std::vector<int> sites_;
+        std::shared_ptr<EnsembleRestraintSet> set_;
+        size_t index_;
+        std::shared_ptr<Resources> resources_;
+};
+
+// Explicitly instantiated in ensemblerestraintset.cpp
+extern template
+class RestraintModule<EnsembleSetRestraint>;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_ENSEMBLERESTRAINTSET_H
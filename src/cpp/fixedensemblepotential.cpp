@@ -0,0 +1,32 @@
+/*! \file
+ * \brief Instantiate the fixed-size potentials declared in fixedensemblepotential.h
+ *
+ * Keep the list of instantiations consistent with FixedBinCounts.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "fixedensemblepotential.h"
+
+namespace plugin
+{
+
+template
+class FixedEnsemblePotential<50>;
+template
+class FixedEnsemblePotential<70>;
+template
+class FixedEnsemblePotential<100>;
+template
+class FixedEnsemblePotential<200>;
+
+template
+class ::plugin::RestraintModule<FixedEnsembleRestraint<50>>;
+template
+class ::plugin::RestraintModule<FixedEnsembleRestraint<70>>;
+template
+class ::plugin::RestraintModule<FixedEnsembleRestraint<100>>;
+template
+class ::plugin::RestraintModule<FixedEnsembleRestraint<200>>;
+
+} // end namespace plugin
@@ -0,0 +1,183 @@
+#ifndef RESTRAINT_FIXEDENSEMBLEPOTENTIAL_H
+#define RESTRAINT_FIXEDENSEMBLEPOTENTIAL_H
+
+/*! \file
+ * \brief Restrained-ensemble potential specialized for a bin count known at compile time.
+ *
+ * Production restraints use a few grid sizes (FixedBinCounts). For those, FixedEnsemblePotential
+ * keeps the histogram read by calculate() in a std::array padded with zeros to a multiple of the
+ * widest SIMD vector, and sums the bias over it with a fixed-size kernel
+ * (GaussianKernels::fixedMoments), whose loop has a compile-time trip count and no remainder.
+ * Window sampling, reduction, checkpointing, and window output are inherited from EnsemblePotential.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cstddef>
+
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+
+#include "gmxapi/exceptions.h"
+
+#include "ensemblepotential.h"
+#include "kernels.h"
+#include "snapshotbuffer.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief EnsemblePotential with a compile-time number of bins.
+ *
+ * The fixed-size kernel is used when the bias is a sum over all bins in double precision (see
+ * EnsemblePotential::fullGridBias()). With a kernel cutoff, a bias table, single precision, or the
+ * recurrence, the cost does not scale with the whole grid, and calculate() behaves exactly like
+ * EnsemblePotential::calculate().
+ *
+ * \tparam NBins number of histogram bins, one of FixedBinCounts.
+ */
+template<size_t NBins>
+class FixedEnsemblePotential : public EnsemblePotential
+{
+    public:
+        static_assert(fixedBinCountIndex(NBins) < numFixedBinCounts,
+                      "No fixed-size kernels are compiled for this bin count. See FixedBinCounts.");
+
+        /// Number of stored bins, rounded up to a multiple of eight.
+        static constexpr size_t numPaddedBins = paddedBinCount(NBins);
+
+        /*!
+         * \brief Construct the potential.
+         *
+         * \param params parameters, with params.nBins == NBins.
+         * \throws gmxapi::ProtocolError if the bin count does not match.
+         */
+        explicit FixedEnsemblePotential(const input_param_type& params) :
+            EnsemblePotential(checkBins(params)),
+            moments_{gaussianKernels(expAccuracy()).fixedMoments[fixedBinCountIndex(NBins)]}
+        {
+            histogramUpdated();
+        }
+
+        /*!
+         * \brief Evaluates the pair restraint potential.
+         *
+         * \see EnsemblePotential::calculate()
+         */
+        gmx::PotentialPointData calculate(gmx::Vector v,
+                                          gmx::Vector v0,
+                                          double /* t */)
+        {
+            const auto rdiff = v - v0;
+            return calculateAt(rdiff,
+                               sqrt(dot(rdiff,
+                                        rdiff)));
+        }
+
+        /*!
+         * \brief Evaluates the pair restraint potential for a separation whose length is known.
+         *
+         * \see EnsemblePotential::calculateAt()
+         */
+        gmx::PotentialPointData calculateAt(gmx::Vector rdiff,
+                                            double R)
+        {
+            if (!fullGridBias())
+            {
+                return EnsemblePotential::calculateAt(rdiff,
+                                                      R);
+            }
+            return pairForce(rdiff,
+                             R,
+                             [this](double R)
+                             {
+                                 const auto histogram = histogram_.read();
+                                 double sums[3];
+                                 moments_(histogram->data(),
+                                          gridOrigin(),
+                                          binWidth(),
+                                          R,
+                                          exponentScale(),
+                                          sums);
+                                 return biasFromMoments(sums);
+                             });
+        }
+
+    private:
+        static const input_param_type& checkBins(const input_param_type& params)
+        {
+            if (params.nBins != NBins)
+            {
+                throw gmxapi::ProtocolError("FixedEnsemblePotential bin count does not match nbins.");
+            }
+            return params;
+        }
+
+        void histogramUpdated() override
+        {
+            // Only the first NBins values are written, so the padding stays zero.
+            auto& next = histogram_.back();
+            std::copy_n(histogram().begin(),
+                        NBins,
+                        next.begin());
+            histogram_.publish();
+        }
+
+        /// Fixed-size kernel of the instruction set selected at run time.
+        GaussianFixedMomentsFunction moments_;
+        /// Copy of histogram() padded with zeros, published like the bias of EnsemblePotential.
+        SnapshotBuffer<std::array<double, numPaddedBins>> histogram_;
+};
+
+/*!
+ * \brief Call a function with the supported compile-time bin count matching a run-time value.
+ *
+ * \param nBins run-time bin count.
+ * \param function called as function(std::integral_constant<size_t, N>()) if nBins == N for
+ * some N in the list.
+ * \return true if function was called.
+ */
+template<class Function, size_t ... N>
+bool dispatchFixedBins(size_t nBins,
+                       Function&& function,
+                       std::index_sequence<N...>)
+{
+    bool found{false};
+    // Expands to one comparison per supported bin count.
+    (void) std::initializer_list<int>{(nBins == N ? (function(std::integral_constant<size_t, N>()), found = true, 0) : 0)...};
+    return found;
+}
+
+/*!
+ * \brief Call a function with the bin count of FixedBinCounts matching a run-time value.
+ */
+template<class Function>
+bool dispatchFixedBins(size_t nBins,
+                       Function&& function)
+{
+    return dispatchFixedBins(nBins,
+                             std::forward<Function>(function),
+                             FixedBinCounts());
+}
+
+/// Ensemble restraint with a compile-time number of bins.
+template<size_t NBins>
+using FixedEnsembleRestraint = BasicEnsembleRestraint<FixedEnsemblePotential<NBins>>;
+
+// Explicitly instantiated in fixedensemblepotential.cpp
+extern template class FixedEnsemblePotential<50>;
+extern template class FixedEnsemblePotential<70>;
+extern template class FixedEnsemblePotential<100>;
+extern template class FixedEnsemblePotential<200>;
+extern template class RestraintModule<FixedEnsembleRestraint<50>>;
+extern template class RestraintModule<FixedEnsembleRestraint<70>>;
+extern template class RestraintModule<FixedEnsembleRestraint<100>>;
+extern template class RestraintModule<FixedEnsembleRestraint<200>>;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_FIXEDENSEMBLEPOTENTIAL_H
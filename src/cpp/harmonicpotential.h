@@ -13,6 +13,8 @@
 #include "gromacs/restraint/restraintpotential.h"
 #include "gromacs/utility/real.h"
 
+#include "pairevaluator.h"
+
 /*! \file
  * \brief Implement a harmonic pair force.
  *
@@ -140,6 +142,16 @@ class HarmonicRestraint : public ::gmx::IRestraintPotential, private Harmonic
                                          gmx::Vector r2,
                                          double t) override;
 
+        /*!
+         * \brief Get a function pointer evaluating this restraint without virtual dispatch.
+         *
+         * \return evaluator equivalent to evaluate(), valid for the lifetime of the restraint.
+         */
+        PairEvaluator pairEvaluator()
+        {
+            return makePairEvaluator(this);
+        }
+
     private:
         int site1_{0};
         int site2_{0};
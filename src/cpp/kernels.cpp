@@ -0,0 +1,466 @@
+/*! \file
+ * \brief Scalar Gaussian kernels and run time selection of the kernels declared in kernels.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "kernels.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <utility>
+#include <vector>
+
+#include "kernels_simd.h"
+
+namespace plugin
+{
+
+// Instruction-set specific kernels are only declared if the build system compiled them.
+#ifdef GMXAPI_EXTENSION_SIMD_SSE4
+namespace sse4
+{
+extern const GaussianKernels kernels[numExpAccuracies];
+}
+#endif
+#ifdef GMXAPI_EXTENSION_SIMD_AVX2
+namespace avx2
+{
+extern const GaussianKernels kernels[numExpAccuracies];
+}
+#endif
+#ifdef GMXAPI_EXTENSION_SIMD_AVX512
+namespace avx512
+{
+extern const GaussianKernels kernels[numExpAccuracies];
+}
+#endif
+
+namespace
+{
+
+void scalarAccumulate(double center,
+                      double low,
+                      double gridSpacing,
+                      double scale,
+                      double exponentScale,
+                      size_t first,
+                      size_t end,
+                      double* grid)
+{
+    for (size_t i = first;i < end;++i)
+    {
+        const double x{low + i * gridSpacing - center};
+        grid[i] += scale * exp(-exponentScale * x * x);
+    }
+}
+
+void scalarMoments(const double* weights,
+                   double low,
+                   double gridSpacing,
+                   double center,
+                   double exponentScale,
+                   size_t first,
+                   size_t end,
+                   double* sums)
+{
+    double sum0{0};
+    double sum1{0};
+    double sum2{0};
+    for (size_t i = first;i < end;++i)
+    {
+        const double x{low + i * gridSpacing - center};
+        const double g{weights[i] * exp(-exponentScale * x * x)};
+        sum0 += g;
+        sum1 += g * x;
+        sum2 += g * x * x;
+    }
+    sums[0] = sum0;
+    sums[1] = sum1;
+    sums[2] = sum2;
+}
+
+template<size_t N>
+void scalarFixedMoments(const double* weights,
+                        double low,
+                        double gridSpacing,
+                        double center,
+                        double exponentScale,
+                        double* sums)
+{
+    scalarMoments(weights, low, gridSpacing, center, exponentScale, 0, N, sums);
+}
+
+/*!
+ * \brief Gaussian term exp(-a x^2), flushed to zero below exp(-60) like the vectorized version.
+ */
+float gaussianFloat(float x,
+                    float a)
+{
+    const float exponent{-a * x * x};
+    return exponent < -60.f ? 0.f : std::exp(exponent);
+}
+
+void scalarAccumulateFloat(double center,
+                           double low,
+                           double gridSpacing,
+                           double scale,
+                           double exponentScale,
+                           size_t first,
+                           size_t end,
+                           float* grid)
+{
+    const float x0{static_cast<float>(low - center)};
+    const float dx{static_cast<float>(gridSpacing)};
+    const float a{static_cast<float>(exponentScale)};
+    const float s{static_cast<float>(scale)};
+    for (size_t i = first;i < end;++i)
+    {
+        const float x{x0 + i * dx};
+        grid[i] += s * gaussianFloat(x, a);
+    }
+}
+
+void scalarMomentsFloat(const float* weights,
+                        double low,
+                        double gridSpacing,
+                        double center,
+                        double exponentScale,
+                        size_t first,
+                        size_t end,
+                        double* sums)
+{
+    const float x0{static_cast<float>(low - center)};
+    const float dx{static_cast<float>(gridSpacing)};
+    const float a{static_cast<float>(exponentScale)};
+    // Without vectors, double accumulators cost the same as compensated float sums.
+    double sum0{0};
+    double sum1{0};
+    double sum2{0};
+    for (size_t i = first;i < end;++i)
+    {
+        const float x{x0 + i * dx};
+        const float g{weights[i] * gaussianFloat(x, a)};
+        sum0 += g;
+        sum1 += g * x;
+        sum2 += g * x * x;
+    }
+    sums[0] = sum0;
+    sums[1] = sum1;
+    sums[2] = sum2;
+}
+
+/// Relative Gaussian terms below this are dropped by the recurrence.
+constexpr double recurrenceLimit = 1e-300;
+
+/*!
+ * \brief Generate the Gaussian terms over a range of grid points with a recurrence.
+ *
+ * \param visit callable with signature void(size_t i, double term), called with scale times the
+ * Gaussian term of each grid point in [first, end) whose term is not negligible.
+ */
+template<class Visit>
+void gaussianRecurrence(double center,
+                        double low,
+                        double gridSpacing,
+                        double scale,
+                        double exponentScale,
+                        size_t first,
+                        size_t end,
+                        Visit&& visit)
+{
+    assert(first < end);
+    const double& a{exponentScale};
+    const double& dx{gridSpacing};
+
+    // Start from the grid point nearest the center, so the terms decrease in both directions.
+    const double nearest = std::round((center - low) / dx);
+    size_t start{first};
+    if (nearest >= static_cast<double>(end - 1))
+    {
+        start = end - 1;
+    }
+    else if (nearest > static_cast<double>(first))
+    {
+        start = static_cast<size_t>(nearest);
+    }
+    const double x{low + start * dx - center};
+    const double q = exp(-2 * a * dx * dx);
+    // Ratios of the terms next to the start to its term. Each is at most one. Away from the ends
+    // of the range, the up ratio is at least q, and the product of the two ratios is q.
+    const double up = start + 1 < end ? exp(-a * dx * (2 * x + dx)) : 0.;
+    double down{0};
+    if (start > first)
+    {
+        down = up > 0 ? q / up : exp(-a * dx * (dx - 2 * x));
+    }
+
+    // The recurrence runs on terms relative to the starting term, which may itself underflow.
+    const double startTerm = scale * exp(-a * x * x);
+    visit(start, startTerm);
+    double term{1};
+    double ratio{up};
+    for (size_t i = start + 1;i < end;++i)
+    {
+        term *= ratio;
+        if (term < recurrenceLimit)
+        {
+            break;
+        }
+        ratio *= q;
+        visit(i, startTerm * term);
+    }
+    term = 1;
+    ratio = down;
+    for (size_t i = start;i > first;--i)
+    {
+        term *= ratio;
+        if (term < recurrenceLimit)
+        {
+            break;
+        }
+        ratio *= q;
+        visit(i - 1, startTerm * term);
+    }
+}
+
+/*!
+ * \brief Traits for the generic kernels of kernels_simd.h with vectors of one double.
+ *
+ * Used for the reduced accuracy scalar kernels, so that they evaluate the same polynomials as
+ * the vectorized kernels.
+ */
+struct ScalarTraits
+{
+    using V = double;
+    static constexpr size_t width = 1;
+
+    static V set1(double a) { return a; }
+    static V iota() { return 0.; }
+    static V loadu(const double* p) { return *p; }
+    static void storeu(double* p, V a) { *p = a; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V min(V a, V b) { return b < a ? b : a; }
+    static V max(V a, V b) { return a < b ? b : a; }
+    static V fma(V a, V b, V c) { return a * b + c; }
+    static V scaleByPowerOfTwo(V p, V t)
+    {
+        uint64_t bits;
+        uint64_t exponent;
+        memcpy(&bits, &p, sizeof(bits));
+        memcpy(&exponent, &t, sizeof(exponent));
+        bits += exponent << 52;
+        memcpy(&p, &bits, sizeof(p));
+        return p;
+    }
+    static double hsum(V a) { return a; }
+};
+
+/*!
+ * \brief Single precision version of ScalarTraits.
+ */
+struct ScalarFloatTraits
+{
+    using V = float;
+    static constexpr size_t width = 1;
+
+    static V set1(float a) { return a; }
+    static V iota() { return 0.f; }
+    static V loadu(const float* p) { return *p; }
+    static void storeu(float* p, V a) { *p = a; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V min(V a, V b) { return b < a ? b : a; }
+    static V max(V a, V b) { return a < b ? b : a; }
+    static V fma(V a, V b, V c) { return a * b + c; }
+    static V scaleByPowerOfTwo(V p, V t)
+    {
+        uint32_t bits;
+        uint32_t exponent;
+        memcpy(&bits, &p, sizeof(bits));
+        memcpy(&exponent, &t, sizeof(exponent));
+        bits += exponent << 23;
+        memcpy(&p, &bits, sizeof(p));
+        return p;
+    }
+    static V zeroWhereLess(V a, V x, V limit) { return x >= limit ? a : 0.f; }
+    static double hsum(V a) { return a; }
+};
+
+/*!
+ * \brief Scalar kernels with the C library exp().
+ *
+ * \tparam NBins the bin counts of FixedBinCounts.
+ */
+template<size_t ... NBins>
+constexpr GaussianKernels makeScalarKernels(std::index_sequence<NBins...>)
+{
+    return {SimdLevel::None,
+            "none",
+            ExpAccuracy::Full,
+            &scalarAccumulate,
+            &scalarMoments,
+            &scalarAccumulateFloat,
+            &scalarMomentsFloat,
+            {&scalarFixedMoments<paddedBinCount(NBins)>...}};
+}
+
+/// Scalar kernels for each ExpAccuracy, in the order of its values.
+const GaussianKernels scalarKernels[numExpAccuracies]{
+    makeScalarKernels(FixedBinCounts()),
+    simd::makeKernels<ScalarTraits, ScalarFloatTraits, ExpAccuracy::Relative1e7>(SimdLevel::None, "none"),
+    simd::makeKernels<ScalarTraits, ScalarFloatTraits, ExpAccuracy::Relative1e4>(SimdLevel::None, "none")};
+
+/*!
+ * \brief Check whether the host can execute instructions for a SIMD level.
+ *
+ * The compiler's CPU detection also checks that the operating system preserves the
+ * extended register state.
+ */
+bool hostSupports(SimdLevel level)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    switch (level)
+    {
+        case SimdLevel::None:
+            return true;
+        case SimdLevel::Sse4:
+            return __builtin_cpu_supports("sse4.1");
+        case SimdLevel::Avx2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case SimdLevel::Avx512:
+            return __builtin_cpu_supports("avx512f");
+    }
+    return false;
+#else
+    return level == SimdLevel::None;
+#endif
+}
+
+/*!
+ * \brief Select the instruction set of the kernels.
+ *
+ * \return the kernels of the selected instruction set with ExpAccuracy::Full. The kernels with
+ * the other accuracies follow in the same array.
+ */
+const GaussianKernels* selectGaussianKernels()
+{
+    const auto available = availableGaussianKernels();
+    const GaussianKernels* selected = available.back();
+
+    const char* request = getenv("GMXAPI_EXTENSION_SIMD");
+    if (request != nullptr)
+    {
+        const std::vector<std::pair<const char*, SimdLevel>> names{{"none", SimdLevel::None},
+                                                                   {"sse4", SimdLevel::Sse4},
+                                                                   {"avx2", SimdLevel::Avx2},
+                                                                   {"avx512", SimdLevel::Avx512}};
+        for (const auto& name : names)
+        {
+            if (strcmp(request, name.first) != 0)
+            {
+                continue;
+            }
+            for (const auto kernels : available)
+            {
+                if (kernels->level == name.second)
+                {
+                    selected = kernels;
+                }
+            }
+        }
+    }
+    return selected;
+}
+
+} // end anonymous namespace
+
+void recurrenceAccumulate(double center,
+                          double low,
+                          double gridSpacing,
+                          double scale,
+                          double exponentScale,
+                          size_t first,
+                          size_t end,
+                          double* grid)
+{
+    if (first >= end)
+    {
+        return;
+    }
+    gaussianRecurrence(center, low, gridSpacing, scale, exponentScale, first, end,
+                       [grid](size_t i, double term)
+                       {
+                           grid[i] += term;
+                       });
+}
+
+void recurrenceMoments(const double* weights,
+                       double low,
+                       double gridSpacing,
+                       double center,
+                       double exponentScale,
+                       size_t first,
+                       size_t end,
+                       double* sums)
+{
+    double sum0{0};
+    double sum1{0};
+    double sum2{0};
+    if (first < end)
+    {
+        gaussianRecurrence(center, low, gridSpacing, 1., exponentScale, first, end,
+                           [&](size_t i, double term)
+                           {
+                               const double x{low + i * gridSpacing - center};
+                               const double g{weights[i] * term};
+                               sum0 += g;
+                               sum1 += g * x;
+                               sum2 += g * x * x;
+                           });
+    }
+    sums[0] = sum0;
+    sums[1] = sum1;
+    sums[2] = sum2;
+}
+
+std::vector<const GaussianKernels*> availableGaussianKernels(ExpAccuracy accuracy)
+{
+    const auto index = static_cast<size_t>(accuracy);
+    std::vector<const GaussianKernels*> available{&scalarKernels[index]};
+#ifdef GMXAPI_EXTENSION_SIMD_SSE4
+    if (hostSupports(SimdLevel::Sse4))
+    {
+        available.push_back(&sse4::kernels[index]);
+    }
+#endif
+#ifdef GMXAPI_EXTENSION_SIMD_AVX2
+    if (hostSupports(SimdLevel::Avx2))
+    {
+        available.push_back(&avx2::kernels[index]);
+    }
+#endif
+#ifdef GMXAPI_EXTENSION_SIMD_AVX512
+    if (hostSupports(SimdLevel::Avx512))
+    {
+        available.push_back(&avx512::kernels[index]);
+    }
+#endif
+    return available;
+}
+
+const GaussianKernels& gaussianKernels(ExpAccuracy accuracy)
+{
+    // Thread-safe one-time initialization.
+    static const GaussianKernels* const kernels = selectGaussianKernels();
+    return kernels[static_cast<size_t>(accuracy)];
+}
+
+} // end namespace plugin
@@ -0,0 +1,289 @@
+#ifndef RESTRAINT_KERNELS_H
+#define RESTRAINT_KERNELS_H
+
+/*! \file
+ * \brief Gaussian kernels used for histogram blurring and bias force evaluation.
+ *
+ * The kernels operate on evenly spaced grids. Each kernel has a portable scalar
+ * implementation using the C library exp() and, on x86 hosts, implementations for
+ * SSE4.1, AVX2 and AVX-512 with a vectorized exp(). The implementation is chosen at
+ * run time from the instruction sets supported by the host, so a single build of the
+ * plugin uses the widest vectors available on each node of a heterogeneous cluster.
+ *
+ * The vectorized exp() has a relative error of a few units in the last place, so the
+ * kernels agree with the scalar implementation to about 1e-14 relative precision. Kernels
+ * with lower degree polynomials for exp() trade accuracy for speed (see ExpAccuracy). Set
+ * the environment variable GMXAPI_EXTENSION_SIMD to "none", "sse4", "avx2" or "avx512"
+ * to request a specific implementation (e.g. for reproducibility checks). A request for
+ * an implementation that is not available on the host is ignored.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cstddef>
+
+#include <utility>
+#include <vector>
+
+namespace plugin
+{
+
+/*!
+ * \brief Instruction sets for which kernels may be provided.
+ */
+enum class SimdLevel
+{
+    None,
+    Sse4,
+    Avx2,
+    Avx512
+};
+
+/*!
+ * \brief Floating point type of the histogram grids passed to the kernels.
+ *
+ * Single precision halves the memory traffic and doubles the SIMD width. GROMACS mixed precision
+ * builds pass coordinates and receive forces in single precision anyway.
+ */
+enum class KernelPrecision
+{
+    Double,
+    Single
+};
+
+/*!
+ * \brief Relative accuracy of the exponential function in the kernels.
+ *
+ * The reduced accuracy kernels evaluate exp() with a shorter polynomial after the same range
+ * reduction, in the scalar implementation as well. The bias is a coarse statistical potential,
+ * so errors far below the statistical noise of the histogram do not change the results.
+ */
+enum class ExpAccuracy
+{
+    /// A few units in the last place. The scalar kernels use the C library exp().
+    Full,
+    /// Relative error below 1e-7 (single precision terms are limited to their rounding error).
+    Relative1e7,
+    /// Relative error below 1e-4.
+    Relative1e4
+};
+
+/// Number of ExpAccuracy values.
+constexpr size_t numExpAccuracies = 3;
+
+/*!
+ * \brief How the Gaussian terms of the double precision kernels are evaluated.
+ */
+enum class GaussianEvaluation
+{
+    /// Evaluate exp() for every grid point, with the kernels of gaussianKernels().
+    Direct,
+    /// Use the recurrence of Gaussian terms on an evenly spaced grid (see recurrenceAccumulate()).
+    Recurrence
+};
+
+/*!
+ * \brief Accumulate a Gaussian onto a range of grid points.
+ *
+ * For i in [first, end), x = low + i * gridSpacing - center,
+ *
+ *     grid[i] += scale * exp(-exponentScale * x * x)
+ */
+using GaussianAccumulateFunction = void (*)(double center,
+                                            double low,
+                                            double gridSpacing,
+                                            double scale,
+                                            double exponentScale,
+                                            size_t first,
+                                            size_t end,
+                                            double* grid);
+
+/*!
+ * \brief Weighted moments of a Gaussian over a range of grid points.
+ *
+ * For i in [first, end), x = low + i * gridSpacing - center, and g = weights[i] * exp(-exponentScale * x * x),
+ *
+ *     sums[0] = sum(g), sums[1] = sum(g * x), sums[2] = sum(g * x * x)
+ */
+using GaussianMomentsFunction = void (*)(const double* weights,
+                                         double low,
+                                         double gridSpacing,
+                                         double center,
+                                         double exponentScale,
+                                         size_t first,
+                                         size_t end,
+                                         double* sums);
+
+/*!
+ * \brief Single precision version of GaussianAccumulateFunction.
+ *
+ * Grid values and the Gaussian terms are single precision. The scalar arguments are converted
+ * to single precision after computing low - center in double precision.
+ */
+using GaussianAccumulateFloatFunction = void (*)(double center,
+                                                 double low,
+                                                 double gridSpacing,
+                                                 double scale,
+                                                 double exponentScale,
+                                                 size_t first,
+                                                 size_t end,
+                                                 float* grid);
+
+/*!
+ * \brief Single precision version of GaussianMomentsFunction.
+ *
+ * The terms are computed in single precision, but the sums have cancellations between the grid
+ * points on either side of the center, so they are accumulated with compensated (Kahan) summation
+ * and returned in double precision.
+ */
+using GaussianMomentsFloatFunction = void (*)(const float* weights,
+                                              double low,
+                                              double gridSpacing,
+                                              double center,
+                                              double exponentScale,
+                                              size_t first,
+                                              size_t end,
+                                              double* sums);
+
+/*!
+ * \brief Bin counts for which kernels with a compile-time number of grid points are compiled.
+ *
+ * See GaussianKernels::fixedMoments and FixedEnsemblePotential.
+ */
+using FixedBinCounts = std::index_sequence<50, 70, 100, 200>;
+
+/// Number of bin counts in FixedBinCounts.
+constexpr size_t numFixedBinCounts = FixedBinCounts::size();
+
+/*!
+ * \brief Number of grid points of the fixed-size kernels for a bin count.
+ *
+ * Rounded up to a multiple of eight doubles, the widest vector, so no kernel has a partial vector.
+ */
+constexpr size_t paddedBinCount(size_t nBins)
+{
+    return (nBins + 7) / 8 * 8;
+}
+
+/*!
+ * \brief Position of a bin count in a list of bin counts.
+ *
+ * \return the index of nBins in N, or sizeof...(N) if it is not in the list.
+ */
+template<size_t ... N>
+constexpr size_t fixedBinCountIndex(size_t nBins,
+                                    std::index_sequence<N...>)
+{
+    const size_t counts[] = {N...};
+    size_t i = 0;
+    while (i < sizeof...(N) && counts[i] != nBins)
+    {
+        ++i;
+    }
+    return i;
+}
+
+/*!
+ * \brief Position of a bin count in FixedBinCounts, or numFixedBinCounts if it is not supported.
+ */
+constexpr size_t fixedBinCountIndex(size_t nBins)
+{
+    return fixedBinCountIndex(nBins,
+                              FixedBinCounts());
+}
+
+/*!
+ * \brief GaussianMomentsFunction over a grid whose size is fixed at compile time.
+ *
+ * Same as a GaussianMomentsFunction with first = 0 and end = paddedBinCount(N), for the bin count N
+ * of FixedBinCounts that the function was compiled for. The trip count of the loop is a constant, so
+ * there is no remainder handling and the compiler may unroll the loop. Weights past N must be zero.
+ */
+using GaussianFixedMomentsFunction = void (*)(const double* weights,
+                                              double low,
+                                              double gridSpacing,
+                                              double center,
+                                              double exponentScale,
+                                              double* sums);
+
+/*!
+ * \brief Set of kernel implementations for one instruction set.
+ */
+struct GaussianKernels
+{
+    /// Instruction set required by the implementation.
+    SimdLevel level;
+    /// Human-readable name of the instruction set.
+    const char* name;
+    /// Accuracy of exp() in the kernels.
+    ExpAccuracy accuracy;
+    GaussianAccumulateFunction accumulate;
+    GaussianMomentsFunction moments;
+    GaussianAccumulateFloatFunction accumulateFloat;
+    GaussianMomentsFloatFunction momentsFloat;
+    /// Fixed-size moments for each bin count of FixedBinCounts, in the same order.
+    GaussianFixedMomentsFunction fixedMoments[numFixedBinCounts];
+};
+
+/*!
+ * \brief GaussianAccumulateFunction evaluated with a recurrence instead of an exp() per grid point.
+ *
+ * On an evenly spaced grid, consecutive Gaussian terms g(n) = exp(-a x(n)^2) with
+ * x(n) = x(0) + n * gridSpacing are related by g(n + 1) = g(n) r(n), where the ratios satisfy
+ * r(n + 1) = r(n) q with q = exp(-2 a gridSpacing^2). The terms are generated outwards from the
+ * grid point nearest the center, so only three exp() calls are needed, and the terms decrease
+ * monotonically along each direction.
+ *
+ * The recurrence runs on terms relative to the term of the starting point, which are rescaled as
+ * they are used, so terms do not underflow early when the center is far from the range.
+ * A direction is abandoned when its relative terms fall below 1e-300, beyond which all terms are
+ * smaller. The relative error of the n-th term from the start grows as about n^2 / 2 units in the
+ * last place (about 1e-11 after 500 grid points), so the result is not bitwise identical to the
+ * direct kernels.
+ */
+void recurrenceAccumulate(double center,
+                          double low,
+                          double gridSpacing,
+                          double scale,
+                          double exponentScale,
+                          size_t first,
+                          size_t end,
+                          double* grid);
+
+/*!
+ * \brief GaussianMomentsFunction evaluated with the recurrence of recurrenceAccumulate().
+ */
+void recurrenceMoments(const double* weights,
+                       double low,
+                       double gridSpacing,
+                       double center,
+                       double exponentScale,
+                       size_t first,
+                       size_t end,
+                       double* sums);
+
+/*!
+ * \brief Get the kernels to use on this host.
+ *
+ * The choice of instruction set is made on the first call and does not change during the
+ * process lifetime.
+ *
+ * \param accuracy accuracy of exp() in the kernels.
+ * \return the kernels for the widest instruction set supported by the host, unless overridden
+ * by the GMXAPI_EXTENSION_SIMD environment variable.
+ */
+const GaussianKernels& gaussianKernels(ExpAccuracy accuracy = ExpAccuracy::Full);
+
+/*!
+ * \brief List the kernel implementations that can run on this host.
+ *
+ * Intended for testing and benchmarking.
+ *
+ * \param accuracy accuracy of exp() in the kernels.
+ * \return kernel sets, starting with the scalar implementation, in order of increasing vector width.
+ */
+std::vector<const GaussianKernels*> availableGaussianKernels(ExpAccuracy accuracy = ExpAccuracy::Full);
+
+} // end namespace plugin
+
+#endif //RESTRAINT_KERNELS_H
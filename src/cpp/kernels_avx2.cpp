@@ -0,0 +1,99 @@
+/*! \file
+ * \brief AVX2 implementation of the Gaussian kernels declared in kernels.h
+ *
+ * This file must be compiled with AVX2 and FMA enabled (e.g. -mavx2 -mfma). The functions
+ * defined here must only be called after checking that the host supports AVX2 and FMA.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "kernels.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+#include <immintrin.h>
+
+namespace plugin
+{
+
+namespace avx2
+{
+
+struct Traits
+{
+    using V = __m256d;
+    static constexpr size_t width = 4;
+
+    static V set1(double a) { return _mm256_set1_pd(a); }
+    static V iota() { return _mm256_set_pd(3., 2., 1., 0.); }
+    static V loadu(const double* p) { return _mm256_loadu_pd(p); }
+    static void storeu(double* p, V a) { _mm256_storeu_pd(p, a); }
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V min(V a, V b) { return _mm256_min_pd(a, b); }
+    static V max(V a, V b) { return _mm256_max_pd(a, b); }
+    static V fma(V a, V b, V c) { return _mm256_fmadd_pd(a, b, c); }
+    static V scaleByPowerOfTwo(V p, V t)
+    {
+        const __m256i exponent = _mm256_slli_epi64(_mm256_castpd_si256(t), 52);
+        return _mm256_castsi256_pd(_mm256_add_epi64(_mm256_castpd_si256(p), exponent));
+    }
+    static double hsum(V a)
+    {
+        const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+    }
+};
+
+struct FloatTraits
+{
+    using V = __m256;
+    static constexpr size_t width = 8;
+
+    static V set1(float a) { return _mm256_set1_ps(a); }
+    static V iota() { return _mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f); }
+    static V loadu(const float* p) { return _mm256_loadu_ps(p); }
+    static void storeu(float* p, V a) { _mm256_storeu_ps(p, a); }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V min(V a, V b) { return _mm256_min_ps(a, b); }
+    static V max(V a, V b) { return _mm256_max_ps(a, b); }
+    static V fma(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+    static V scaleByPowerOfTwo(V p, V t)
+    {
+        const __m256i exponent = _mm256_slli_epi32(_mm256_castps_si256(t), 23);
+        return _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(p), exponent));
+    }
+    static V zeroWhereLess(V a, V x, V limit) { return _mm256_and_ps(a, _mm256_cmp_ps(x, limit, _CMP_GE_OQ)); }
+    static double hsum(V a)
+    {
+        return Traits::hsum(_mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(a)),
+                                          _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1))));
+    }
+};
+
+} // end namespace plugin::avx2
+
+} // end namespace plugin
+
+#include "kernels_simd.h"
+
+namespace plugin
+{
+
+namespace avx2
+{
+
+/// Kernels for each ExpAccuracy, in the order of its values.
+extern const GaussianKernels kernels[numExpAccuracies]{
+    simd::makeKernels<Traits, FloatTraits, ExpAccuracy::Full>(SimdLevel::Avx2, "AVX2"),
+    simd::makeKernels<Traits, FloatTraits, ExpAccuracy::Relative1e7>(SimdLevel::Avx2, "AVX2"),
+    simd::makeKernels<Traits, FloatTraits, ExpAccuracy::Relative1e4>(SimdLevel::Avx2, "AVX2")};
+
+} // end namespace plugin::avx2
+
+} // end namespace plugin
+
+#endif
@@ -0,0 +1,104 @@
+/*! \file
+ * \brief AVX-512 implementation of the Gaussian kernels declared in kernels.h
+ *
+ * This file must be compiled with AVX-512F enabled (e.g. -mavx512f). The functions defined
+ * here must only be called after checking that the host supports AVX-512F.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "kernels.h"
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+
+namespace plugin
+{
+
+namespace avx512
+{
+
+struct Traits
+{
+    using V = __m512d;
+    static constexpr size_t width = 8;
+
+    static V set1(double a) { return _mm512_set1_pd(a); }
+    static V iota() { return _mm512_set_pd(7., 6., 5., 4., 3., 2., 1., 0.); }
+    static V loadu(const double* p) { return _mm512_loadu_pd(p); }
+    static void storeu(double* p, V a) { _mm512_storeu_pd(p, a); }
+    static V add(V a, V b) { return _mm512_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+    static V min(V a, V b) { return _mm512_min_pd(a, b); }
+    static V max(V a, V b) { return _mm512_max_pd(a, b); }
+    static V fma(V a, V b, V c) { return _mm512_fmadd_pd(a, b, c); }
+    static V scaleByPowerOfTwo(V p, V t)
+    {
+        const __m512i exponent = _mm512_slli_epi64(_mm512_castpd_si512(t), 52);
+        return _mm512_castsi512_pd(_mm512_add_epi64(_mm512_castpd_si512(p), exponent));
+    }
+    static double hsum(V a) { return _mm512_reduce_add_pd(a); }
+};
+
+struct FloatTraits
+{
+    using V = __m512;
+    static constexpr size_t width = 16;
+
+    static V set1(float a) { return _mm512_set1_ps(a); }
+    static V iota()
+    {
+        return _mm512_set_ps(15.f, 14.f, 13.f, 12.f, 11.f, 10.f, 9.f, 8.f,
+                             7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f);
+    }
+    static V loadu(const float* p) { return _mm512_loadu_ps(p); }
+    static void storeu(float* p, V a) { _mm512_storeu_ps(p, a); }
+    static V add(V a, V b) { return _mm512_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+    static V min(V a, V b) { return _mm512_min_ps(a, b); }
+    static V max(V a, V b) { return _mm512_max_ps(a, b); }
+    static V fma(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+    static V scaleByPowerOfTwo(V p, V t)
+    {
+        const __m512i exponent = _mm512_slli_epi32(_mm512_castps_si512(t), 23);
+        return _mm512_castsi512_ps(_mm512_add_epi32(_mm512_castps_si512(p), exponent));
+    }
+    static V zeroWhereLess(V a, V x, V limit)
+    {
+        return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, limit, _CMP_GE_OQ), a);
+    }
+    static double hsum(V a)
+    {
+        // The upper half is extracted as doubles to avoid requiring AVX-512DQ.
+        const __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1));
+        return _mm512_reduce_add_pd(_mm512_add_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(a)),
+                                                  _mm512_cvtps_pd(high)));
+    }
+};
+
+} // end namespace plugin::avx512
+
+} // end namespace plugin
+
+#include "kernels_simd.h"
+
+namespace plugin
+{
+
+namespace avx512
+{
+
+/// Kernels for each ExpAccuracy, in the order of its values.
+extern const GaussianKernels kernels[numExpAccuracies]{
+    simd::makeKernels<Traits, FloatTraits, ExpAccuracy::Full>(SimdLevel::Avx512, "AVX-512"),
+    simd::makeKernels<Traits, FloatTraits, ExpAccuracy::Relative1e7>(SimdLevel::Avx512, "AVX-512"),
+    simd::makeKernels<Traits, FloatTraits, ExpAccuracy::Relative1e4>(SimdLevel::Avx512, "AVX-512")};
+
+} // end namespace plugin::avx512
+
+} // end namespace plugin
+
+#endif
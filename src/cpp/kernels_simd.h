@@ -0,0 +1,515 @@
+#ifndef RESTRAINT_KERNELS_SIMD_H
+#define RESTRAINT_KERNELS_SIMD_H
+
+/*! \file
+ * \brief Vectorized Gaussian kernels, generic over the SIMD instruction set.
+ *
+ * This header is only included by the instruction-set specific translation units
+ * (kernels_sse4.cpp, kernels_avx2.cpp, kernels_avx512.cpp), each of which is compiled with
+ * the flags for its instruction set, and by kernels.cpp for the reduced accuracy scalar kernels.
+ * Each provides a traits class T with
+ *
+ *  - T::V, a vector of T::width doubles,
+ *  - set1, iota (0, 1, 2, ...), loadu, storeu, add, sub, mul, min, max,
+ *  - fma(a, b, c) == a * b + c,
+ *  - scaleByPowerOfTwo(p, t), which adds the integer in the low mantissa bits of t to the exponent of p,
+ *  - hsum, the sum of the elements of a vector.
+ *
+ * The single precision kernels take a traits class with the same members for a vector of floats,
+ * except that hsum returns the sum of the elements in double precision, and with
+ *
+ *  - zeroWhereLess(a, x, limit), which is a where x >= limit and zero elsewhere.
+ *
+ * Every template here is parameterized by the traits class, which lives in a namespace specific
+ * to the instruction set. Code compiled for one instruction set can therefore never be selected
+ * by the linker in place of code compiled for another. For the same reason, do not use standard
+ * library templates in this header.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cstddef>
+
+#include "kernels.h"
+
+namespace plugin
+{
+
+namespace simd
+{
+
+/// N!, exact in double precision for N <= 18.
+template<int N>
+struct Factorial
+{
+    static constexpr double value = N * Factorial<N - 1>::value;
+};
+
+template<>
+struct Factorial<0>
+{
+    static constexpr double value = 1.0;
+};
+
+/*!
+ * \brief Horner evaluation of the Taylor polynomial of exp(r) from the coefficient of degree K down.
+ *
+ * \tparam T SIMD traits class.
+ * \tparam Real scalar type of the vector elements.
+ * \tparam K degree of the next coefficient to apply.
+ */
+template<class T, class Real, int K>
+struct TaylorExp
+{
+    static typename T::V horner(typename T::V p,
+                                typename T::V r)
+    {
+        const Real coefficient = static_cast<Real>(1.0 / Factorial<K>::value);
+        return TaylorExp<T, Real, K - 1>::horner(T::fma(p, r, T::set1(coefficient)), r);
+    }
+};
+
+template<class T, class Real>
+struct TaylorExp<T, Real, -1>
+{
+    static typename T::V horner(typename T::V p,
+                                typename T::V /* r */)
+    {
+        return p;
+    }
+};
+
+/*!
+ * \brief Degree of the Taylor polynomial of exp() in double precision kernels for each ExpAccuracy.
+ *
+ * The truncation error of a degree n polynomial for |r| <= ln(2)/2 is below
+ * (ln(2)/2)^(n+1) / (n+1)! / exp(-ln(2)/2) relative to exp(r): about 1e-17 for degree 13,
+ * 7e-9 for degree 7, and 6e-5 for degree 4.
+ */
+constexpr int expDegree(ExpAccuracy accuracy)
+{
+    return accuracy == ExpAccuracy::Full ? 13 : (accuracy == ExpAccuracy::Relative1e7 ? 7 : 4);
+}
+
+/*!
+ * \brief Degree of the Taylor polynomial of exp() in single precision kernels for each ExpAccuracy.
+ *
+ * Single precision terms are limited to about 1e-7 relative precision by rounding, so only
+ * ExpAccuracy::Relative1e4 uses a lower degree than ExpAccuracy::Full.
+ */
+constexpr int expFloatDegree(ExpAccuracy accuracy)
+{
+    return accuracy == ExpAccuracy::Relative1e4 ? 4 : 7;
+}
+
+/*!
+ * \brief Vectorized exponential function.
+ *
+ * Uses Cody-Waite range reduction x = n ln(2) + r with |r| <= ln(2)/2 and a Taylor polynomial
+ * for exp(r). The default degree 13 gives a relative error of a few units in the last place,
+ * and lower degrees trade accuracy for speed (see expDegree()). Arguments are clamped to
+ * [-708, 709], so results below the smallest normal double are returned as about 3e-308 rather
+ * than as denormals or zero.
+ *
+ * \tparam T SIMD traits class.
+ * \tparam Degree degree of the polynomial.
+ * \param x exponents
+ * \return exp(x) for each element.
+ */
+template<class T, int Degree = 13>
+inline typename T::V exp(typename T::V x)
+{
+    using V = typename T::V;
+    x = T::max(x, T::set1(-708.0));
+    x = T::min(x, T::set1(709.0));
+
+    // Adding 1.5 * 2^52 rounds x / ln(2) to the nearest integer n and leaves n in the low mantissa bits.
+    const V shifter = T::set1(6755399441055744.0);
+    const V t = T::fma(x, T::set1(1.4426950408889634074), shifter);
+    const V n = T::sub(t, shifter);
+    // ln(2) split such that n * ln2High is exact.
+    V r = T::fma(n, T::set1(-6.93147180369123816490e-01), x);
+    r = T::fma(n, T::set1(-1.90821492927058770002e-10), r);
+
+    const V p = TaylorExp<T, double, Degree - 1>::horner(T::set1(1.0 / Factorial<Degree>::value), r);
+
+    return T::scaleByPowerOfTwo(p, t);
+}
+
+/*!
+ * \brief Implements GaussianAccumulateFunction.
+ *
+ * \tparam Degree degree of the polynomial of exp().
+ */
+template<class T, int Degree = 13>
+void accumulate(double center,
+                double low,
+                double gridSpacing,
+                double scale,
+                double exponentScale,
+                size_t first,
+                size_t end,
+                double* grid)
+{
+    using V = typename T::V;
+    constexpr size_t width = T::width;
+
+    const V x0 = T::set1(low - center);
+    const V dx = T::set1(gridSpacing);
+    const V a = T::set1(-exponentScale);
+    const V s = T::set1(scale);
+    const V step = T::set1(static_cast<double>(width));
+    V index = T::add(T::set1(static_cast<double>(first)), T::iota());
+
+    size_t i = first;
+    for (; i + width <= end; i += width)
+    {
+        const V x = T::fma(index, dx, x0);
+        const V g = T::mul(s, exp<T, Degree>(T::mul(a, T::mul(x, x))));
+        T::storeu(grid + i, T::add(T::loadu(grid + i), g));
+        index = T::add(index, step);
+    }
+    if (i < end)
+    {
+        // Process the remainder in a padded buffer.
+        double buffer[width] = {};
+        const size_t remainder = end - i;
+        for (size_t j = 0; j < remainder; ++j)
+        {
+            buffer[j] = grid[i + j];
+        }
+        const V x = T::fma(index, dx, x0);
+        const V g = T::mul(s, exp<T, Degree>(T::mul(a, T::mul(x, x))));
+        T::storeu(buffer, T::add(T::loadu(buffer), g));
+        for (size_t j = 0; j < remainder; ++j)
+        {
+            grid[i + j] = buffer[j];
+        }
+    }
+}
+
+/*!
+ * \brief Implements GaussianMomentsFunction.
+ *
+ * \tparam Degree degree of the polynomial of exp().
+ */
+template<class T, int Degree = 13>
+void moments(const double* weights,
+             double low,
+             double gridSpacing,
+             double center,
+             double exponentScale,
+             size_t first,
+             size_t end,
+             double* sums)
+{
+    using V = typename T::V;
+    constexpr size_t width = T::width;
+
+    const V x0 = T::set1(low - center);
+    const V dx = T::set1(gridSpacing);
+    const V a = T::set1(-exponentScale);
+    const V step = T::set1(static_cast<double>(width));
+    V index = T::add(T::set1(static_cast<double>(first)), T::iota());
+
+    V sum0 = T::set1(0.);
+    V sum1 = T::set1(0.);
+    V sum2 = T::set1(0.);
+
+    size_t i = first;
+    for (; i + width <= end; i += width)
+    {
+        const V x = T::fma(index, dx, x0);
+        const V g = T::mul(T::loadu(weights + i), exp<T, Degree>(T::mul(a, T::mul(x, x))));
+        const V gx = T::mul(g, x);
+        sum0 = T::add(sum0, g);
+        sum1 = T::add(sum1, gx);
+        sum2 = T::fma(gx, x, sum2);
+        index = T::add(index, step);
+    }
+    if (i < end)
+    {
+        // Zero weights pad the remainder to a full vector.
+        double buffer[width] = {};
+        for (size_t j = 0; i + j < end; ++j)
+        {
+            buffer[j] = weights[i + j];
+        }
+        const V x = T::fma(index, dx, x0);
+        const V g = T::mul(T::loadu(buffer), exp<T, Degree>(T::mul(a, T::mul(x, x))));
+        const V gx = T::mul(g, x);
+        sum0 = T::add(sum0, g);
+        sum1 = T::add(sum1, gx);
+        sum2 = T::fma(gx, x, sum2);
+    }
+
+    sums[0] = T::hsum(sum0);
+    sums[1] = T::hsum(sum1);
+    sums[2] = T::hsum(sum2);
+}
+
+/*!
+ * \brief Implements GaussianFixedMomentsFunction.
+ *
+ * Same arithmetic as moments() over [0, N), without the partial vector at the end.
+ *
+ * \tparam Degree degree of the polynomial of exp().
+ * \tparam N number of grid points, a multiple of the vector width.
+ */
+template<class T, int Degree, size_t N>
+void fixedMoments(const double* weights,
+                  double low,
+                  double gridSpacing,
+                  double center,
+                  double exponentScale,
+                  double* sums)
+{
+    using V = typename T::V;
+    constexpr size_t width = T::width;
+    static_assert(N % width == 0, "The grid must be a whole number of vectors.");
+
+    const V x0 = T::set1(low - center);
+    const V dx = T::set1(gridSpacing);
+    const V a = T::set1(-exponentScale);
+    const V step = T::set1(static_cast<double>(width));
+    V index = T::iota();
+
+    V sum0 = T::set1(0.);
+    V sum1 = T::set1(0.);
+    V sum2 = T::set1(0.);
+
+    for (size_t i = 0; i < N; i += width)
+    {
+        const V x = T::fma(index, dx, x0);
+        const V g = T::mul(T::loadu(weights + i), exp<T, Degree>(T::mul(a, T::mul(x, x))));
+        const V gx = T::mul(g, x);
+        sum0 = T::add(sum0, g);
+        sum1 = T::add(sum1, gx);
+        sum2 = T::fma(gx, x, sum2);
+        index = T::add(index, step);
+    }
+
+    sums[0] = T::hsum(sum0);
+    sums[1] = T::hsum(sum1);
+    sums[2] = T::hsum(sum2);
+}
+
+/*!
+ * \brief Vectorized single precision exponential function.
+ *
+ * Same method as exp(), with a degree 7 Taylor polynomial by default for a relative error of
+ * about one unit in the last place (see expFloatDegree()). Arguments are clamped to [-87, 88].
+ *
+ * \tparam T single precision SIMD traits class.
+ * \tparam Degree degree of the polynomial.
+ * \param x exponents
+ * \return exp(x) for each element.
+ */
+template<class T, int Degree = 7>
+inline typename T::V expFloat(typename T::V x)
+{
+    using V = typename T::V;
+    x = T::max(x, T::set1(-87.0f));
+    x = T::min(x, T::set1(88.0f));
+
+    // Adding 1.5 * 2^23 rounds x / ln(2) to the nearest integer n and leaves n in the low mantissa bits.
+    const V shifter = T::set1(12582912.0f);
+    const V t = T::fma(x, T::set1(1.44269504f), shifter);
+    const V n = T::sub(t, shifter);
+    // ln(2) split such that n * ln2High is exact.
+    V r = T::fma(n, T::set1(-0.693359375f), x);
+    r = T::fma(n, T::set1(2.12194440e-4f), r);
+
+    const V p = TaylorExp<T, float, Degree - 1>::horner(T::set1(static_cast<float>(1.0 / Factorial<Degree>::value)), r);
+
+    return T::scaleByPowerOfTwo(p, t);
+}
+
+/*!
+ * \brief Single precision Gaussian term exp(-a x^2).
+ *
+ * Terms smaller than exp(-60) are flushed to zero. They are far below single precision
+ * resolution relative to the peak, and multiplying them by weights would produce denormals,
+ * which are very slow on x86.
+ *
+ * \tparam T single precision SIMD traits class.
+ * \tparam Degree degree of the polynomial of exp().
+ * \param x distances from the center
+ * \param a negative exponent scale, -a.
+ */
+template<class T, int Degree = 7>
+inline typename T::V gaussianFloat(typename T::V x,
+                                   typename T::V a)
+{
+    const typename T::V exponent = T::mul(a, T::mul(x, x));
+    return T::zeroWhereLess(expFloat<T, Degree>(exponent), exponent, T::set1(-60.0f));
+}
+
+/*!
+ * \brief Implements GaussianAccumulateFloatFunction.
+ *
+ * \tparam T single precision SIMD traits class.
+ * \tparam Degree degree of the polynomial of exp().
+ */
+template<class T, int Degree = 7>
+void accumulateFloat(double center,
+                     double low,
+                     double gridSpacing,
+                     double scale,
+                     double exponentScale,
+                     size_t first,
+                     size_t end,
+                     float* grid)
+{
+    using V = typename T::V;
+    constexpr size_t width = T::width;
+
+    const V x0 = T::set1(static_cast<float>(low - center));
+    const V dx = T::set1(static_cast<float>(gridSpacing));
+    const V a = T::set1(static_cast<float>(-exponentScale));
+    const V s = T::set1(static_cast<float>(scale));
+    const V step = T::set1(static_cast<float>(width));
+    V index = T::add(T::set1(static_cast<float>(first)), T::iota());
+
+    size_t i = first;
+    for (; i + width <= end; i += width)
+    {
+        const V x = T::fma(index, dx, x0);
+        const V g = T::mul(s, gaussianFloat<T, Degree>(x, a));
+        T::storeu(grid + i, T::add(T::loadu(grid + i), g));
+        index = T::add(index, step);
+    }
+    if (i < end)
+    {
+        // Process the remainder in a padded buffer.
+        float buffer[width] = {};
+        const size_t remainder = end - i;
+        for (size_t j = 0; j < remainder; ++j)
+        {
+            buffer[j] = grid[i + j];
+        }
+        const V x = T::fma(index, dx, x0);
+        const V g = T::mul(s, gaussianFloat<T, Degree>(x, a));
+        T::storeu(buffer, T::add(T::loadu(buffer), g));
+        for (size_t j = 0; j < remainder; ++j)
+        {
+            grid[i + j] = buffer[j];
+        }
+    }
+}
+
+/*!
+ * \brief Add to a compensated (Kahan) sum.
+ *
+ * The running error is kept in compensation and subtracted from the next term.
+ */
+template<class T>
+inline void compensatedAdd(typename T::V value,
+                           typename T::V* sum,
+                           typename T::V* compensation)
+{
+    const typename T::V y = T::sub(value, *compensation);
+    const typename T::V t = T::add(*sum, y);
+    *compensation = T::sub(T::sub(t, *sum), y);
+    *sum = t;
+}
+
+/*!
+ * \brief Implements GaussianMomentsFloatFunction.
+ *
+ * \tparam T single precision SIMD traits class.
+ * \tparam Degree degree of the polynomial of exp().
+ */
+template<class T, int Degree = 7>
+void momentsFloat(const float* weights,
+                  double low,
+                  double gridSpacing,
+                  double center,
+                  double exponentScale,
+                  size_t first,
+                  size_t end,
+                  double* sums)
+{
+    using V = typename T::V;
+    constexpr size_t width = T::width;
+
+    const V x0 = T::set1(static_cast<float>(low - center));
+    const V dx = T::set1(static_cast<float>(gridSpacing));
+    const V a = T::set1(static_cast<float>(-exponentScale));
+    const V step = T::set1(static_cast<float>(width));
+    V index = T::add(T::set1(static_cast<float>(first)), T::iota());
+
+    V sum[3] = {T::set1(0.f), T::set1(0.f), T::set1(0.f)};
+    V compensation[3] = {T::set1(0.f), T::set1(0.f), T::set1(0.f)};
+
+    size_t i = first;
+    for (; i + width <= end; i += width)
+    {
+        const V x = T::fma(index, dx, x0);
+        const V g = T::mul(T::loadu(weights + i), gaussianFloat<T, Degree>(x, a));
+        const V gx = T::mul(g, x);
+        compensatedAdd<T>(g, &sum[0], &compensation[0]);
+        compensatedAdd<T>(gx, &sum[1], &compensation[1]);
+        compensatedAdd<T>(T::mul(gx, x), &sum[2], &compensation[2]);
+        index = T::add(index, step);
+    }
+    if (i < end)
+    {
+        // Zero weights pad the remainder to a full vector.
+        float buffer[width] = {};
+        for (size_t j = 0; i + j < end; ++j)
+        {
+            buffer[j] = weights[i + j];
+        }
+        const V x = T::fma(index, dx, x0);
+        const V g = T::mul(T::loadu(buffer), gaussianFloat<T, Degree>(x, a));
+        const V gx = T::mul(g, x);
+        compensatedAdd<T>(g, &sum[0], &compensation[0]);
+        compensatedAdd<T>(gx, &sum[1], &compensation[1]);
+        compensatedAdd<T>(T::mul(gx, x), &sum[2], &compensation[2]);
+    }
+
+    // Combine the lanes in double precision.
+    for (int m = 0; m < 3; ++m)
+    {
+        sums[m] = T::hsum(sum[m]) - T::hsum(compensation[m]);
+    }
+}
+
+/*!
+ * \brief Kernels for an instruction set with an accuracy of exp().
+ *
+ * \tparam T SIMD traits class.
+ * \tparam FloatT single precision SIMD traits class.
+ * \tparam Accuracy accuracy of exp().
+ * \tparam NBins the bin counts of FixedBinCounts.
+ */
+template<class T, class FloatT, ExpAccuracy Accuracy, size_t ... NBins>
+constexpr GaussianKernels makeKernels(SimdLevel level,
+                                      const char* name,
+                                      std::index_sequence<NBins...>)
+{
+    return {level,
+            name,
+            Accuracy,
+            &accumulate<T, expDegree(Accuracy)>,
+            &moments<T, expDegree(Accuracy)>,
+            &accumulateFloat<FloatT, expFloatDegree(Accuracy)>,
+            &momentsFloat<FloatT, expFloatDegree(Accuracy)>,
+            {&fixedMoments<T, expDegree(Accuracy), paddedBinCount(NBins)>...}};
+}
+
+template<class T, class FloatT, ExpAccuracy Accuracy>
+constexpr GaussianKernels makeKernels(SimdLevel level,
+                                      const char* name)
+{
+    return makeKernels<T, FloatT, Accuracy>(level,
+                                            name,
+                                            FixedBinCounts());
+}
+
+} // end namespace plugin::simd
+
+} // end namespace plugin
+
+#endif //RESTRAINT_KERNELS_SIMD_H
@@ -0,0 +1,98 @@
+/*! \file
+ * \brief SSE4.1 implementation of the Gaussian kernels declared in kernels.h
+ *
+ * This file must be compiled with SSE4.1 enabled (e.g. -msse4.1). The functions defined
+ * here must only be called after checking that the host supports SSE4.1.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "kernels.h"
+
+#if defined(__SSE4_1__)
+
+#include <smmintrin.h>
+
+namespace plugin
+{
+
+namespace sse4
+{
+
+struct Traits
+{
+    using V = __m128d;
+    static constexpr size_t width = 2;
+
+    static V set1(double a) { return _mm_set1_pd(a); }
+    static V iota() { return _mm_set_pd(1., 0.); }
+    static V loadu(const double* p) { return _mm_loadu_pd(p); }
+    static void storeu(double* p, V a) { _mm_storeu_pd(p, a); }
+    static V add(V a, V b) { return _mm_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+    static V min(V a, V b) { return _mm_min_pd(a, b); }
+    static V max(V a, V b) { return _mm_max_pd(a, b); }
+    // No fused multiply-add before AVX2.
+    static V fma(V a, V b, V c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static V scaleByPowerOfTwo(V p, V t)
+    {
+        const __m128i exponent = _mm_slli_epi64(_mm_castpd_si128(t), 52);
+        return _mm_castsi128_pd(_mm_add_epi64(_mm_castpd_si128(p), exponent));
+    }
+    static double hsum(V a)
+    {
+        return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a)));
+    }
+};
+
+struct FloatTraits
+{
+    using V = __m128;
+    static constexpr size_t width = 4;
+
+    static V set1(float a) { return _mm_set1_ps(a); }
+    static V iota() { return _mm_set_ps(3.f, 2.f, 1.f, 0.f); }
+    static V loadu(const float* p) { return _mm_loadu_ps(p); }
+    static void storeu(float* p, V a) { _mm_storeu_ps(p, a); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+    static V fma(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static V scaleByPowerOfTwo(V p, V t)
+    {
+        const __m128i exponent = _mm_slli_epi32(_mm_castps_si128(t), 23);
+        return _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(p), exponent));
+    }
+    static V zeroWhereLess(V a, V x, V limit) { return _mm_and_ps(a, _mm_cmpge_ps(x, limit)); }
+    static double hsum(V a)
+    {
+        return Traits::hsum(_mm_add_pd(_mm_cvtps_pd(a), _mm_cvtps_pd(_mm_movehl_ps(a, a))));
+    }
+};
+
+} // end namespace plugin::sse4
+
+} // end namespace plugin
+
+#include "kernels_simd.h"
+
+namespace plugin
+{
+
+namespace sse4
+{
+
+/// Kernels for each ExpAccuracy, in the order of its values.
+extern const GaussianKernels kernels[numExpAccuracies]{
+    simd::makeKernels<Traits, FloatTraits, ExpAccuracy::Full>(SimdLevel::Sse4, "SSE4.1"),
+    simd::makeKernels<Traits, FloatTraits, ExpAccuracy::Relative1e7>(SimdLevel::Sse4, "SSE4.1"),
+    simd::makeKernels<Traits, FloatTraits, ExpAccuracy::Relative1e4>(SimdLevel::Sse4, "SSE4.1")};
+
+} // end namespace plugin::sse4
+
+} // end namespace plugin
+
+#endif
@@ -0,0 +1,189 @@
+/*! \file
+ * \brief Implement the MPI ensemble reduction declared in mpireduce.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "mpireduce.h"
+
+#include <memory>
+
+#include <mpi.h>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+namespace
+{
+
+/*!
+ * \brief Owns a duplicate of the ensemble communicator.
+ */
+class MpiCommunicator
+{
+    public:
+        explicit MpiCommunicator(MPI_Comm communicator)
+        {
+            MPI_Comm_dup(communicator,
+                         &communicator_);
+            MPI_Comm_size(communicator_,
+                          &size_);
+        }
+
+        ~MpiCommunicator()
+        {
+            int finalized{0};
+            MPI_Finalized(&finalized);
+            if (!finalized)
+            {
+                MPI_Comm_free(&communicator_);
+            }
+        }
+
+        MpiCommunicator(const MpiCommunicator&) = delete;
+
+        MpiCommunicator& operator=(const MpiCommunicator&) = delete;
+
+        MPI_Comm get() const
+        {
+            return communicator_;
+        }
+
+        int size() const
+        {
+            return size_;
+        }
+
+    private:
+        MPI_Comm communicator_{MPI_COMM_NULL};
+        int size_{0};
+};
+
+/*!
+ * \brief Check that MPI can be used for ensemble reductions.
+ *
+ * \throws gmxapi::ProtocolError if MPI is not initialized or does not provide the required thread support.
+ */
+void checkMpi()
+{
+    int initialized{0};
+    MPI_Initialized(&initialized);
+    if (!initialized)
+    {
+        throw gmxapi::ProtocolError("MPI ensemble reduction requires MPI to be initialized.");
+    }
+    int threadSupport{MPI_THREAD_SINGLE};
+    MPI_Query_thread(&threadSupport);
+    if (threadSupport < MPI_THREAD_SERIALIZED)
+    {
+        throw gmxapi::ProtocolError("MPI ensemble reduction requires MPI_THREAD_SERIALIZED or MPI_THREAD_MULTIPLE.");
+    }
+}
+
+/*!
+ * \brief Convert the sum over the ranks of a communicator to the mean.
+ */
+void scaleToMean(Matrix<double>* receive,
+                 size_t count,
+                 int size)
+{
+    const double scale = 1.0 / size;
+    double* const data = receive->data();
+    for (size_t i = 0;i < count;++i)
+    {
+        data[i] *= scale;
+    }
+}
+
+/*!
+ * \brief Check the sizes of the matrices to reduce.
+ *
+ * \return number of elements.
+ */
+size_t reductionSize(const Matrix<double>& send,
+                     const Matrix<double>& receive)
+{
+    const auto count = send.rows() * send.cols();
+    if (receive.rows() * receive.cols() != count)
+    {
+        throw gmxapi::ProtocolError("MPI ensemble reduction requires send and receive matrices of the same size.");
+    }
+    return count;
+}
+
+} // end anonymous namespace
+
+std::function<void(const Matrix<double>&,
+                   Matrix<double>*)> makeMpiReduce(int fortranCommunicator)
+{
+    checkMpi();
+
+    // Share one duplicate among the copies made by std::function.
+    auto communicator = std::make_shared<MpiCommunicator>(MPI_Comm_f2c(fortranCommunicator));
+    return [communicator](const Matrix<double>& send,
+                          Matrix<double>* receive)
+    {
+        const auto count = reductionSize(send,
+                                         *receive);
+        MPI_Allreduce(send.data(),
+                      receive->data(),
+                      static_cast<int>(count),
+                      MPI_DOUBLE,
+                      MPI_SUM,
+                      communicator->get());
+        scaleToMean(receive,
+                    count,
+                    communicator->size());
+    };
+}
+
+std::function<ReduceRequest(const Matrix<double>&,
+                            Matrix<double>*)> makeMpiIreduce(int fortranCommunicator)
+{
+    checkMpi();
+
+    auto communicator = std::make_shared<MpiCommunicator>(MPI_Comm_f2c(fortranCommunicator));
+    return [communicator](const Matrix<double>& send,
+                          Matrix<double>* receive)
+    {
+        const auto count = reductionSize(send,
+                                         *receive);
+        auto request = std::make_shared<MPI_Request>();
+        MPI_Iallreduce(send.data(),
+                       receive->data(),
+                       static_cast<int>(count),
+                       MPI_DOUBLE,
+                       MPI_SUM,
+                       communicator->get(),
+                       request.get());
+        const int size = communicator->size();
+        auto test = [communicator, request, receive, count, size]()
+        {
+            int complete{0};
+            MPI_Test(request.get(),
+                     &complete,
+                     MPI_STATUS_IGNORE);
+            if (complete)
+            {
+                scaleToMean(receive,
+                            count,
+                            size);
+            }
+            return complete != 0;
+        };
+        auto wait = [communicator, request, receive, count, size]()
+        {
+            MPI_Wait(request.get(),
+                     MPI_STATUS_IGNORE);
+            scaleToMean(receive,
+                        count,
+                        size);
+        };
+        return ReduceRequest(std::move(test),
+                             std::move(wait));
+    };
+}
+
+} // end namespace plugin
@@ -0,0 +1,61 @@
+#ifndef RESTRAINT_MPIREDUCE_H
+#define RESTRAINT_MPIREDUCE_H
+
+/*! \file
+ * \brief Ensemble reduction with MPI for plugin::Resources.
+ *
+ * The reduce functor provided by the Python Context calls back into the Python interpreter at every
+ * window update. The functor declared here calls MPI directly from C++. It is only available if the
+ * library was built with MPI support, in which case GMXAPI_EXTENSION_MPI is defined.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <functional>
+
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Get a reduce function object that averages a Matrix across an MPI communicator.
+ *
+ * The function object sums the send Matrix over a duplicate of the communicator with
+ * MPI_Allreduce and divides the result by the size of the communicator, which matches the
+ * ensemble mean provided by the ensemble_update function of the Python Context. The reduction is
+ * collective, so every rank of the communicator must call it the same number of times with
+ * matrices of the same size.
+ *
+ * The communicator is passed as a Fortran handle (e.g. from mpi4py ``Comm.py2f()``) so that client
+ * code does not need the MPI headers. The duplicate communicator is freed when the last copy of the
+ * function object is destroyed, unless MPI has already been finalized.
+ *
+ * The restraint framework calls the reduction from the simulation master thread, which need not be
+ * the thread that initialized MPI, so MPI must provide at least MPI_THREAD_SERIALIZED.
+ *
+ * \param fortranCommunicator Fortran handle of the ensemble communicator.
+ * \return function object for the Resources constructor.
+ * \throws gmxapi::ProtocolError if MPI is not initialized or does not provide the required thread support.
+ */
+std::function<void(const Matrix<double>&,
+                   Matrix<double>*)> makeMpiReduce(int fortranCommunicator);
+
+/*!
+ * \brief Get a function object that starts the reduction of makeMpiReduce() without blocking.
+ *
+ * The function object starts an MPI_Iallreduce on a duplicate of the communicator. The average is
+ * written to the receive Matrix when the returned request completes. The requirements of
+ * makeMpiReduce() apply, and the function object can be used as the non-blocking reduce of
+ * Resources.
+ *
+ * \param fortranCommunicator Fortran handle of the ensemble communicator.
+ * \return function object for the Resources constructor.
+ * \throws gmxapi::ProtocolError if MPI is not initialized or does not provide the required thread support.
+ */
+std::function<ReduceRequest(const Matrix<double>&,
+                            Matrix<double>*)> makeMpiIreduce(int fortranCommunicator);
+
+} // end namespace plugin
+
+#endif //RESTRAINT_MPIREDUCE_H
@@ -0,0 +1,38 @@
+/*! \file
+ * \brief Definitions for the batched pair evaluation declared in pairevaluator.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "pairevaluator.h"
+
+namespace plugin
+{
+
+void evaluatePairs(const PairEvaluator* evaluators,
+                   const gmx::Vector* r1,
+                   const gmx::Vector* r2,
+                   size_t count,
+                   double t,
+                   gmx::PotentialPointData* output)
+{
+    size_t first{0};
+    while (first < count)
+    {
+        const auto batchFunction = evaluators[first].batchFunction;
+        size_t end{first + 1};
+        while (end < count && evaluators[end].batchFunction == batchFunction)
+        {
+            ++end;
+        }
+        batchFunction(evaluators + first,
+                      r1 + first,
+                      r2 + first,
+                      end - first,
+                      t,
+                      output + first);
+        first = end;
+    }
+}
+
+} // end namespace plugin
@@ -0,0 +1,131 @@
+#ifndef RESTRAINT_PAIREVALUATOR_H
+#define RESTRAINT_PAIREVALUATOR_H
+
+/*! \file
+ * \brief Type-erased pair restraint evaluation without virtual dispatch.
+ *
+ * GROMACS evaluates restraints through the virtual gmx::IRestraintPotential::evaluate(). Callers
+ * that hold many restraints, such as a driver evaluating all pairs of a simulation, can instead use
+ * a PairEvaluator: a plain function pointer bound to a restraint, whose function calls the
+ * concrete evaluate() of the restraint type directly, so the compiler can inline the potential into
+ * it. evaluatePairs() evaluates consecutive pairs of the same restraint type in a single call.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cstddef>
+
+#include "gromacs/restraint/restraintpotential.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief A restraint and the functions evaluating it.
+ *
+ * The restraint is not owned, and must outlive the evaluator. Evaluating through a PairEvaluator
+ * is equivalent to calling evaluate() on the restraint.
+ *
+ * Example:
+ *
+ *     std::vector<PairEvaluator> evaluators;
+ *     for (auto& restraint : restraints)
+ *     {
+ *         evaluators.push_back(restraint->pairEvaluator());
+ *     }
+ *     evaluatePairs(evaluators.data(), r1.data(), r2.data(), evaluators.size(), t, forces.data());
+ */
+struct PairEvaluator
+{
+    /// Evaluate the restraint at restraint for sites at r1 and r2 at time t.
+    using Function = gmx::PotentialPointData (*)(void* restraint,
+                                                 gmx::Vector r1,
+                                                 gmx::Vector r2,
+                                                 double t);
+    /*!
+     * \brief Evaluate count pairs whose evaluators all have the same batch function.
+     *
+     * output[i] is the result for evaluators[i].restraint with sites at r1[i] and r2[i].
+     */
+    using BatchFunction = void (*)(const PairEvaluator* evaluators,
+                                   const gmx::Vector* r1,
+                                   const gmx::Vector* r2,
+                                   size_t count,
+                                   double t,
+                                   gmx::PotentialPointData* output);
+
+    Function function;
+    BatchFunction batchFunction;
+    /// Restraint passed to the functions.
+    void* restraint;
+
+    gmx::PotentialPointData operator()(gmx::Vector r1,
+                                       gmx::Vector r2,
+                                       double t) const
+    {
+        return function(restraint,
+                        r1,
+                        r2,
+                        t);
+    }
+};
+
+/*!
+ * \brief Bind a restraint to the functions evaluating its type.
+ *
+ * The functions call Restraint::evaluate() by its qualified name, which is not a virtual call, so
+ * an evaluate() defined in a header is inlined into them.
+ *
+ * \tparam Restraint a gmx::IRestraintPotential implementation with a public evaluate().
+ */
+template<class Restraint>
+PairEvaluator makePairEvaluator(Restraint* restraint)
+{
+    const PairEvaluator::Function function = [](void* restraint,
+                                                gmx::Vector r1,
+                                                gmx::Vector r2,
+                                                double t)
+    {
+        return static_cast<Restraint*>(restraint)->Restraint::evaluate(r1,
+                                                                       r2,
+                                                                       t);
+    };
+    const PairEvaluator::BatchFunction batchFunction = [](const PairEvaluator* evaluators,
+                                                          const gmx::Vector* r1,
+                                                          const gmx::Vector* r2,
+                                                          size_t count,
+                                                          double t,
+                                                          gmx::PotentialPointData* output)
+    {
+        for (size_t i = 0;i < count;++i)
+        {
+            output[i] = static_cast<Restraint*>(evaluators[i].restraint)->Restraint::evaluate(r1[i],
+                                                                                              r2[i],
+                                                                                              t);
+        }
+    };
+    return {function, batchFunction, restraint};
+}
+
+/*!
+ * \brief Evaluate many pairs, with one indirect call per run of pairs of the same restraint type.
+ *
+ * Sorting the evaluators by restraint type makes the runs as long as possible.
+ *
+ * \param evaluators count evaluators.
+ * \param r1 first site of each pair.
+ * \param r2 reference site of each pair.
+ * \param count number of pairs.
+ * \param t simulation time.
+ * \param output destination for count results.
+ */
+void evaluatePairs(const PairEvaluator* evaluators,
+                   const gmx::Vector* r1,
+                   const gmx::Vector* r2,
+                   size_t count,
+                   double t,
+                   gmx::PotentialPointData* output);
+
+} // end namespace plugin
+
+#endif //RESTRAINT_PAIREVALUATOR_H
@@ -37,9 +37,48 @@ void ResourcesHandle::reduce(const Matrix<double>& send,
     }
 }
 
+ReduceRequest ResourcesHandle::ireduce(const Matrix<double>& send,
+                                      Matrix<double>* receive) const
+{
+    if (ireduce_ && *ireduce_)
+    {
+        return (*ireduce_)(send,
+                           receive);
+    }
+    reduce(send,
+           receive);
+    return {};
+}
+
+bool ReduceRequest::test()
+{
+    if (!complete_)
+    {
+        complete_ = test_();
+    }
+    return complete_;
+}
+
+void ReduceRequest::wait()
+{
+    if (!complete_)
+    {
+        wait_();
+        complete_ = true;
+    }
+}
+
 void ResourcesHandle::stop()
 {
-    assert(session_);
+    if (stop_ && *stop_)
+    {
+        (*stop_)();
+        return;
+    }
+    if (!session_)
+    {
+        throw gmxapi::ProtocolError("ResourcesHandle::stop() requires a Session. Call Resources::setSession() first.");
+    }
     auto signaller = gmxapi::getMdrunnerSignal(session_,
                                                gmxapi::md::signals::STOP);
 
@@ -56,11 +95,9 @@ ResourcesHandle Resources::getHandle() const
         throw gmxapi::ProtocolError("reduce operation functor is not set, which should not happen...");
     }
     handle.reduce_ = &reduce_;
-
-    if (!session_)
-    {
-        throw gmxapi::ProtocolError("Resources::getHandle() must not be called before setSession() has been called.");
-    }
+    handle.ireduce_ = &ireduce_;
+    handle.stop_ = &stop_;
+    // May be null outside of a Session, in which case stop() is not available.
     handle.session_ = session_;
 
     return handle;
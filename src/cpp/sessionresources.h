@@ -9,6 +9,7 @@
 #ifndef RESTRAINT_SESSIONRESOURCES_H
 #define RESTRAINT_SESSIONRESOURCES_H
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -22,11 +23,18 @@
 #include "gromacs/restraint/restraintpotential.h"
 #include "gromacs/utility/real.h"
 
+#include "alignedarena.h"
+#include "pairevaluator.h"
+
 namespace plugin
 {
 
 // Stop-gap for cross-language data exchange pending SharedData implementation and inclusion of Eigen.
 // Adapted from pybind docs.
+//
+// The elements are either owned by the Matrix or allocated from an AlignedArena. Copies always
+// own their elements, except that assigning to a Matrix of the same size copies the elements into
+// its existing storage.
 template<class T>
 class Matrix
 {
@@ -35,23 +43,95 @@ class Matrix
                size_t cols) :
             rows_(rows),
             cols_(cols),
-            data_(rows_ * cols_,
-                  0)
+            storage_(rows_ * cols_,
+                     0),
+            data_{storage_.data()}
         {
         }
 
         explicit Matrix(std::vector<T>&& captured_data) :
             rows_{1},
             cols_{captured_data.size()},
-            data_{std::move(captured_data)}
+            storage_{std::move(captured_data)},
+            data_{storage_.data()}
         {
         }
 
+        /*!
+         * \brief Allocate a zero-initialized matrix from an arena, which must outlive the matrix.
+         */
+        Matrix(size_t rows,
+               size_t cols,
+               AlignedArena* arena) :
+            rows_(rows),
+            cols_(cols),
+            data_{arena->allocate<T>(rows * cols)}
+        {
+        }
+
+        Matrix(const Matrix& other) :
+            rows_{other.rows_},
+            cols_{other.cols_},
+            storage_(other.data_,
+                     other.data_ + other.size()),
+            data_{storage_.data()}
+        {
+        }
+
+        Matrix(Matrix&& other) noexcept :
+            rows_{other.rows_},
+            cols_{other.cols_},
+            storage_{std::move(other.storage_)},
+            data_{other.data_}
+        {
+            other.rows_ = 0;
+            other.cols_ = 0;
+            other.data_ = nullptr;
+        }
+
+        Matrix& operator=(const Matrix& other)
+        {
+            if (this != &other)
+            {
+                if (size() == other.size())
+                {
+                    std::copy(other.data_,
+                              other.data_ + other.size(),
+                              data_);
+                }
+                else
+                {
+                    storage_.assign(other.data_,
+                                    other.data_ + other.size());
+                    data_ = storage_.data();
+                }
+                rows_ = other.rows_;
+                cols_ = other.cols_;
+            }
+            return *this;
+        }
+
+        Matrix& operator=(Matrix&& other) noexcept
+        {
+            rows_ = other.rows_;
+            cols_ = other.cols_;
+            storage_ = std::move(other.storage_);
+            data_ = other.data_;
+            other.rows_ = 0;
+            other.cols_ = 0;
+            other.data_ = nullptr;
+            return *this;
+        }
+
+        /// Owned storage. Empty if the elements are allocated from an arena.
         std::vector<T>* vector()
-        { return &data_; }
+        { return &storage_; }
 
         T* data()
-        { return data_.data(); };
+        { return data_; };
+
+        const T* data() const
+        { return data_; };
 
         size_t rows() const
         { return rows_; }
@@ -60,15 +140,63 @@ class Matrix
         { return cols_; }
 
     private:
+        size_t size() const
+        { return rows_ * cols_; }
+
         size_t rows_;
         size_t cols_;
-        std::vector<T> data_;
+        std::vector<T> storage_;
+        /// First element, in storage_ or in an arena.
+        T* data_;
 };
 
 // Defer implicit instantiation to ensemblepotential.cpp
 extern template
 class Matrix<double>;
 
+/*!
+ * \brief Handle to an ensemble reduction that may still be in progress.
+ *
+ * Returned by ResourcesHandle::ireduce(). The receive Matrix must not be accessed, and the send
+ * and receive Matrices must stay alive, until test() has returned true or wait() has returned.
+ * A default-constructed request is complete.
+ */
+class ReduceRequest
+{
+    public:
+        ReduceRequest() = default;
+
+        /*!
+         * \brief Wrap an operation in progress.
+         *
+         * \param test function object returning true if the operation has completed.
+         * \param wait function object blocking until the operation has completed.
+         */
+        ReduceRequest(std::function<bool()> test,
+                      std::function<void()> wait) :
+            test_{std::move(test)},
+            wait_{std::move(wait)},
+            complete_{false}
+        {}
+
+        /*!
+         * \brief Check for completion without blocking.
+         *
+         * \return true if the reduction has completed.
+         */
+        bool test();
+
+        /*!
+         * \brief Block until the reduction has completed.
+         */
+        void wait();
+
+    private:
+        std::function<bool()> test_;
+        std::function<void()> wait_;
+        bool complete_{true};
+};
+
 /*!
  * \brief An active handle to ensemble resources provided by the Context.
  *
@@ -117,11 +245,29 @@ class ResourcesHandle
         void reduce(const Matrix<double>& send,
                     Matrix<double>* receive) const;
 
+        /*!
+         * \brief Start an ensemble reduce without waiting for it to complete.
+         *
+         * If the Context did not provide a non-blocking reduce, the reduction is performed with
+         * reduce() and the returned request is already complete.
+         *
+         * \param send Matrices to be summed across the ensemble using Context resources.
+         * \param receive destination of reduced data.
+         * \return request to complete before using receive.
+         */
+        ReduceRequest ireduce(const Matrix<double>& send,
+                              Matrix<double>* receive) const;
+
         /*!
          * \brief Issue a stop condition event.
          *
          * Can be called on any or all ranks. Sets a condition that will cause the current simulation to shut down
          * after the current step.
+         *
+         * If the Resources provide a stop function (see Resources::setStop()), it is called instead of
+         * signalling the Session.
+         *
+         * \throws gmxapi::ProtocolError if the resources are not bound to a Session and provide no stop function.
          */
         void stop();
 
@@ -129,7 +275,14 @@ class ResourcesHandle
         const std::function<void(const Matrix<double>&,
                                  Matrix<double>*)>* reduce_;
 
-        gmxapi::SessionResources* session_;
+        // Optional. May be null.
+        const std::function<ReduceRequest(const Matrix<double>&,
+                                          Matrix<double>*)>* ireduce_{nullptr};
+
+        // Optional. May be null.
+        const std::function<void()>* stop_{nullptr};
+
+        gmxapi::SessionResources* session_{nullptr};
 };
 
 /*!
@@ -150,7 +303,7 @@ class Resources
          * This constructor is called by the framework during Session launch to provide the plugin
          * potential with external resources.
          *
-         * \note If getHandle() is going to be used, setSession() must be called first.
+         * \note If the handle is going to be used to stop the simulation, setSession() must be called first.
          *
          * \param reduce ownership of a function object providing ensemble averaging of a 2D matrix.
          */
@@ -160,6 +313,21 @@ class Resources
             session_(nullptr)
         {};
 
+        /*!
+         * \brief Create a new resources object with a non-blocking reduce.
+         *
+         * \param reduce ownership of a function object providing ensemble averaging of a 2D matrix.
+         * \param ireduce ownership of a function object starting the same averaging without blocking.
+         */
+        Resources(std::function<void(const Matrix<double>&,
+                                     Matrix<double>*)>&& reduce,
+                  std::function<ReduceRequest(const Matrix<double>&,
+                                              Matrix<double>*)>&& ireduce) :
+            reduce_(reduce),
+            ireduce_(ireduce),
+            session_(nullptr)
+        {};
+
         /*!
          * \brief Grant the caller an active handle for the currently executing block of code.
          *
@@ -167,9 +335,9 @@ class Resources
          * calculate() and callback() functions get a handle to the resources for the current time step
          * by calling getHandle().
          *
-         * \note setSession() must be called before this function can be used.
-         * This clumsy protocol requires other infrastructure before it can be
-         * cleaned up for gmxapi 0.1
+         * \note Without a prior call to setSession(), the handle provides the ensemble reduction
+         * but not stop(), which allows restraints to be driven outside of a Session (e.g. for
+         * testing or replaying recorded trajectories).
          *
          * \return resource handle
          *
@@ -185,11 +353,31 @@ class Resources
          */
         void setSession(gmxapi::SessionResources* session);
 
+        /*!
+         * \brief Provide a function to call in place of the Session stop signal.
+         *
+         * Allows restraints to be run outside of a Session with a stand-in for the simulation
+         * (see ThreadEnsemble).
+         *
+         * \param stop function object called by ResourcesHandle::stop().
+         */
+        void setStop(std::function<void()>&& stop)
+        {
+            stop_ = std::move(stop);
+        }
+
     private:
         //! bound function object to provide ensemble reduce facility.
         std::function<void(const Matrix<double>&,
                            Matrix<double>*)> reduce_;
 
+        //! optional function object starting an ensemble reduce without blocking.
+        std::function<ReduceRequest(const Matrix<double>&,
+                                    Matrix<double>*)> ireduce_;
+
+        //! optional function object replacing the Session stop signal.
+        std::function<void()> stop_;
+
         // Raw pointer to the session in which these resources live.
         gmxapi::SessionResources* session_;
 };
@@ -274,6 +462,19 @@ class RestraintModule : public gmxapi::MDModule // consider names
             return restraint_;
         }
 
+        /*!
+         * \brief Get a function pointer evaluating the restraint instance without virtual dispatch.
+         *
+         * Creates the restraint instance if it does not already exist (see getRestraint()).
+         *
+         * \return evaluator equivalent to the evaluate() of the restraint, valid while the restraint exists.
+         */
+        PairEvaluator pairEvaluator()
+        {
+            getRestraint();
+            return makePairEvaluator(restraint_.get());
+        }
+
     private:
         std::vector<int> sites_;
         param_t params_;
@@ -0,0 +1,171 @@
+#ifndef RESTRAINT_SNAPSHOTBUFFER_H
+#define RESTRAINT_SNAPSHOTBUFFER_H
+
+/*! \file
+ * \brief Double buffer for publishing immutable snapshots to concurrent readers.
+ *
+ * Restraint potentials are updated by callback() on one thread while GROMACS may call calculate()
+ * from several threads. The state read by calculate() is published through a SnapshotBuffer, so
+ * that readers never see a partially updated state and never take a lock.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <atomic>
+#include <thread>
+
+namespace plugin
+{
+
+/*!
+ * \brief Two copies of a value, one published for readers and one being prepared by a single writer.
+ *
+ * Readers take a Snapshot of the published copy, which remains valid and unchanged until the
+ * Snapshot is destroyed. The writer fills the unpublished copy returned by back() and swaps the
+ * copies with publish().
+ *
+ * Reads are lock-free but not wait-free. A reader retries if a publication happens between reading
+ * the index of the published copy and registering itself as a reader of that copy, and retries again
+ * for every further publication in that interval, so its number of retries is not bounded. Retries
+ * are rare in practice because the writer publishes at most once per window update. Only back() can
+ * wait, for readers still holding a Snapshot of the copy published before the last publish(), each of
+ * which is held for the duration of a single force evaluation.
+ *
+ * Example:
+ *
+ *     // Writer
+ *     auto& next = buffer.back();
+ *     next = computeNewState();
+ *     buffer.publish();
+ *
+ *     // Readers, on any thread
+ *     const auto state = buffer.read();
+ *     use(*state);
+ *
+ * \tparam T type of the published value. Both copies are default constructed.
+ */
+template<class T>
+class SnapshotBuffer
+{
+    public:
+        /*!
+         * \brief Reference to a published copy that cannot be overwritten while it exists.
+         */
+        class Snapshot
+        {
+            public:
+                Snapshot(const Snapshot&) = delete;
+                Snapshot& operator=(const Snapshot&) = delete;
+
+                Snapshot(Snapshot&& other) noexcept :
+                    slot_{other.slot_}
+                {
+                    other.slot_ = nullptr;
+                }
+
+                ~Snapshot()
+                {
+                    if (slot_)
+                    {
+                        slot_->readers.fetch_sub(1,
+                                                 std::memory_order_release);
+                    }
+                }
+
+                const T& operator*() const
+                {
+                    return slot_->value;
+                }
+
+                const T* operator->() const
+                {
+                    return &slot_->value;
+                }
+
+            private:
+                friend class SnapshotBuffer;
+
+                explicit Snapshot(const typename SnapshotBuffer::Slot* slot) :
+                    slot_{slot}
+                {}
+
+                const typename SnapshotBuffer::Slot* slot_;
+        };
+
+        SnapshotBuffer() = default;
+        SnapshotBuffer(const SnapshotBuffer&) = delete;
+        SnapshotBuffer& operator=(const SnapshotBuffer&) = delete;
+
+        /*!
+         * \brief Get the published copy.
+         *
+         * Safe to call from any number of threads concurrently with the writer. Lock-free: the loop
+         * only repeats when the writer publishes during the call.
+         */
+        Snapshot read() const
+        {
+            while (true)
+            {
+                const unsigned int index = current_.load();
+                const Slot& slot = slots_[index];
+                slot.readers.fetch_add(1);
+                // The copy cannot be handed to the writer once it is registered as read, so it is
+                // safe to use if it is still the published copy.
+                if (current_.load() == index)
+                {
+                    return Snapshot(&slot);
+                }
+                slot.readers.fetch_sub(1);
+            }
+        }
+
+        /*!
+         * \brief Get the unpublished copy, to be overwritten by the writer.
+         *
+         * Waits until no reader holds a Snapshot of the copy. The copy holds the value published
+         * before the last publish(), not the currently published value. Must only be called by the
+         * single writer.
+         */
+        T& back()
+        {
+            Slot& slot = slots_[1 - current_.load()];
+            while (slot.readers.load() != 0)
+            {
+                std::this_thread::yield();
+            }
+            return slot.value;
+        }
+
+        /*!
+         * \brief Publish the copy returned by back().
+         *
+         * Must only be called by the single writer.
+         */
+        void publish()
+        {
+            current_.store(1 - current_.load());
+        }
+
+    private:
+        /*!
+         * \brief A copy and its reader count.
+         *
+         * The count is written by every reader, so it is padded to keep it off the cache line of
+         * the value (and of the other count). Padding is used instead of alignas because C++14
+         * allocation does not honor extended alignment.
+         */
+        struct Slot
+        {
+            mutable std::atomic<unsigned int> readers{0};
+            char padding[64 - sizeof(std::atomic<unsigned int>)];
+            T value{};
+        };
+
+        Slot slots_[2];
+        /// Index of the published copy.
+        std::atomic<unsigned int> current_{0};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_SNAPSHOTBUFFER_H
@@ -0,0 +1,215 @@
+#ifndef RESTRAINT_STEPCACHE_H
+#define RESTRAINT_STEPCACHE_H
+
+/*! \file
+ * \brief Cache of the pair distance and force of the current step of a restraint.
+ *
+ * GROMACS calls IRestraintPotential::update() and then evaluate() with the same positions and
+ * time, and may call evaluate() more than once per step in parallel runs. The StepCache defined
+ * here lets the restraint compute the pair distance and force once per step.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+#include "gromacs/restraint/restraintpotential.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Lock-free single-entry cache keyed on the time and positions of a pair.
+ *
+ * An entry holds the pair distance R and, once it has been evaluated, the force and energy. The
+ * entry is stored in atomic words guarded by a sequence counter (a seqlock), so any number of
+ * threads can look up and store entries without waiting: a lookup that overlaps a store misses,
+ * and a store that overlaps another store is dropped.
+ *
+ * A result is tagged with the generation of the bias it was computed with, and a lookup only returns
+ * the result if the generation matches its own. The owner increments the generation when the bias
+ * changes, so results computed before the change are never returned afterwards, even if they are
+ * stored after the change or a store is dropped. To avoid tagging a result computed with a newer
+ * bias as older (which would only cost a miss) or the reverse, the caller must read the generation
+ * before reading the bias.
+ *
+ * Example:
+ *
+ *     StepCache::Entry entry;
+ *     if (cache.find(v, v0, t, generation, &entry) && entry.hasResult)
+ *     {
+ *         return entry.result;
+ *     }
+ */
+class StepCache
+{
+    public:
+        /*!
+         * \brief Cached data for a pair at a time.
+         */
+        struct Entry
+        {
+            /// Pair separation distance.
+            double R{0};
+            /// Whether result holds the force and energy.
+            bool hasResult{false};
+            /// Generation of the bias with which result was computed.
+            uint64_t generation{0};
+            gmx::PotentialPointData result;
+        };
+
+        StepCache()
+        {
+            for (auto& word : words_)
+            {
+                word.store(std::numeric_limits<double>::quiet_NaN(),
+                           std::memory_order_relaxed);
+            }
+        }
+
+        StepCache(const StepCache&) = delete;
+        StepCache& operator=(const StepCache&) = delete;
+
+        /*!
+         * \brief Look up the entry for positions v and v0 at time t.
+         *
+         * Counts a lookup, and a hit if the entry has a result for the generation.
+         *
+         * \param generation current generation of the bias.
+         * \param entry destination for the cached entry. entry->hasResult is false unless the
+         * result was computed with this generation.
+         * \return true if the key matches the cached entry.
+         */
+        bool find(const gmx::Vector& v,
+                  const gmx::Vector& v0,
+                  double t,
+                  uint64_t generation,
+                  Entry* entry) const
+        {
+            lookups_.fetch_add(1,
+                               std::memory_order_relaxed);
+            const uint64_t sequence = sequence_.load(std::memory_order_acquire);
+            if (sequence & 1)
+            {
+                return false;
+            }
+            double words[numWords];
+            for (size_t i = 0;i < numWords;++i)
+            {
+                words[i] = words_[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence_.load(std::memory_order_relaxed) != sequence)
+            {
+                return false;
+            }
+            if (words[timeWord] != t || !matches(words + vWord, v) || !matches(words + v0Word, v0))
+            {
+                return false;
+            }
+            entry->R = words[distanceWord];
+            entry->generation = generation;
+            entry->hasResult = words[hasResultWord] != 0 && words[generationWord] == static_cast<double>(generation);
+            for (int d = 0;d < 3;++d)
+            {
+                entry->result.force[d] = static_cast<real>(words[forceWord + d]);
+            }
+            entry->result.energy = static_cast<real>(words[energyWord]);
+            if (entry->hasResult)
+            {
+                hits_.fetch_add(1,
+                                std::memory_order_relaxed);
+            }
+            return true;
+        }
+
+        /*!
+         * \brief Replace the cached entry.
+         *
+         * Dropped if another thread is storing an entry at the same time.
+         */
+        void store(const gmx::Vector& v,
+                   const gmx::Vector& v0,
+                   double t,
+                   const Entry& entry)
+        {
+            uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+            if ((sequence & 1) || !sequence_.compare_exchange_strong(sequence,
+                                                                     sequence + 1,
+                                                                     std::memory_order_acquire))
+            {
+                return;
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            words_[timeWord].store(t, std::memory_order_relaxed);
+            for (int d = 0;d < 3;++d)
+            {
+                words_[vWord + d].store(v[d], std::memory_order_relaxed);
+                words_[v0Word + d].store(v0[d], std::memory_order_relaxed);
+                words_[forceWord + d].store(entry.result.force[d], std::memory_order_relaxed);
+            }
+            words_[distanceWord].store(entry.R, std::memory_order_relaxed);
+            words_[hasResultWord].store(entry.hasResult ? 1 : 0, std::memory_order_relaxed);
+            words_[generationWord].store(static_cast<double>(entry.generation), std::memory_order_relaxed);
+            words_[energyWord].store(entry.result.energy, std::memory_order_relaxed);
+            sequence_.store(sequence + 2,
+                            std::memory_order_release);
+        }
+
+        /*!
+         * \brief Discard the cached entry.
+         *
+         * Must not be called concurrently with store().
+         */
+        void invalidate()
+        {
+            // No time compares equal to NaN.
+            store(gmx::Vector(),
+                  gmx::Vector(),
+                  std::numeric_limits<double>::quiet_NaN(),
+                  Entry());
+        }
+
+        /// Number of calls to find().
+        uint64_t lookups() const
+        {
+            return lookups_.load(std::memory_order_relaxed);
+        }
+
+        /// Number of calls to find() that returned a result.
+        uint64_t hits() const
+        {
+            return hits_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static bool matches(const double* words,
+                            const gmx::Vector& v)
+        {
+            return words[0] == v[0] && words[1] == v[1] && words[2] == v[2];
+        }
+
+        // Layout of words_.
+        static constexpr size_t timeWord = 0;
+        static constexpr size_t vWord = 1;
+        static constexpr size_t v0Word = 4;
+        static constexpr size_t distanceWord = 7;
+        static constexpr size_t hasResultWord = 8;
+        static constexpr size_t forceWord = 9;
+        static constexpr size_t energyWord = 12;
+        // Exact up to 2^53 generations.
+        static constexpr size_t generationWord = 13;
+        static constexpr size_t numWords = 14;
+
+        /// Odd while an entry is being stored.
+        std::atomic<uint64_t> sequence_{0};
+        std::atomic<double> words_[numWords];
+        mutable std::atomic<uint64_t> lookups_{0};
+        mutable std::atomic<uint64_t> hits_{0};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_STEPCACHE_H
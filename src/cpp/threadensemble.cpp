@@ -0,0 +1,160 @@
+/*! \file
+ * \brief Code to implement the ensemble emulation declared in threadensemble.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "threadensemble.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+ThreadEnsemble::ThreadEnsemble(size_t numMembers)
+{
+    if (numMembers == 0)
+    {
+        throw gmxapi::ProtocolError("A ThreadEnsemble needs at least one member.");
+    }
+    for (size_t member = 0;member < numMembers;++member)
+    {
+        auto resources = std::make_shared<Resources>(
+            [this](const Matrix<double>& send, Matrix<double>* receive)
+            {
+                reduce(send,
+                       receive);
+            });
+        resources->setStop([this]() { stopRequested_ = true; });
+        resources_.push_back(std::move(resources));
+    }
+}
+
+void ThreadEnsemble::run(const std::function<void(size_t,
+                                                  const Resources&)>& body)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        arrived_ = 0;
+        finished_ = 0;
+        aborted_ = false;
+        error_ = nullptr;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t member = 0;member < size();++member)
+    {
+        threads.emplace_back([this, &body, member]()
+                             {
+                                 try
+                                 {
+                                     body(member,
+                                          *resources_[member]);
+                                 }
+                                 catch (...)
+                                 {
+                                     std::lock_guard<std::mutex> lock(mutex_);
+                                     if (!error_)
+                                     {
+                                         error_ = std::current_exception();
+                                     }
+                                     aborted_ = true;
+                                 }
+                                 std::lock_guard<std::mutex> lock(mutex_);
+                                 ++finished_;
+                                 released_.notify_all();
+                             });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (error_)
+    {
+        std::rethrow_exception(error_);
+    }
+}
+
+ThreadEnsembleStatistics ThreadEnsemble::statistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+}
+
+void ThreadEnsemble::reduce(const Matrix<double>& send,
+                            Matrix<double>* receive)
+{
+    const auto arrival = clock::now();
+    const size_t numValues = send.rows() * send.cols();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (aborted_)
+    {
+        throw gmxapi::ProtocolError("ThreadEnsemble reduction abandoned after a member failed.");
+    }
+    if (arrived_ == 0)
+    {
+        sum_.assign(send.data(),
+                    send.data() + numValues);
+        firstArrival_ = arrival;
+    }
+    else if (numValues != sum_.size())
+    {
+        aborted_ = true;
+        released_.notify_all();
+        throw gmxapi::ProtocolError("ThreadEnsemble members reduced matrices of different sizes.");
+    }
+    else
+    {
+        for (size_t i = 0;i < numValues;++i)
+        {
+            sum_[i] += send.data()[i];
+        }
+    }
+
+    // The result of a reduction is not overwritten until every member has arrived at the next one,
+    // by which time all members have copied it.
+    const auto generation = generation_;
+    if (++arrived_ == size())
+    {
+        result_.resize(numValues);
+        for (size_t i = 0;i < numValues;++i)
+        {
+            result_[i] = sum_[i] / size();
+        }
+        arrived_ = 0;
+        ++generation_;
+
+        const double skew = std::chrono::duration<double>(arrival - firstArrival_).count();
+        ++statistics_.reductions;
+        statistics_.skewSeconds += skew;
+        statistics_.maxSkewSeconds = std::max(statistics_.maxSkewSeconds,
+                                              skew);
+        released_.notify_all();
+    }
+    else
+    {
+        released_.wait(lock,
+                       [this, generation]()
+                       {
+                           return generation_ != generation || aborted_ || finished_ > 0;
+                       });
+        if (generation_ == generation)
+        {
+            aborted_ = true;
+            released_.notify_all();
+            throw gmxapi::ProtocolError("ThreadEnsemble reduction abandoned because a member did not take part.");
+        }
+    }
+
+    std::copy(result_.begin(),
+              result_.end(),
+              receive->data());
+    statistics_.waitSeconds += std::chrono::duration<double>(clock::now() - arrival).count();
+}
+
+} // end namespace plugin
@@ -0,0 +1,154 @@
+#ifndef RESTRAINT_THREADENSEMBLE_H
+#define RESTRAINT_THREADENSEMBLE_H
+
+/*! \file
+ * \brief In-process emulation of an ensemble of simulations with one thread per member.
+ *
+ * Restraints normally get their ensemble reduction from the Context of a running Session. The
+ * ThreadEnsemble provides the same Resources interface to restraints driven by threads of a single
+ * process, so that ensemble behavior can be tested, and the cost of the reduction measured, without
+ * GROMACS or MPI.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Timing of the reductions in a ThreadEnsemble.
+ */
+struct ThreadEnsembleStatistics
+{
+    /// Number of completed reductions.
+    unsigned long reductions{0};
+    /// Time spent by all members in the reduction, including waiting for the other members.
+    double waitSeconds{0};
+    /// Sum over reductions of the time between the first and last member arriving.
+    double skewSeconds{0};
+    /// Largest time between the first and last member arriving at a reduction.
+    double maxSkewSeconds{0};
+};
+
+/*!
+ * \brief Run the members of an emulated ensemble on separate threads.
+ *
+ * Each member gets its own Resources, whose reduce function averages a Matrix across all members.
+ * The reduction is a barrier: every member blocks until all members have contributed, like the
+ * ensemble reduction of a real Context. ResourcesHandle::stop() sets a flag that can be checked
+ * with stopRequested() in place of stopping a simulation.
+ *
+ * If a member throws, or returns while the others are waiting in a reduction, the waiting members
+ * throw gmxapi::ProtocolError instead of blocking forever, and run() rethrows the first exception.
+ *
+ * Example:
+ *
+ *     plugin::ThreadEnsemble ensemble{4};
+ *     ensemble.run([&](size_t member, const plugin::Resources& resources)
+ *                  {
+ *                      plugin::EnsemblePotential restraint{params};
+ *                      for (...)
+ *                      {
+ *                          restraint.callback(v, v0, t, resources);
+ *                      }
+ *                  });
+ */
+class ThreadEnsemble
+{
+    public:
+        /*!
+         * \brief Set up an ensemble.
+         *
+         * \param numMembers number of members (threads).
+         */
+        explicit ThreadEnsemble(size_t numMembers);
+
+        ThreadEnsemble(const ThreadEnsemble&) = delete;
+        ThreadEnsemble& operator=(const ThreadEnsemble&) = delete;
+
+        /*!
+         * \brief Number of members.
+         */
+        size_t size() const
+        {
+            return resources_.size();
+        }
+
+        /*!
+         * \brief Resources of a member.
+         *
+         * \param member member index.
+         */
+        std::shared_ptr<Resources> resources(size_t member) const
+        {
+            return resources_.at(member);
+        }
+
+        /*!
+         * \brief Run a function for every member, each on its own thread, and wait for them to finish.
+         *
+         * \param body function called with the member index and the resources of the member.
+         * \throws the first exception thrown by a member.
+         */
+        void run(const std::function<void(size_t,
+                                          const Resources&)>& body);
+
+        /*!
+         * \brief Whether any member has called ResourcesHandle::stop().
+         */
+        bool stopRequested() const
+        {
+            return stopRequested_;
+        }
+
+        /*!
+         * \brief Timing of the reductions performed so far.
+         */
+        ThreadEnsembleStatistics statistics() const;
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        /*!
+         * \brief Barrier reduction called by every member.
+         */
+        void reduce(const Matrix<double>& send,
+                    Matrix<double>* receive);
+
+        std::vector<std::shared_ptr<Resources>> resources_;
+        std::atomic<bool> stopRequested_{false};
+
+        mutable std::mutex mutex_;
+        std::condition_variable released_;
+        /// Number of members that have contributed to the current reduction.
+        size_t arrived_{0};
+        /// Number of completed reductions, used to release the waiting members.
+        unsigned long generation_{0};
+        /// Sum of the contributions to the current reduction.
+        std::vector<double> sum_;
+        /// Mean of the last completed reduction.
+        std::vector<double> result_;
+        clock::time_point firstArrival_;
+
+        /// Number of members that have returned from run().
+        size_t finished_{0};
+        bool aborted_{false};
+        std::exception_ptr error_;
+
+        ThreadEnsembleStatistics statistics_;
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_THREADENSEMBLE_H
@@ -0,0 +1,139 @@
+/*! \file
+ * \brief Definitions for the window history declared in windowhistory.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "windowhistory.h"
+
+#include <cassert>
+
+#include <algorithm>
+
+namespace plugin
+{
+
+WindowHistory::WindowHistory(size_t capacity,
+                             size_t numBins,
+                             size_t resyncPeriod,
+                             AlignedArena* arena) :
+    capacity_{capacity},
+    numBins_{numBins},
+    resyncPeriod_{resyncPeriod > 0 ? resyncPeriod : capacity}
+{
+    if (arena)
+    {
+        windows_ = arena->allocate<double>(capacity * numBins);
+        sum_ = arena->allocate<double>(numBins);
+    }
+    else
+    {
+        ownedStorage_.resize((capacity + 1) * numBins);
+        windows_ = ownedStorage_.data();
+        sum_ = windows_ + capacity * numBins;
+    }
+}
+
+void WindowHistory::push(const double* window)
+{
+    if (capacity_ == 0)
+    {
+        return;
+    }
+
+    // The slot after the newest window is either empty or holds the oldest window.
+    const size_t slot = (oldest_ + size_) % capacity_;
+    double* const storage = windows_ + slot * numBins_;
+    if (size_ == capacity_)
+    {
+        for (size_t i = 0;i < numBins_;++i)
+        {
+            sum_[i] += window[i] - storage[i];
+        }
+        oldest_ = (oldest_ + 1) % capacity_;
+    }
+    else
+    {
+        for (size_t i = 0;i < numBins_;++i)
+        {
+            sum_[i] += window[i];
+        }
+        ++size_;
+    }
+    std::copy(window, window + numBins_, storage);
+
+    if (++updatesSinceResync_ >= resyncPeriod_)
+    {
+        resync();
+    }
+}
+
+const double* WindowHistory::window(size_t age) const
+{
+    assert(age < size_);
+    return windows_ + ((oldest_ + age) % capacity_) * numBins_;
+}
+
+void WindowHistory::restore(size_t size,
+                            const double* windows,
+                            const double* sum,
+                            size_t updatesSinceResync)
+{
+    assert(size <= capacity_);
+    std::copy(windows, windows + size * numBins_, windows_);
+    std::copy(sum, sum + numBins_, sum_);
+    oldest_ = 0;
+    size_ = size;
+    updatesSinceResync_ = updatesSinceResync;
+}
+
+void WindowHistory::resync()
+{
+    std::fill(sum_, sum_ + numBins_, 0.);
+    for (size_t age = 0;age < size_;++age)
+    {
+        const double* const stored = window(age);
+        for (size_t i = 0;i < numBins_;++i)
+        {
+            sum_[i] += stored[i];
+        }
+    }
+    updatesSinceResync_ = 0;
+}
+
+ExponentialAverage::ExponentialAverage(size_t equivalentWindows,
+                                       size_t numBins,
+                                       AlignedArena* arena) :
+    numBins_{numBins},
+    weight_{2.0 / (std::max<size_t>(equivalentWindows, 1) + 1)}
+{
+    if (arena)
+    {
+        mean_ = arena->allocate<double>(numBins);
+    }
+    else
+    {
+        ownedStorage_.resize(numBins);
+        mean_ = ownedStorage_.data();
+    }
+}
+
+void ExponentialAverage::push(const double* window)
+{
+    ++updates_;
+    const double weight = std::max(weight_,
+                                   1.0 / updates_);
+    for (size_t i = 0;i < numBins_;++i)
+    {
+        mean_[i] += weight * (window[i] - mean_[i]);
+    }
+}
+
+void ExponentialAverage::restore(unsigned long long updates,
+                                 const double* mean)
+{
+    updates_ = updates;
+    std::copy(mean, mean + numBins_, mean_);
+}
+
+} // end namespace plugin
@@ -0,0 +1,252 @@
+#ifndef RESTRAINT_WINDOWHISTORY_H
+#define RESTRAINT_WINDOWHISTORY_H
+
+/*! \file
+ * \brief Fixed-capacity history of histogram windows with a running sum, and an exponential
+ * average of windows for restraints that cannot afford to store the history.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cstddef>
+
+#include <vector>
+
+#include "alignedarena.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Ring buffer of the most recent histogram windows.
+ *
+ * All storage is allocated at construction. Adding a window overwrites the oldest window
+ * once the buffer is full, and the element-wise sum of the stored windows is updated
+ * incrementally by subtracting the evicted window and adding the new one, so an update
+ * costs O(numBins) regardless of the number of windows.
+ *
+ * Incremental updates accumulate rounding error, so the sum is recomputed exactly from
+ * the stored windows every resyncPeriod updates. With the default period of one full
+ * cycle of the buffer, the recomputation adds O(numBins) amortized work per update.
+ *
+ * The storage can be allocated from an AlignedArena owned by the restraint, which then holds
+ * the windows, the sum, and the restraint's other window buffers in one aligned block.
+ */
+class WindowHistory
+{
+    public:
+        /*!
+         * \brief Allocate storage for the window history.
+         *
+         * \param capacity maximum number of windows to keep.
+         * \param numBins size of each window.
+         * \param resyncPeriod number of updates between exact recomputations of the sum, or zero
+         * to use the capacity.
+         * \param arena arena from which to allocate arenaBytes(capacity, numBins) bytes, or nullptr
+         * for storage owned by the history.
+         */
+        WindowHistory(size_t capacity,
+                      size_t numBins,
+                      size_t resyncPeriod = 0,
+                      AlignedArena* arena = nullptr);
+
+        WindowHistory(const WindowHistory&) = delete;
+        WindowHistory& operator=(const WindowHistory&) = delete;
+
+        /*!
+         * \brief Space needed in an AlignedArena for a history.
+         */
+        static constexpr size_t arenaBytes(size_t capacity,
+                                           size_t numBins)
+        {
+            return AlignedArena::bytesFor<double>(capacity * numBins) + AlignedArena::bytesFor<double>(numBins);
+        }
+
+        /*!
+         * \brief Add a window, evicting the oldest window if the history is full.
+         *
+         * \param window numBins values to copy into the history.
+         */
+        void push(const double* window);
+
+        /*!
+         * \brief Number of windows currently stored.
+         */
+        size_t size() const
+        {
+            return size_;
+        }
+
+        /*!
+         * \brief Maximum number of windows stored.
+         */
+        size_t capacity() const
+        {
+            return capacity_;
+        }
+
+        /*!
+         * \brief Number of bins per window.
+         */
+        size_t numBins() const
+        {
+            return numBins_;
+        }
+
+        /*!
+         * \brief Element-wise sum of the stored windows.
+         *
+         * \return numBins values.
+         */
+        const double* sum() const
+        {
+            return sum_;
+        }
+
+        /*!
+         * \brief Access a stored window.
+         *
+         * \param age index of the window, from 0 for the oldest to size() - 1 for the newest.
+         * \return pointer to numBins values.
+         */
+        const double* window(size_t age) const;
+
+        /*!
+         * \brief Number of updates since the sum was last recomputed.
+         */
+        size_t updatesSinceResync() const
+        {
+            return updatesSinceResync_;
+        }
+
+        /*!
+         * \brief Replace the contents of the history, e.g. from a checkpoint.
+         *
+         * The sum is restored rather than recomputed, so the restored history produces bitwise
+         * identical sums to the saved history.
+         *
+         * \param size number of windows, at most capacity().
+         * \param windows size * numBins() values, from the oldest window to the newest.
+         * \param sum numBins() values of the running sum.
+         * \param updatesSinceResync number of updates since the sum was last recomputed.
+         */
+        void restore(size_t size,
+                     const double* windows,
+                     const double* sum,
+                     size_t updatesSinceResync);
+
+    private:
+        /// Recompute sum_ from the stored windows.
+        void resync();
+
+        size_t capacity_;
+        size_t numBins_;
+        size_t resyncPeriod_;
+
+        /// Storage for windows_ and sum_ if no arena is used.
+        std::vector<double> ownedStorage_;
+        /// Contiguous storage for capacity_ windows of numBins_ values.
+        double* windows_{nullptr};
+        /// Running sum of the stored windows.
+        double* sum_{nullptr};
+        /// Slot of the oldest window.
+        size_t oldest_{0};
+        size_t size_{0};
+        size_t updatesSinceResync_{0};
+};
+
+/*!
+ * \brief Exponentially weighted running average of histogram windows.
+ *
+ * Each update computes mean += w (window - mean) with w = 2 / (equivalentWindows + 1), for which
+ * the mean age of the averaged windows is the same as for a sliding window of equivalentWindows.
+ * Until 1 / w windows have been added, w is 1 / (number of windows added), so the first updates
+ * give the plain mean of the windows so far, as a partially filled WindowHistory does.
+ *
+ * Memory is numBins values regardless of equivalentWindows.
+ */
+class ExponentialAverage
+{
+    public:
+        /*!
+         * \brief Allocate storage for the average.
+         *
+         * \param equivalentWindows size of the sliding window with the same mean age.
+         * \param numBins size of each window.
+         * \param arena arena from which to allocate arenaBytes(numBins) bytes, or nullptr for
+         * storage owned by the average.
+         */
+        ExponentialAverage(size_t equivalentWindows,
+                           size_t numBins,
+                           AlignedArena* arena = nullptr);
+
+        ExponentialAverage(const ExponentialAverage&) = delete;
+        ExponentialAverage& operator=(const ExponentialAverage&) = delete;
+
+        /*!
+         * \brief Space needed in an AlignedArena for an average.
+         */
+        static constexpr size_t arenaBytes(size_t numBins)
+        {
+            return AlignedArena::bytesFor<double>(numBins);
+        }
+
+        /*!
+         * \brief Add a window to the average.
+         *
+         * \param window numBins values.
+         */
+        void push(const double* window);
+
+        /*!
+         * \brief Current average.
+         *
+         * \return numBins values, zero before the first update.
+         */
+        const double* mean() const
+        {
+            return mean_;
+        }
+
+        /*!
+         * \brief Weight of a new window once the average is warmed up.
+         */
+        double weight() const
+        {
+            return weight_;
+        }
+
+        /*!
+         * \brief Number of windows added.
+         */
+        unsigned long long updates() const
+        {
+            return updates_;
+        }
+
+        size_t numBins() const
+        {
+            return numBins_;
+        }
+
+        /*!
+         * \brief Replace the state of the average, e.g. from a checkpoint.
+         *
+         * \param updates number of windows added.
+         * \param mean numBins values.
+         */
+        void restore(unsigned long long updates,
+                     const double* mean);
+
+    private:
+        size_t numBins_;
+        double weight_;
+        unsigned long long updates_{0};
+        /// Storage for mean_ if no arena is used.
+        std::vector<double> ownedStorage_;
+        double* mean_{nullptr};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_WINDOWHISTORY_H
@@ -0,0 +1,345 @@
+/*! \file
+ * \brief Implement the window output declared in windowwriter.h
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include "windowwriter.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+namespace
+{
+
+const char magic[8] = {'E', 'N', 'S', 'W', 'I', 'N', 'D', 'O'};
+constexpr uint32_t formatVersion = 1;
+//! Reads back as a different value if the file was written with a different byte order.
+constexpr uint32_t byteOrderMarker = 0x01020304;
+//! Size of the header written by writeHeader().
+constexpr uint64_t headerSize = sizeof(magic) + 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+bool writeHeader(FILE* fh,
+                 uint64_t numBins,
+                 uint64_t numSamples)
+{
+    return fwrite(magic, sizeof(magic), 1, fh) == 1
+           && fwrite(&formatVersion, sizeof(formatVersion), 1, fh) == 1
+           && fwrite(&byteOrderMarker, sizeof(byteOrderMarker), 1, fh) == 1
+           && fwrite(&numBins, sizeof(numBins), 1, fh) == 1
+           && fwrite(&numSamples, sizeof(numSamples), 1, fh) == 1;
+}
+
+void readHeader(FILE* fh,
+                const std::string& filename,
+                uint64_t* numBins,
+                uint64_t* numSamples)
+{
+    char header[sizeof(magic)];
+    uint32_t version{0};
+    uint32_t marker{0};
+    if (fread(header, sizeof(header), 1, fh) != 1
+        || fread(&version, sizeof(version), 1, fh) != 1
+        || fread(&marker, sizeof(marker), 1, fh) != 1
+        || fread(numBins, sizeof(*numBins), 1, fh) != 1
+        || fread(numSamples, sizeof(*numSamples), 1, fh) != 1)
+    {
+        throw gmxapi::ProtocolError("Could not read the header of " + filename + ".");
+    }
+    if (memcmp(header, magic, sizeof(magic)) != 0 || version != formatVersion || marker != byteOrderMarker)
+    {
+        throw gmxapi::ProtocolError(filename + " is not a supported window output file.");
+    }
+}
+
+uint64_t fileSize(FILE* fh,
+                  const std::string& filename)
+{
+    if (fseek(fh, 0, SEEK_END) != 0)
+    {
+        throw gmxapi::ProtocolError("Could not seek in " + filename + ".");
+    }
+    const long size = ftell(fh);
+    if (size < 0)
+    {
+        throw gmxapi::ProtocolError("Could not seek in " + filename + ".");
+    }
+    return static_cast<uint64_t>(size);
+}
+
+/*!
+ * \brief Check that a file to append to was written with the same parameters.
+ */
+void checkHeader(const std::string& filename,
+                 uint64_t numBins,
+                 uint64_t numSamples)
+{
+    RAIIFile file{filename.c_str(),
+                  "rb"};
+    if (file.fh() == nullptr)
+    {
+        throw gmxapi::ProtocolError("Could not open window output file " + filename + ".");
+    }
+    uint64_t fileBins{0};
+    uint64_t fileSamples{0};
+    readHeader(file.fh(), filename, &fileBins, &fileSamples);
+    if (fileBins != numBins || fileSamples != numSamples)
+    {
+        throw gmxapi::ProtocolError(filename + " was written for a different number of bins or samples.");
+    }
+}
+
+} // end anonymous namespace
+
+WindowWriter::WindowWriter(const std::string& filename,
+                           size_t numBins,
+                           size_t numSamples,
+                           bool append,
+                           size_t queueCapacity) :
+    filename_{filename},
+    numBins_{numBins},
+    numSamples_{numSamples},
+    capacity_{std::max<size_t>(queueCapacity, 1)},
+    data_{filename.c_str(),
+          append ? "ab" : "wb"},
+    index_{(filename + ".index").c_str(),
+           append ? "ab" : "wb"}
+{
+    if (data_.fh() == nullptr || index_.fh() == nullptr)
+    {
+        throw gmxapi::ProtocolError("Could not open window output file " + filename + ".");
+    }
+    const uint64_t dataSize = fileSize(data_.fh(), filename);
+    const uint64_t indexSize = fileSize(index_.fh(), filename + ".index");
+    if (dataSize == 0 && indexSize == 0)
+    {
+        if (!writeHeader(data_.fh(), numBins_, numSamples_) || !writeHeader(index_.fh(), numBins_, numSamples_))
+        {
+            throw gmxapi::ProtocolError("Could not write window output file " + filename + ".");
+        }
+        offset_ = headerSize;
+    }
+    else
+    {
+        checkHeader(filename, numBins_, numSamples_);
+        checkHeader(filename + ".index", numBins_, numSamples_);
+        if ((indexSize - headerSize) % (2 * sizeof(uint64_t)) != 0)
+        {
+            throw gmxapi::ProtocolError("Window output index " + filename + ".index is corrupt.");
+        }
+        offset_ = dataSize;
+    }
+
+    thread_ = std::thread([this]() { run(); });
+}
+
+WindowWriter::~WindowWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    recordsAvailable_.notify_one();
+    thread_.join();
+    data_.close();
+    index_.close();
+}
+
+bool WindowWriter::push(WindowRecord&& record)
+{
+    if (record.samples.size() != numSamples_
+        || record.localHistogram.size() != numBins_
+        || record.reducedHistogram.size() != numBins_
+        || record.difference.size() != numBins_)
+    {
+        throw gmxapi::ProtocolError("Window record does not match the sizes of window output file " + filename_ + ".");
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.size() >= capacity_)
+        {
+            ++dropped_;
+            return false;
+        }
+        queue_.emplace_back(std::move(record));
+    }
+    recordsAvailable_.notify_one();
+    return true;
+}
+
+void WindowWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    queueDrained_.wait(lock, [this]() { return queue_.empty() && !writing_; });
+    if (failed_)
+    {
+        throw gmxapi::ProtocolError("Could not write window output file " + filename_ + ".");
+    }
+}
+
+bool WindowWriter::failed() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+size_t WindowWriter::dropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
+
+size_t WindowWriter::written() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+}
+
+void WindowWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        recordsAvailable_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+        if (queue_.empty())
+        {
+            // Stopping, and every record has been written.
+            break;
+        }
+        WindowRecord record{std::move(queue_.front())};
+        queue_.pop_front();
+        const bool last = queue_.empty();
+        // Only this thread sets failed_.
+        const bool skip = failed_;
+        writing_ = true;
+
+        // Write without holding the lock so the simulation thread can keep queueing.
+        lock.unlock();
+        bool ok{true};
+        if (!skip)
+        {
+            ok = write(record);
+            if (ok && last)
+            {
+                ok = fflush(data_.fh()) == 0 && fflush(index_.fh()) == 0;
+            }
+        }
+        lock.lock();
+
+        writing_ = false;
+        if (!skip)
+        {
+            if (ok)
+            {
+                ++written_;
+            }
+            else
+            {
+                failed_ = true;
+            }
+        }
+        if (queue_.empty())
+        {
+            queueDrained_.notify_all();
+        }
+    }
+}
+
+bool WindowWriter::write(const WindowRecord& record)
+{
+    FILE* const fh = data_.fh();
+    const uint64_t window{record.window};
+    const int64_t step{record.step};
+    // push() checked the sizes.
+    const bool ok = fwrite(&window, sizeof(window), 1, fh) == 1
+                    && fwrite(&step, sizeof(step), 1, fh) == 1
+                    && fwrite(record.samples.data(), sizeof(double), numSamples_, fh) == numSamples_
+                    && fwrite(record.localHistogram.data(), sizeof(double), numBins_, fh) == numBins_
+                    && fwrite(record.reducedHistogram.data(), sizeof(double), numBins_, fh) == numBins_
+                    && fwrite(record.difference.data(), sizeof(double), numBins_, fh) == numBins_
+                    && fwrite(&window, sizeof(window), 1, index_.fh()) == 1
+                    && fwrite(&offset_, sizeof(offset_), 1, index_.fh()) == 1;
+
+    offset_ += sizeof(window) + sizeof(step) + sizeof(double) * (numSamples_ + 3 * numBins_);
+    return ok;
+}
+
+WindowReader::WindowReader(const std::string& filename) :
+    filename_{filename},
+    data_{filename.c_str(),
+          "rb"}
+{
+    RAIIFile index{(filename + ".index").c_str(),
+                   "rb"};
+    if (data_.fh() == nullptr || index.fh() == nullptr)
+    {
+        throw gmxapi::ProtocolError("Could not open window output file " + filename + ".");
+    }
+    uint64_t numBins{0};
+    uint64_t numSamples{0};
+    readHeader(data_.fh(), filename, &numBins, &numSamples);
+    readHeader(index.fh(), filename + ".index", &numBins, &numSamples);
+    numBins_ = numBins;
+    numSamples_ = numSamples;
+
+    std::vector<uint64_t> windows;
+    std::vector<uint64_t> offsets;
+    uint64_t entry[2];
+    while (fread(entry, sizeof(entry), 1, index.fh()) == 1)
+    {
+        windows.push_back(entry[0]);
+        offsets.push_back(entry[1]);
+    }
+
+    // Windows written again after a restart supersede the earlier chunks.
+    std::unordered_set<uint64_t> seen;
+    for (size_t i = windows.size();i-- > 0;)
+    {
+        if (seen.insert(windows[i]).second)
+        {
+            windows_.push_back(windows[i]);
+            offsets_.push_back(offsets[i]);
+        }
+    }
+    std::reverse(windows_.begin(), windows_.end());
+    std::reverse(offsets_.begin(), offsets_.end());
+}
+
+WindowRecord WindowReader::read(uint64_t window)
+{
+    const auto found = std::find(windows_.begin(), windows_.end(), window);
+    if (found == windows_.end())
+    {
+        throw gmxapi::ProtocolError("Window " + std::to_string(window) + " is not in " + filename_ + ".");
+    }
+    const auto offset = offsets_[found - windows_.begin()];
+
+    WindowRecord record;
+    record.samples.resize(numSamples_);
+    record.localHistogram.resize(numBins_);
+    record.reducedHistogram.resize(numBins_);
+    record.difference.resize(numBins_);
+    FILE* const fh = data_.fh();
+    const bool ok = fseek(fh, static_cast<long>(offset), SEEK_SET) == 0
+                    && fread(&record.window, sizeof(record.window), 1, fh) == 1
+                    && fread(&record.step, sizeof(record.step), 1, fh) == 1
+                    && fread(record.samples.data(), sizeof(double), numSamples_, fh) == numSamples_
+                    && fread(record.localHistogram.data(), sizeof(double), numBins_, fh) == numBins_
+                    && fread(record.reducedHistogram.data(), sizeof(double), numBins_, fh) == numBins_
+                    && fread(record.difference.data(), sizeof(double), numBins_, fh) == numBins_;
+    if (!ok)
+    {
+        throw gmxapi::ProtocolError("Could not read window " + std::to_string(window) + " from " + filename_ + ".");
+    }
+    return record;
+}
+
+} // end namespace plugin
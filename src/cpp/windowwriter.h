@@ -0,0 +1,207 @@
+#ifndef RESTRAINT_WINDOWWRITER_H
+#define RESTRAINT_WINDOWWRITER_H
+
+/*! \file
+ * \brief Background output of the per-window data of a restraint.
+ *
+ * The data file starts with a header of the 8 character magic string "ENSWINDO", a 32-bit format
+ * version, a 32-bit byte order marker, and the 64-bit number of bins and number of samples per
+ * window. It is followed by one chunk per window, each containing
+ *
+ *  - the 64-bit window number and the 64-bit step at which the window ended,
+ *  - the distance samples of the window,
+ *  - the blurred histogram of the samples in this simulation,
+ *  - the ensemble average of the blurred histograms, and
+ *  - the histogram difference used for the bias after the window,
+ *
+ * as doubles in native byte order. The index file, with the name of the data file plus ".index",
+ * has the same header followed by the 64-bit window number and 64-bit byte offset of each chunk
+ * in the data file, so a window can be found without scanning the data file.
+ *
+ * A restarted simulation appends to the files, and may write windows again that were written after
+ * its checkpoint. The last chunk written for a window supersedes the earlier ones.
+ *
+ * \author M. Eric Irrgang <ericirrgang@gmail.com>
+ */
+
+#include <cstdint>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Data recorded for one window.
+ */
+struct WindowRecord
+{
+    uint64_t window{0};
+    int64_t step{0};
+    std::vector<double> samples;
+    std::vector<double> localHistogram;
+    std::vector<double> reducedHistogram;
+    std::vector<double> difference;
+};
+
+/*!
+ * \brief Write window records to an indexed binary file from a background thread.
+ *
+ * push() only moves the record into a bounded queue, so the simulation thread never waits for file
+ * I/O. If the queue is full, the record is discarded and counted in dropped(). If a write fails,
+ * the writer stops writing and reports the error through failed() and flush(). The destructor
+ * writes the records remaining in the queue and joins the writer thread.
+ */
+class WindowWriter
+{
+    public:
+        /*!
+         * \brief Open the output files and start the writer thread.
+         *
+         * \param filename name of the data file.
+         * \param numBins number of histogram bins per window.
+         * \param numSamples number of distance samples per window.
+         * \param append if true, append to existing files, e.g. when restarting from a checkpoint.
+         * Otherwise existing files are overwritten.
+         * \param queueCapacity maximum number of records waiting to be written.
+         * \throws gmxapi::ProtocolError if the files cannot be opened, or if the files to append to
+         * were written with different parameters.
+         */
+        WindowWriter(const std::string& filename,
+                     size_t numBins,
+                     size_t numSamples,
+                     bool append = false,
+                     size_t queueCapacity = 16);
+
+        ~WindowWriter();
+
+        WindowWriter(const WindowWriter&) = delete;
+
+        WindowWriter& operator=(const WindowWriter&) = delete;
+
+        /*!
+         * \brief Queue a record for output.
+         *
+         * \param record window data with numSamples samples and numBins values per histogram.
+         * \return false if the queue was full and the record was discarded.
+         * \throws gmxapi::ProtocolError if the record does not have the sizes given at construction.
+         */
+        bool push(WindowRecord&& record);
+
+        /*!
+         * \brief Block until all queued records have been written and flushed.
+         *
+         * \throws gmxapi::ProtocolError if writing to the files failed.
+         */
+        void flush();
+
+        /*!
+         * \brief Whether writing to the files failed.
+         *
+         * Records queued after the failure are not written.
+         */
+        bool failed() const;
+
+        /*!
+         * \brief Number of records discarded because the queue was full.
+         */
+        size_t dropped() const;
+
+        /*!
+         * \brief Number of records written to the file.
+         */
+        size_t written() const;
+
+    private:
+        /// Body of the writer thread.
+        void run();
+
+        /*!
+         * \brief Append a record to the data and index files. Called on the writer thread only.
+         *
+         * \return false if a write failed.
+         */
+        bool write(const WindowRecord& record);
+
+        std::string filename_;
+        size_t numBins_;
+        size_t numSamples_;
+        size_t capacity_;
+
+        RAIIFile data_;
+        RAIIFile index_;
+        /// Byte offset of the next chunk in the data file.
+        uint64_t offset_{0};
+
+        mutable std::mutex mutex_;
+        std::condition_variable recordsAvailable_;
+        std::condition_variable queueDrained_;
+        std::deque<WindowRecord> queue_;
+        /// Whether the writer thread is writing a record taken from the queue.
+        bool writing_{false};
+        bool stop_{false};
+        bool failed_{false};
+        size_t dropped_{0};
+        size_t written_{0};
+
+        std::thread thread_;
+};
+
+/*!
+ * \brief Random access to the records in a file written by WindowWriter.
+ */
+class WindowReader
+{
+    public:
+        /*!
+         * \brief Open a data file and read its index.
+         *
+         * \param filename name of the data file.
+         * \throws gmxapi::ProtocolError if the files cannot be read.
+         */
+        explicit WindowReader(const std::string& filename);
+
+        /*!
+         * \brief Number of records in the file.
+         */
+        size_t size() const
+        {
+            return offsets_.size();
+        }
+
+        /*!
+         * \brief Window numbers of the records, in the order of their last chunk in the file.
+         */
+        const std::vector<uint64_t>& windows() const
+        {
+            return windows_;
+        }
+
+        /*!
+         * \brief Read the record for a window.
+         *
+         * \param window window number.
+         * \return the record.
+         * \throws gmxapi::ProtocolError if the window is not in the file.
+         */
+        WindowRecord read(uint64_t window);
+
+    private:
+        std::string filename_;
+        RAIIFile data_;
+        size_t numBins_{0};
+        size_t numSamples_{0};
+        std::vector<uint64_t> windows_;
+        std::vector<uint64_t> offsets_;
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_WINDOWWRITER_H
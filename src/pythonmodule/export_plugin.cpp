@@ -12,7 +12,12 @@
 
 #include <cassert>
 
+#include <initializer_list>
 #include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "gmxapi/exceptions.h"
 #include "gmxapi/md.h"
@@ -20,6 +25,11 @@
 #include "gmxapi/gmxapi.h"
 
 #include "ensemblepotential.h"
+#include "ensemblerestraintset.h"
+#include "fixedensemblepotential.h"
+#ifdef GMXAPI_EXTENSION_MPI
+#include "mpireduce.h"
+#endif
 
 // Make a convenient alias to save some typing...
 namespace py = pybind11;
@@ -122,23 +132,17 @@ void PyRestraint<T>::bind(py::object object)
  * \tparam T class implementing the gmxapi::MDModule interface.
  * \return shared ownership of a T object via the gmxapi::MDModule interface.
  */
-// If T is derived from gmxapi::MDModule, create a default-constructed std::shared_ptr<T>
-// \todo Need a better default that can call a shared_from_this()
+// If T is derived from gmxapi::MDModule, share ownership of this object.
 template<class T>
 std::shared_ptr<gmxapi::MDModule> PyRestraint<T>::getModule()
 {
-    auto module = std::make_shared<typename std::enable_if<std::is_base_of<gmxapi::MDModule, T>::value, T>::type>();
-    return module;
+    static_assert(std::is_base_of<gmxapi::MDModule, T>::value,
+                  "PyRestraint<T>::getModule() must be specialized if T is not a gmxapi::MDModule.");
+    return this->shared_from_this();
 }
 
-
-template<>
-std::shared_ptr<gmxapi::MDModule> PyRestraint<plugin::RestraintModule<plugin::EnsembleRestraint>>::getModule()
-{
-    return shared_from_this();
-}
 //////////////////////////////////////////////////////////////////////////////////////////
-// New restraints mimicking EnsembleRestraint should specialize getModule() here as above.
+// New restraints that are not gmxapi::MDModules should specialize getModule() here.
 //////////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -173,6 +177,347 @@ const char* MyRestraint::docstring =
 //////////////////
 
 
+namespace
+{
+
+/*!
+ * \brief Read the parameters of an ensemble restraint from a Python dictionary.
+ *
+ * If "grid_origin" is given, "experimental" may either have "nbins" values, for the bins starting
+ * at the origin, or also include the bins from zero distance (see plugin::experimentalOnGrid()).
+ *
+ * \param parameter_dict parameters of an ensemble_restraint work element.
+ * \param siteIndices destination for the site indices in the "sites" key.
+ * \return parameters structure for the potential.
+ */
+plugin::ensemble_input_param_type ensembleParamsFromDict(const py::dict& parameter_dict,
+                                                         std::vector<int>* siteIndices)
+{
+    // \todo Check for the presence of these dictionary keys to avoid hard-to-diagnose error.
+
+    // Get positional parameters.
+    py::list sites = parameter_dict["sites"];
+    for (auto&& site : sites)
+    {
+        siteIndices->emplace_back(py::cast<int>(site));
+    }
+
+    auto nbins = py::cast<size_t>(parameter_dict["nbins"]);
+    auto binWidth = py::cast<double>(parameter_dict["binWidth"]);
+    auto minDist = py::cast<double>(parameter_dict["min_dist"]);
+    auto maxDist = pybind11::cast<double>(parameter_dict["max_dist"]);
+    auto experimental = pybind11::cast<std::vector<double>>(parameter_dict["experimental"]);
+    double gridOrigin{0};
+    if (parameter_dict.contains("grid_origin"))
+    {
+        gridOrigin = py::cast<double>(parameter_dict["grid_origin"]);
+        experimental = plugin::experimentalOnGrid(experimental,
+                                                  nbins,
+                                                  binWidth,
+                                                  gridOrigin);
+    }
+    auto nSamples = pybind11::cast<unsigned int>(parameter_dict["nsamples"]);
+    auto samplePeriod = pybind11::cast<double>(parameter_dict["sample_period"]);
+    auto nWindows = pybind11::cast<unsigned int>(parameter_dict["nwindows"]);
+    auto k = pybind11::cast<double>(parameter_dict["k"]);
+    auto sigma = pybind11::cast<double>(parameter_dict["sigma"]);
+
+    auto params = plugin::makeEnsembleParams(nbins,
+                                             binWidth,
+                                             minDist,
+                                             maxDist,
+                                             experimental,
+                                             nSamples,
+                                             samplePeriod,
+                                             nWindows,
+                                             k,
+                                             sigma);
+
+    // Optional parameters.
+    params->gridOrigin = gridOrigin;
+    if (parameter_dict.contains("sigma_cutoff"))
+    {
+        params->sigmaCutoff = py::cast<double>(parameter_dict["sigma_cutoff"]);
+    }
+    if (parameter_dict.contains("blur"))
+    {
+        const auto blur = py::cast<std::string>(parameter_dict["blur"]);
+        if (blur == "exact")
+        {
+            params->blurMethod = plugin::BlurMethod::Exact;
+        }
+        else if (blur == "binned")
+        {
+            params->blurMethod = plugin::BlurMethod::Binned;
+        }
+        else if (blur != "auto")
+        {
+            throw gmxapi::ProtocolError("blur must be 'auto', 'exact', or 'binned'.");
+        }
+    }
+    if (parameter_dict.contains("blur_tolerance"))
+    {
+        params->blurTolerance = py::cast<double>(parameter_dict["blur_tolerance"]);
+    }
+    if (parameter_dict.contains("averaging"))
+    {
+        const auto averaging = py::cast<std::string>(parameter_dict["averaging"]);
+        if (averaging == "exponential")
+        {
+            params->averaging = plugin::WindowAveraging::Exponential;
+        }
+        else if (averaging != "sliding")
+        {
+            throw gmxapi::ProtocolError("averaging must be 'sliding' or 'exponential'.");
+        }
+    }
+    if (parameter_dict.contains("kernel_precision"))
+    {
+        const auto precision = py::cast<std::string>(parameter_dict["kernel_precision"]);
+        if (precision == "single")
+        {
+            params->kernelPrecision = plugin::KernelPrecision::Single;
+        }
+        else if (precision != "double")
+        {
+            throw gmxapi::ProtocolError("kernel_precision must be 'double' or 'single'.");
+        }
+    }
+    if (parameter_dict.contains("exp_accuracy"))
+    {
+        const auto accuracy = py::cast<std::string>(parameter_dict["exp_accuracy"]);
+        if (accuracy == "1e-7")
+        {
+            params->expAccuracy = plugin::ExpAccuracy::Relative1e7;
+        }
+        else if (accuracy == "1e-4")
+        {
+            params->expAccuracy = plugin::ExpAccuracy::Relative1e4;
+        }
+        else if (accuracy != "full")
+        {
+            throw gmxapi::ProtocolError("exp_accuracy must be 'full', '1e-7', or '1e-4'.");
+        }
+    }
+    if (parameter_dict.contains("gaussian_evaluation"))
+    {
+        const auto evaluation = py::cast<std::string>(parameter_dict["gaussian_evaluation"]);
+        if (evaluation == "recurrence")
+        {
+            params->gaussianEvaluation = plugin::GaussianEvaluation::Recurrence;
+        }
+        else if (evaluation != "direct")
+        {
+            throw gmxapi::ProtocolError("gaussian_evaluation must be 'direct' or 'recurrence'.");
+        }
+    }
+    if (parameter_dict.contains("autotune"))
+    {
+        params->autotune = py::cast<bool>(parameter_dict["autotune"]);
+    }
+    if (parameter_dict.contains("table_points_per_bin"))
+    {
+        params->tablePointsPerBin = py::cast<unsigned int>(parameter_dict["table_points_per_bin"]);
+    }
+    if (parameter_dict.contains("dt"))
+    {
+        params->timeStep = py::cast<double>(parameter_dict["dt"]);
+    }
+    if (parameter_dict.contains("checkpoint_file"))
+    {
+        params->checkpointFile = py::cast<std::string>(parameter_dict["checkpoint_file"]);
+    }
+    if (parameter_dict.contains("checkpoint_interval"))
+    {
+        params->checkpointInterval = py::cast<unsigned int>(parameter_dict["checkpoint_interval"]);
+    }
+    if (parameter_dict.contains("restart_file"))
+    {
+        params->restartFile = py::cast<std::string>(parameter_dict["restart_file"]);
+    }
+    if (parameter_dict.contains("output_file"))
+    {
+        params->outputFile = py::cast<std::string>(parameter_dict["output_file"]);
+    }
+    if (parameter_dict.contains("reduce_lag"))
+    {
+        params->reduceLag = py::cast<unsigned int>(parameter_dict["reduce_lag"]);
+    }
+
+    return std::move(*params);
+}
+
+/*!
+ * \brief Get the name of the ensemble reduce backend requested by work element parameters.
+ *
+ * \param parameter_dict params of a work element, optionally with a "reduce_backend" key.
+ * \return "python" (default) or "mpi"
+ */
+std::string reduceBackendFromDict(const py::dict& parameter_dict)
+{
+    std::string backend{"python"};
+    if (parameter_dict.contains("reduce_backend"))
+    {
+        backend = py::cast<std::string>(parameter_dict["reduce_backend"]);
+    }
+    if (backend != "python" && backend != "mpi")
+    {
+        throw gmxapi::ProtocolError("reduce_backend must be 'python' or 'mpi'.");
+    }
+    return backend;
+}
+
+/*!
+ * \brief Get ensemble resources providing the ensemble reduce for restraints.
+ *
+ * With the "python" backend, the reduce calls the ensemble_update function of the Context from the
+ * simulation thread. With the "mpi" backend, the reduce calls MPI_Allreduce directly on the ensemble
+ * communicator of the Context, which is looked up once, here. The Context is expected to provide the
+ * mpi4py communicator with one rank per ensemble member as its ``ensemble_communicator`` attribute.
+ *
+ * Only the "mpi" backend can overlap the reduction with MD steps (see the reduce_lag parameter).
+ * The "python" backend always blocks.
+ *
+ * \param context Python Context providing ensemble_update.
+ * \param name tag for the reduction, passed to ensemble_update.
+ * \param backend "python" or "mpi"
+ * \return resources to share with the restraints.
+ */
+std::shared_ptr<plugin::Resources> makeEnsembleResources(const py::object& context,
+                                                         const std::string& name,
+                                                         const std::string& backend)
+{
+    if (backend == "mpi")
+    {
+#ifdef GMXAPI_EXTENSION_MPI
+        // Accept the private name used by the gmx package Context as well.
+        py::object communicator = py::none();
+        for (const char* attribute : {"ensemble_communicator", "_session_ensemble_communicator"})
+        {
+            if (py::hasattr(context, attribute) && !context.attr(attribute).is_none())
+            {
+                communicator = context.attr(attribute);
+                break;
+            }
+        }
+        if (communicator.is_none() || !py::hasattr(communicator, "py2f"))
+        {
+            throw gmxapi::ProtocolError("reduce_backend 'mpi' requires an mpi4py ensemble_communicator on the context.");
+        }
+        const auto handle = py::cast<int>(communicator.attr("py2f")());
+        return std::make_shared<plugin::Resources>(plugin::makeMpiReduce(handle),
+                                                   plugin::makeMpiIreduce(handle));
+#else
+        throw gmxapi::ProtocolError("reduce_backend 'mpi' is not available because the plugin was built without MPI.");
+#endif
+    }
+
+    // Temporarily subvert things to get quick-and-dirty solution for testing.
+    // Need to capture Python communicator and pybind syntax in closure so EnsembleResources
+    // can just call with matrix arguments.
+
+    // This can be replaced with a subscription and delayed until launch, if necessary.
+    if (!py::hasattr(context, "ensemble_update"))
+    {
+        throw gmxapi::ProtocolError("context does not have 'ensemble_update'.");
+    }
+    // make a local copy of the Python object so we can capture it in the lambda
+    auto update = context.attr("ensemble_update");
+    // Make a callable with standardizeable signature.
+    auto functor = [update, name](const plugin::Matrix<double>& send,
+                                  plugin::Matrix<double>* receive) {
+        update(send,
+               receive,
+               py::str(name));
+    };
+
+    // To use a reduce function on the Python side, we need to provide it with a Python buffer-like object,
+    // so we will create one here. Note: it looks like the SharedData element will be useful after all.
+    return std::make_shared<plugin::Resources>(std::move(functor));
+}
+
+/*!
+ * \brief Create the Python object for an ensemble restraint.
+ *
+ * If the bin count is one of plugin::FixedBinCounts, the restraint uses the
+ * plugin::FixedEnsemblePotential specialization for it.
+ *
+ * \return Python wrapper of a plugin::RestraintModule for the restraint.
+ */
+py::object createEnsembleRestraint(const std::string& name,
+                                   const std::vector<int>& sites,
+                                   const plugin::ensemble_input_param_type& params,
+                                   const std::shared_ptr<plugin::Resources>& resources)
+{
+    py::object potential;
+    const bool fixed = plugin::dispatchFixedBins(params.nBins,
+                                                 [&](auto nBins)
+                                                 {
+                                                     using Restraint = plugin::FixedEnsembleRestraint<decltype(nBins)::value>;
+                                                     potential = py::cast(PyRestraint<plugin::RestraintModule<Restraint>>::create(name,
+                                                                                                                                 sites,
+                                                                                                                                 params,
+                                                                                                                                 resources));
+                                                 });
+    if (!fixed)
+    {
+        potential = py::cast(PyRestraint<plugin::RestraintModule<plugin::EnsembleRestraint>>::create(name,
+                                                                                                     sites,
+                                                                                                     params,
+                                                                                                     resources));
+    }
+    return potential;
+}
+
+/*!
+ * \brief Export the Python class of an ensemble restraint.
+ *
+ * \tparam Restraint plugin::BasicEnsembleRestraint for a potential.
+ * \param className Python class name, which must outlive the module.
+ */
+template<class Restraint>
+void exportEnsembleRestraint(py::module& m,
+                             const char* className)
+{
+    using PyEnsemble = PyRestraint<plugin::RestraintModule<Restraint>>;
+    py::class_<PyEnsemble, std::shared_ptr<PyEnsemble>> ensemble(m, className);
+    // EnsembleRestraint can only be created via builder for now.
+    ensemble.def("bind",
+                 &PyEnsemble::bind,
+                 "Implement binding protocol");
+    // Step cache statistics, e.g. to check that repeated evaluations are served from the cache.
+    ensemble.def("evaluations",
+                 [](PyEnsemble& self)
+                 {
+                     return std::static_pointer_cast<Restraint>(self.getRestraint())->evaluations();
+                 },
+                 "Number of force evaluations requested by GROMACS");
+    ensemble.def("cache_hits",
+                 [](PyEnsemble& self)
+                 {
+                     return std::static_pointer_cast<Restraint>(self.getRestraint())->cacheHits();
+                 },
+                 "Number of force evaluations served from the step cache");
+}
+
+/*!
+ * \brief Export the Python classes of the fixed-size ensemble restraints.
+ *
+ * The classes are named EnsembleRestraint<nbins>, e.g. EnsembleRestraint70, and behave like EnsembleRestraint.
+ */
+template<size_t ... NBins>
+void exportFixedEnsembleRestraints(py::module& m,
+                                   std::index_sequence<NBins...>)
+{
+    // pybind11 keeps the class names, so they must outlive the module.
+    static const std::string classNames[] = {"EnsembleRestraint" + std::to_string(NBins)...};
+    size_t i{0};
+    (void) std::initializer_list<int>{(exportEnsembleRestraint<plugin::FixedEnsembleRestraint<NBins>>(m,
+                                                                                                      classNames[i++].c_str()), 0)...};
+}
+
+} // end anonymous namespace
+
 class EnsembleRestraintBuilder
 {
     public:
@@ -188,37 +533,9 @@ class EnsembleRestraintBuilder
 
             // Params attribute should be a Python list
             py::dict parameter_dict = element.attr("params");
-            // \todo Check for the presence of these dictionary keys to avoid hard-to-diagnose error.
-
-            // Get positional parameters.
-            py::list sites = parameter_dict["sites"];
-            for (auto&& site : sites)
-            {
-                siteIndices_.emplace_back(py::cast<int>(site));
-            }
-
-            auto nbins = py::cast<size_t>(parameter_dict["nbins"]);
-            auto binWidth = py::cast<double>(parameter_dict["binWidth"]);
-            auto minDist = py::cast<double>(parameter_dict["min_dist"]);
-            auto maxDist = pybind11::cast<double>(parameter_dict["max_dist"]);
-            auto experimental = pybind11::cast<std::vector<double>>(parameter_dict["experimental"]);
-            auto nSamples = pybind11::cast<unsigned int>(parameter_dict["nsamples"]);
-            auto samplePeriod = pybind11::cast<double>(parameter_dict["sample_period"]);
-            auto nWindows = pybind11::cast<unsigned int>(parameter_dict["nwindows"]);
-            auto k = pybind11::cast<double>(parameter_dict["k"]);
-            auto sigma = pybind11::cast<double>(parameter_dict["sigma"]);
-
-            auto params = plugin::makeEnsembleParams(nbins,
-                                                     binWidth,
-                                                     minDist,
-                                                     maxDist,
-                                                     experimental,
-                                                     nSamples,
-                                                     samplePeriod,
-                                                     nWindows,
-                                                     k,
-                                                     sigma);
-            params_ = std::move(*params);
+            params_ = ensembleParamsFromDict(parameter_dict,
+                                             &siteIndices_);
+            reduceBackend_ = reduceBackendFromDict(parameter_dict);
 
             // Note that if we want to grab a reference to the Context or its communicator, we can get it
             // here through element.workspec._context. We need a more general API solution, but this code is
@@ -253,34 +570,14 @@ class EnsembleRestraintBuilder
             // mark this standard 'graph' argument unused.
             (void) graph;
 
-            // Temporarily subvert things to get quick-and-dirty solution for testing.
-            // Need to capture Python communicator and pybind syntax in closure so EnsembleResources
-            // can just call with matrix arguments.
+            auto resources = makeEnsembleResources(context_,
+                                                   name_,
+                                                   reduceBackend_);
 
-            // This can be replaced with a subscription and delayed until launch, if necessary.
-            if (!py::hasattr(context_, "ensemble_update"))
-            {
-                throw gmxapi::ProtocolError("context does not have 'ensemble_update'.");
-            }
-            // make a local copy of the Python object so we can capture it in the lambda
-            auto update = context_.attr("ensemble_update");
-            // Make a callable with standardizeable signature.
-            const std::string name{name_};
-            auto functor = [update, name](const plugin::Matrix<double>& send,
-                                          plugin::Matrix<double>* receive) {
-                update(send,
-                       receive,
-                       py::str(name));
-            };
-
-            // To use a reduce function on the Python side, we need to provide it with a Python buffer-like object,
-            // so we will create one here. Note: it looks like the SharedData element will be useful after all.
-            auto resources = std::make_shared<plugin::Resources>(std::move(functor));
-
-            auto potential = PyRestraint<plugin::RestraintModule<plugin::EnsembleRestraint>>::create(name_,
-                                                                                                     siteIndices_,
-                                                                                                     params_,
-                                                                                                     resources);
+            auto potential = createEnsembleRestraint(name_,
+                                                     siteIndices_,
+                                                     params_,
+                                                     resources);
 
             auto subscriber = subscriber_;
             py::list potentialList = subscriber.attr("potential");
@@ -308,6 +605,106 @@ class EnsembleRestraintBuilder
         std::vector<int> siteIndices_;
 
         plugin::ensemble_input_param_type params_;
+        std::string reduceBackend_;
+
+        std::string name_;
+};
+
+/*!
+ * \brief Build the restraints of an ensemble_restraint_set work element.
+ *
+ * The element params have a "restraints" key holding a list of parameter dictionaries, each with
+ * the same keys as the params of an ensemble_restraint element. All of the restraints share one
+ * ensemble reduction per window (see plugin::EnsembleRestraintSet).
+ */
+class EnsembleRestraintSetBuilder
+{
+    public:
+        explicit EnsembleRestraintSetBuilder(py::object element)
+        {
+            name_ = py::cast<std::string>(element.attr("name"));
+            assert(!name_.empty());
+
+            assert(py::hasattr(element,
+                               "params"));
+            py::dict parameter_dict = element.attr("params");
+            if (!parameter_dict.contains("restraints"))
+            {
+                throw gmxapi::ProtocolError("ensemble_restraint_set requires a 'restraints' parameter.");
+            }
+            reduceBackend_ = reduceBackendFromDict(parameter_dict);
+            py::list restraints = parameter_dict["restraints"];
+            for (auto&& restraint : restraints)
+            {
+                std::vector<int> sites;
+                params_.emplace_back(ensembleParamsFromDict(py::cast<py::dict>(restraint),
+                                                            &sites));
+                siteIndices_.emplace_back(std::move(sites));
+            }
+
+            assert(py::hasattr(element,
+                               "workspec"));
+            auto workspec = element.attr("workspec");
+            assert(py::hasattr(workspec,
+                               "_context"));
+            context_ = workspec.attr("_context");
+        }
+
+        /*!
+         * \brief Add one potential per restraint to the subscriber.
+         *
+         * \param graph networkx.DiGraph object still evolving in gmx.context.
+         */
+        void build(py::object graph)
+        {
+            if (!subscriber_)
+            {
+                return;
+            }
+            else
+            {
+                if (!py::hasattr(subscriber_, "potential")) throw gmxapi::ProtocolError("Invalid subscriber");
+            }
+            (void) graph;
+
+            auto resources = makeEnsembleResources(context_,
+                                                   name_,
+                                                   reduceBackend_);
+
+            auto set = std::make_shared<plugin::EnsembleRestraintSet>();
+            py::list potentialList = subscriber_.attr("potential");
+            for (size_t i = 0;i < params_.size();++i)
+            {
+                plugin::ensemble_set_member_param_type member;
+                member.set = set;
+                member.index = set->addRestraint(params_[i]);
+                auto potential =
+                    PyRestraint<plugin::RestraintModule<plugin::EnsembleSetRestraint>>::create(name_ + "_" + std::to_string(i),
+                                                                                               siteIndices_[i],
+                                                                                               member,
+                                                                                               resources);
+                potentialList.append(potential);
+            }
+        };
+
+        /*!
+         * \brief Accept subscription of an MD task.
+         *
+         * \param subscriber Python object with a 'potential' attribute that is a Python list.
+         */
+        void addSubscriber(py::object subscriber)
+        {
+            assert(py::hasattr(subscriber,
+                               "potential"));
+            subscriber_ = subscriber;
+        };
+
+        py::object subscriber_;
+        py::object context_;
+        std::vector<std::vector<int>> siteIndices_;
+
+        std::vector<plugin::ensemble_input_param_type> params_;
+        std::string reduceBackend_;
 
         std::string name_;
 };
@@ -327,6 +724,19 @@ std::unique_ptr<EnsembleRestraintBuilder> createEnsembleBuilder(const py::object
     return builder;
 }
 
+/*!
+ * \brief Factory function to create a new restraint set builder for use during Session launch.
+ *
+ * \param element WorkElement provided through Context
+ * \return ownership of new builder object
+ */
+std::unique_ptr<EnsembleRestraintSetBuilder> createEnsembleSetBuilder(const py::object& element)
+{
+    using std::make_unique;
+    auto builder = make_unique<EnsembleRestraintSetBuilder>(element);
+    return builder;
+}
+
 }
 
 
@@ -382,20 +792,17 @@ PYBIND11_MODULE(myplugin, m) {
     ensembleBuilder.def("build",
                         &EnsembleRestraintBuilder::build);
 
-    // Get more concise name for the template instantiation...
-    using PyEnsemble = PyRestraint<plugin::RestraintModule<plugin::EnsembleRestraint>>;
-
     // Export a Python class for our parameters struct
     py::class_<plugin::EnsembleRestraint::input_param_type> ensembleParams(m, "EnsembleRestraintParams");
     m.def("make_ensemble_params",
           &plugin::makeEnsembleParams);
 
     // API object to build.
-    py::class_<PyEnsemble, std::shared_ptr<PyEnsemble>> ensemble(m, "EnsembleRestraint");
-    // EnsembleRestraint can only be created via builder for now.
-    ensemble.def("bind",
-                 &PyEnsemble::bind,
-                 "Implement binding protocol");
+    exportEnsembleRestraint<plugin::EnsembleRestraint>(m,
+                                                       "EnsembleRestraint");
+    // Restraints with the bin counts in plugin::FixedBinCounts are built with compile-time bin counts.
+    exportFixedEnsembleRestraints(m,
+                                  plugin::FixedBinCounts());
     /*
      * To implement gmxapi_workspec_1_0, the module needs a function that a Context can import that
      * produces a builder that translates workspec elements for session launching. The object returned
@@ -412,6 +819,29 @@ PYBIND11_MODULE(myplugin, m) {
     // End EnsembleRestraint
     ///////////////////////////////////////////////////////////////////////////
 
+    //////////////////////////////////////////////////////////////////////////
+    // Begin EnsembleRestraintSet
+    //
+    pybind11::class_<EnsembleRestraintSetBuilder> ensembleSetBuilder(m,
+                                                                     "EnsembleSetBuilder");
+    ensembleSetBuilder.def("add_subscriber",
+                           &EnsembleRestraintSetBuilder::addSubscriber);
+    ensembleSetBuilder.def("build",
+                           &EnsembleRestraintSetBuilder::build);
+
+    using PyEnsembleSetMember = PyRestraint<plugin::RestraintModule<plugin::EnsembleSetRestraint>>;
+    py::class_<PyEnsembleSetMember, std::shared_ptr<PyEnsembleSetMember>> ensembleSetMember(m, "EnsembleSetRestraint");
+    ensembleSetMember.def("bind",
+                          &PyEnsembleSetMember::bind,
+                          "Implement binding protocol");
+
+    // WorkElements will have namespace: "myplugin" and operation: "ensemble_restraint_set"
+    m.def("ensemble_restraint_set",
+          [](const py::object element) { return createEnsembleSetBuilder(element); });
+    //
+    // End EnsembleRestraintSet
+    ///////////////////////////////////////////////////////////////////////////
+
 
 
 
@@ -0,0 +1,591 @@
+//
+// Throughput benchmarks for the restraint kernels and window updates.
+//
+// Usage: gmxapi_extension_benchmark [--quick] [--min-time=SECONDS] [--output=FILE]
+//
+// Results are written as JSON (to standard output unless --output is given) with one entry per
+// benchmark and parameter set, reporting ns per call and calls per second, so that builds can be
+// compared with a script. --quick runs a single small parameter set for a smoke test.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ensemblepotential.h"
+#include "fixedensemblepotential.h"
+#include "harmonicpotential.h"
+#include "kernels.h"
+#include "pairevaluator.h"
+#include "threadensemble.h"
+
+using ::gmx::Vector;
+
+namespace {
+
+struct BenchmarkParameters
+{
+    size_t nBins;
+    unsigned int nSamples;
+    unsigned int nWindows;
+    double sigma;
+    /// Number of ensemble members, for the ThreadEnsemble benchmarks.
+    size_t members{1};
+};
+
+struct BenchmarkResult
+{
+    std::string name;
+    BenchmarkParameters parameters;
+    unsigned long long iterations;
+    double nsPerCall;
+    /// Additional named timings (ns) reported by some benchmarks.
+    std::vector<std::pair<std::string, double>> details{};
+};
+
+// Keep the compiler from discarding the benchmarked calculations.
+volatile double sink{0};
+
+/*!
+ * \brief Time a function performing one call per invocation.
+ *
+ * The number of iterations is doubled until the run takes at least minTime seconds.
+ */
+BenchmarkResult measure(const std::string& name,
+                        const BenchmarkParameters& parameters,
+                        double minTime,
+                        const std::function<void(unsigned long long)>& body)
+{
+    using clock = std::chrono::steady_clock;
+
+    unsigned long long iterations{1};
+    double elapsed{0};
+    while (true)
+    {
+        const auto start = clock::now();
+        for (unsigned long long i = 0;i < iterations;++i)
+        {
+            body(i);
+        }
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        if (elapsed >= minTime || iterations >= (1ULL << 40))
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+    return {name, parameters, iterations, 1e9 * elapsed / iterations};
+}
+
+std::unique_ptr<plugin::ensemble_input_param_type> makeParams(const BenchmarkParameters& parameters)
+{
+    // Histogram over 0 to 10 nm with the flat-bottom bounding potential inside 1 to 9 nm.
+    const double binWidth = 10. / parameters.nBins;
+    std::vector<double> experimental(parameters.nBins,
+                                     1. / parameters.nBins);
+    auto params = plugin::makeEnsembleParams(parameters.nBins,
+                                             binWidth,
+                                             1.0,
+                                             9.0,
+                                             experimental,
+                                             parameters.nSamples,
+                                             1.0, // samplePeriod
+                                             parameters.nWindows,
+                                             10., // k
+                                             parameters.sigma);
+    params->timeStep = 1.0;
+    return params;
+}
+
+// Distance of the pair at a step, covering the histogram without being periodic in the window length.
+double distance(unsigned long long step)
+{
+    return 5.0 + 3.5 * sin(0.37 * step);
+}
+
+/*!
+ * \brief Fill the history of a restraint so that the bias is not trivially zero.
+ */
+void fillHistory(plugin::EnsemblePotential* restraint,
+                 const BenchmarkParameters& parameters,
+                 unsigned long long* step)
+{
+    std::vector<double> window(restraint->numBins());
+    const unsigned long long end = *step + static_cast<unsigned long long>(parameters.nSamples) * (parameters.nWindows + 1);
+    for (;*step < end;++*step)
+    {
+        const double t = *step;
+        if (restraint->sample(distance(*step),
+                              t))
+        {
+            restraint->blurWindow(window.data());
+            restraint->applyWindow(window.data(),
+                                   t);
+        }
+    }
+}
+
+template<class Potential = plugin::EnsemblePotential>
+BenchmarkResult benchmarkCalculate(const std::string& name,
+                                   const BenchmarkParameters& parameters,
+                                   double minTime,
+                                   plugin::KernelPrecision precision = plugin::KernelPrecision::Double,
+                                   plugin::GaussianEvaluation evaluation = plugin::GaussianEvaluation::Direct,
+                                   plugin::ExpAccuracy accuracy = plugin::ExpAccuracy::Full)
+{
+    auto params = makeParams(parameters);
+    params->kernelPrecision = precision;
+    params->gaussianEvaluation = evaluation;
+    params->expAccuracy = accuracy;
+    Potential restraint{*params};
+    unsigned long long step{0};
+    fillHistory(&restraint,
+                parameters,
+                &step);
+
+    const Vector zerovec{0, 0, 0};
+    return measure(name,
+                   parameters,
+                   minTime,
+                   [&](unsigned long long i)
+                   {
+                       const Vector v{static_cast<real>(distance(i)), real(0), real(0)};
+                       sink = sink + restraint.calculate(v,
+                                                         zerovec,
+                                                         static_cast<double>(step)).force[0];
+                   });
+}
+
+// One call is a complete window: nSamples samples, the blur, and the update of the bias
+// with an ensemble of one, as composed by EnsemblePotential::callback().
+BenchmarkResult benchmarkWindowUpdate(const BenchmarkParameters& parameters,
+                                      double minTime)
+{
+    auto params = makeParams(parameters);
+    plugin::EnsemblePotential restraint{*params};
+    unsigned long long step{0};
+    fillHistory(&restraint,
+                parameters,
+                &step);
+
+    std::vector<double> window(restraint.numBins());
+    return measure("EnsemblePotential::callback window update",
+                   parameters,
+                   minTime,
+                   [&](unsigned long long)
+                   {
+                       bool complete{false};
+                       while (!complete)
+                       {
+                           const double t = step;
+                           complete = restraint.sample(distance(step),
+                                                       t);
+                           if (complete)
+                           {
+                               restraint.blurWindow(window.data());
+                               restraint.applyWindow(window.data(),
+                                                     t);
+                           }
+                           ++step;
+                       }
+                       sink = sink + window[0];
+                   });
+}
+
+// BlurToGrid is internal to ensemblepotential.cpp, so it is timed through blurWindow(), which only
+// blurs the samples of the last complete window onto the grid.
+BenchmarkResult benchmarkBlur(const std::string& name,
+                              const BenchmarkParameters& parameters,
+                              double minTime,
+                              plugin::BlurMethod method = plugin::BlurMethod::Exact,
+                              double sigmaCutoff = 0)
+{
+    auto params = makeParams(parameters);
+    params->blurMethod = method;
+    params->sigmaCutoff = sigmaCutoff;
+    plugin::EnsemblePotential restraint{*params};
+    unsigned long long step{0};
+    while (!restraint.sample(distance(step),
+                             static_cast<double>(step)))
+    {
+        ++step;
+    }
+
+    std::vector<double> window(restraint.numBins());
+    return measure(name,
+                   parameters,
+                   minTime,
+                   [&](unsigned long long)
+                   {
+                       restraint.blurWindow(window.data());
+                       sink = sink + window[window.size() / 2];
+                   });
+}
+
+BenchmarkResult benchmarkHarmonic(double minTime)
+{
+    plugin::Harmonic harmonic{real(1.0), real(10.0)};
+    const Vector zerovec{0, 0, 0};
+    return measure("Harmonic::calculate",
+                   {0, 0, 0, 0},
+                   minTime,
+                   [&](unsigned long long i)
+                   {
+                       const Vector v{static_cast<real>(distance(i)), real(0.5), real(0)};
+                       sink = sink + harmonic.calculate(v,
+                                                        zerovec,
+                                                        0.).force[0];
+                   });
+}
+
+// Time per pair of evaluating many restraints of one type through gmx::IRestraintPotential::evaluate()
+// (ns_per_call), through a PairEvaluator, and with evaluatePairs(), showing the cost of the virtual
+// dispatch. Every call is at a new time, so the step cache of the ensemble restraints does not answer it.
+template<class Restraint>
+BenchmarkResult benchmarkDispatch(const std::string& name,
+                                  const BenchmarkParameters& parameters,
+                                  double minTime,
+                                  const std::vector<std::shared_ptr<Restraint>>& restraints)
+{
+    const size_t numPairs = restraints.size();
+    std::vector<std::shared_ptr<gmx::IRestraintPotential>> potentials(restraints.begin(),
+                                                                      restraints.end());
+    std::vector<plugin::PairEvaluator> evaluators;
+    for (const auto& restraint : restraints)
+    {
+        evaluators.push_back(restraint->pairEvaluator());
+    }
+
+    // Positions for a few steps, so that computing them is not part of the timing.
+    constexpr size_t numSteps{16};
+    std::vector<Vector> r1(numSteps * numPairs);
+    const std::vector<Vector> r2(numPairs, Vector{0, 0, 0});
+    for (size_t i = 0;i < r1.size();++i)
+    {
+        r1[i] = Vector{static_cast<real>(distance(i)), real(0.5), real(0)};
+    }
+    std::vector<gmx::PotentialPointData> output(numPairs);
+
+    auto result = measure(name,
+                          parameters,
+                          minTime,
+                          [&](unsigned long long i)
+                          {
+                              const Vector* positions = r1.data() + (i % numSteps) * numPairs;
+                              for (size_t pair = 0;pair < numPairs;++pair)
+                              {
+                                  sink = sink + potentials[pair]->evaluate(positions[pair],
+                                                                           r2[pair],
+                                                                           i).force[0];
+                              }
+                          });
+    result.nsPerCall /= numPairs;
+
+    const double evaluatorTime = measure(name,
+                                         parameters,
+                                         minTime,
+                                         [&](unsigned long long i)
+                                         {
+                                             const Vector* positions = r1.data() + (i % numSteps) * numPairs;
+                                             for (size_t pair = 0;pair < numPairs;++pair)
+                                             {
+                                                 sink = sink + evaluators[pair](positions[pair],
+                                                                                r2[pair],
+                                                                                i).force[0];
+                                             }
+                                         }).nsPerCall / numPairs;
+    const double batchTime = measure(name,
+                                     parameters,
+                                     minTime,
+                                     [&](unsigned long long i)
+                                     {
+                                         plugin::evaluatePairs(evaluators.data(),
+                                                               r1.data() + (i % numSteps) * numPairs,
+                                                               r2.data(),
+                                                               numPairs,
+                                                               i,
+                                                               output.data());
+                                         for (const auto& point : output)
+                                         {
+                                             sink = sink + point.force[0];
+                                         }
+                                     }).nsPerCall / numPairs;
+    result.details = {{"pair_evaluator_ns", evaluatorTime},
+                      {"evaluate_pairs_ns", batchTime}};
+    return result;
+}
+
+// One call is a window update of every member of an ensemble emulated with ThreadEnsemble, including
+// the calculate() and callback() calls of the steps in the window. The mean time that members spend
+// in the reduction and the mean spread of their arrival times at window boundaries are reported
+// separately.
+BenchmarkResult benchmarkThreadEnsemble(const BenchmarkParameters& parameters,
+                                        unsigned long long numWindows)
+{
+    using clock = std::chrono::steady_clock;
+
+    auto params = makeParams(parameters);
+    plugin::ThreadEnsemble ensemble{parameters.members};
+    const auto start = clock::now();
+    ensemble.run([&](size_t member, const plugin::Resources& resources)
+                 {
+                     plugin::EnsemblePotential restraint{*params};
+                     const Vector zerovec{0, 0, 0};
+                     double energy{0};
+                     const unsigned long long numSteps = numWindows * parameters.nSamples + 1;
+                     for (unsigned long long step = 0;step < numSteps;++step)
+                     {
+                         const double t = step;
+                         const Vector v{static_cast<real>(distance(step + 7 * member)), real(0), real(0)};
+                         if (restraint.updateDue(t))
+                         {
+                             restraint.callback(v,
+                                                zerovec,
+                                                t,
+                                                resources);
+                         }
+                         energy += restraint.calculate(v,
+                                                       zerovec,
+                                                       t).energy;
+                     }
+                     sink = sink + energy;
+                 });
+    const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+    const auto statistics = ensemble.statistics();
+    const double reductions = std::max<unsigned long>(statistics.reductions,
+                                                      1);
+    return {"ThreadEnsemble window update",
+            parameters,
+            numWindows,
+            1e9 * elapsed / numWindows,
+            {{"reduce_wait_ns", 1e9 * statistics.waitSeconds / (reductions * parameters.members)},
+             {"window_skew_ns", 1e9 * statistics.skewSeconds / reductions},
+             {"max_window_skew_ns", 1e9 * statistics.maxSkewSeconds}}};
+}
+
+void writeJson(std::ostream& stream,
+               const std::vector<BenchmarkResult>& results)
+{
+    stream << "{\n";
+    stream << "  \"context\": {\"gaussian_kernels\": \"" << plugin::gaussianKernels().name << "\"},\n";
+    stream << "  \"benchmarks\": [";
+    for (size_t i = 0;i < results.size();++i)
+    {
+        const auto& result = results[i];
+        stream << (i == 0 ? "\n" : ",\n");
+        stream << "    {\"name\": \"" << result.name << "\", "
+               << "\"nbins\": " << result.parameters.nBins << ", "
+               << "\"nsamples\": " << result.parameters.nSamples << ", "
+               << "\"nwindows\": " << result.parameters.nWindows << ", "
+               << "\"sigma\": " << result.parameters.sigma << ", "
+               << "\"members\": " << result.parameters.members << ", "
+               << "\"iterations\": " << result.iterations << ", "
+               << "\"ns_per_call\": " << result.nsPerCall << ", "
+               << "\"calls_per_second\": " << 1e9 / result.nsPerCall;
+        for (const auto& detail : result.details)
+        {
+            stream << ", \"" << detail.first << "\": " << detail.second;
+        }
+        stream << "}";
+    }
+    stream << "\n  ]\n}\n";
+}
+
+} // end anonymous namespace
+
+int main(int argc,
+         char* argv[])
+{
+    bool quick{false};
+    double minTime{0.2};
+    std::string output;
+    for (int i = 1;i < argc;++i)
+    {
+        const std::string argument{argv[i]};
+        if (argument == "--quick")
+        {
+            quick = true;
+        }
+        else if (argument.compare(0, 11, "--min-time=") == 0)
+        {
+            minTime = std::atof(argument.c_str() + 11);
+        }
+        else if (argument.compare(0, 9, "--output=") == 0)
+        {
+            output = argument.substr(9);
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--quick] [--min-time=SECONDS] [--output=FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BenchmarkParameters> sweep;
+    if (quick)
+    {
+        minTime = 0.001;
+        sweep.push_back({20, 5, 2, 0.2});
+    }
+    else
+    {
+        for (const size_t nBins : {50, 100, 200, 500})
+        {
+            for (const unsigned int nSamples : {10u, 50u})
+            {
+                for (const unsigned int nWindows : {4u, 16u})
+                {
+                    for (const double sigma : {0.05, 0.2, 0.5})
+                    {
+                        sweep.push_back({nBins, nSamples, nWindows, sigma});
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<BenchmarkResult> results;
+    for (const auto& parameters : sweep)
+    {
+        results.push_back(benchmarkCalculate("EnsemblePotential::calculate",
+                                             parameters,
+                                             minTime));
+        plugin::dispatchFixedBins(parameters.nBins,
+                                  [&](auto nBins)
+                                  {
+                                      using Potential = plugin::FixedEnsemblePotential<decltype(nBins)::value>;
+                                      results.push_back(benchmarkCalculate<Potential>("FixedEnsemblePotential::calculate",
+                                                                                      parameters,
+                                                                                      minTime));
+                                  });
+        results.push_back(benchmarkCalculate("EnsemblePotential::calculate single precision",
+                                             parameters,
+                                             minTime,
+                                             plugin::KernelPrecision::Single));
+        results.push_back(benchmarkCalculate("EnsemblePotential::calculate recurrence",
+                                             parameters,
+                                             minTime,
+                                             plugin::KernelPrecision::Double,
+                                             plugin::GaussianEvaluation::Recurrence));
+        results.push_back(benchmarkCalculate("EnsemblePotential::calculate exp 1e-7",
+                                             parameters,
+                                             minTime,
+                                             plugin::KernelPrecision::Double,
+                                             plugin::GaussianEvaluation::Direct,
+                                             plugin::ExpAccuracy::Relative1e7));
+        results.push_back(benchmarkCalculate("EnsemblePotential::calculate exp 1e-4",
+                                             parameters,
+                                             minTime,
+                                             plugin::KernelPrecision::Double,
+                                             plugin::GaussianEvaluation::Direct,
+                                             plugin::ExpAccuracy::Relative1e4));
+        results.push_back(benchmarkWindowUpdate(parameters,
+                                                minTime));
+        results.push_back(benchmarkBlur("BlurToGrid",
+                                        parameters,
+                                        minTime));
+    }
+
+    // Exact and binned blur of large windows, with a kernel cutoff of 5 sigma.
+    std::vector<BenchmarkParameters> blurSweep;
+    if (quick)
+    {
+        blurSweep.push_back({20, 100, 2, 0.2});
+    }
+    else
+    {
+        for (const size_t nBins : {100, 500})
+        {
+            for (const unsigned int nSamples : {100u, 1000u, 10000u})
+            {
+                for (const double sigma : {0.05, 0.2})
+                {
+                    blurSweep.push_back({nBins, nSamples, 1, sigma});
+                }
+            }
+        }
+    }
+    for (const auto& parameters : blurSweep)
+    {
+        results.push_back(benchmarkBlur("BlurToGrid cutoff",
+                                        parameters,
+                                        minTime,
+                                        plugin::BlurMethod::Exact,
+                                        5.));
+        results.push_back(benchmarkBlur("BinnedBlur",
+                                        parameters,
+                                        minTime,
+                                        plugin::BlurMethod::Binned,
+                                        5.));
+        results.push_back(benchmarkBlur("Automatic blur",
+                                        parameters,
+                                        minTime,
+                                        plugin::BlurMethod::Automatic,
+                                        5.));
+    }
+    results.push_back(benchmarkHarmonic(minTime));
+
+    // Virtual dispatch against function pointers, for a cheap and a tabulated restraint.
+    const size_t numPairs = quick ? 16 : 256;
+    std::vector<std::shared_ptr<plugin::HarmonicRestraint>> harmonics;
+    for (size_t pair = 0;pair < numPairs;++pair)
+    {
+        harmonics.push_back(std::make_shared<plugin::HarmonicRestraint>(0, 1, real(1.0), real(10.0)));
+    }
+    results.push_back(benchmarkDispatch("Dispatch HarmonicRestraint",
+                                        {0, 0, 0, 0},
+                                        minTime,
+                                        harmonics));
+    {
+        const BenchmarkParameters parameters{100, 10, 4, 0.2};
+        auto params = makeParams(parameters);
+        params->tablePointsPerBin = 4;
+        plugin::ThreadEnsemble ensemble{1};
+        std::vector<std::shared_ptr<plugin::EnsembleRestraint>> restraints;
+        for (size_t pair = 0;pair < numPairs;++pair)
+        {
+            restraints.push_back(std::make_shared<plugin::EnsembleRestraint>(std::vector<int>{0, 1},
+                                                                             *params,
+                                                                             ensemble.resources(0)));
+        }
+        results.push_back(benchmarkDispatch("Dispatch EnsembleRestraint table",
+                                            parameters,
+                                            minTime,
+                                            restraints));
+    }
+
+    // Scaling of the reduction with the number of ensemble members.
+    const std::vector<size_t> ensembleSizes = quick ? std::vector<size_t>{2} : std::vector<size_t>{2, 4, 8, 16, 32, 64};
+    for (const auto members : ensembleSizes)
+    {
+        results.push_back(benchmarkThreadEnsemble({100, 10, 4, 0.2, members},
+                                                  quick ? 10 : 200));
+    }
+
+    if (output.empty())
+    {
+        writeJson(std::cout,
+                  results);
+    }
+    else
+    {
+        std::ofstream file{output};
+        writeJson(file,
+                  results);
+        if (!file)
+        {
+            std::cerr << "Could not write " << output << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
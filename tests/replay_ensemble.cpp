@@ -0,0 +1,345 @@
+//
+// Replay a pair distance time series through EnsemblePotential without GROMACS.
+//
+// Usage: gmxapi_extension_replay [--input=FILE | --steps=N] [--option=value ...]
+//
+// The distance series is read from a file with one value per MD step (the last column of each line;
+// other columns and lines starting with '#' are ignored), or generated with a reproducible random
+// walk. Each step is replayed at time step * dt through callback() and calculate(), as the restraint
+// framework would call them, with a local reduction standing in for the ensemble:
+//
+//     --reduce=single      an ensemble of one.
+//     --reduce=flat:F      a fraction F of the ensemble samples all distances equally.
+//
+// Restraint parameters are set with --nbins, --bin-width, --grid-origin, --min-dist, --max-dist, --nsamples,
+// --sample-period, --nwindows, --k, --sigma, --sigma-cutoff, --table-points-per-bin,
+// --gaussian-evaluation=direct|recurrence, --exp-accuracy=full|1e-7|1e-4, and --dt, the blur with
+// --blur=auto|exact|binned and --blur-tolerance, and the experimental distribution is read from
+// --experimental=FILE (default: uniform). --autotune=1 lets the restraint time and choose the
+// algorithms instead. --output=FILE writes the samples and histograms of every window (see
+// WindowWriter).
+//
+// The final bias histogram and the time spent in callback() and calculate() are written as JSON.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gmxapi/exceptions.h"
+
+#include "ensemblepotential.h"
+#include "sessionresources.h"
+
+using ::gmx::Vector;
+
+namespace {
+
+using Options = std::map<std::string, std::string>;
+
+Options parseOptions(int argc,
+                     char* argv[])
+{
+    Options options;
+    for (int i = 1;i < argc;++i)
+    {
+        const std::string argument{argv[i]};
+        const auto equals = argument.find('=');
+        if (argument.compare(0, 2, "--") != 0 || equals == std::string::npos)
+        {
+            throw gmxapi::ProtocolError("Expected --option=value but got " + argument);
+        }
+        options[argument.substr(2, equals - 2)] = argument.substr(equals + 1);
+    }
+    return options;
+}
+
+double getOption(const Options& options,
+                 const std::string& name,
+                 double defaultValue)
+{
+    const auto option = options.find(name);
+    return option == options.end() ? defaultValue : std::stod(option->second);
+}
+
+// Read the last value on each line that is not empty or a comment.
+std::vector<double> readColumn(const std::string& filename)
+{
+    std::ifstream file{filename};
+    if (!file)
+    {
+        throw gmxapi::ProtocolError("Could not open " + filename);
+    }
+    std::vector<double> values;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields{line};
+        double value{0};
+        bool found{false};
+        std::string field;
+        while (fields >> field && field[0] != '#')
+        {
+            value = std::stod(field);
+            found = true;
+        }
+        if (found)
+        {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+// Ornstein-Uhlenbeck walk around the center of the flat-bottom region.
+std::vector<double> synthesize(size_t steps,
+                               double dt,
+                               double minDist,
+                               double maxDist,
+                               unsigned int seed)
+{
+    const double mean = 0.5 * (minDist + maxDist);
+    const double relaxationRate{1.0};
+    const double spread = 0.25 * (maxDist - minDist);
+    std::mt19937 rng{seed};
+    std::normal_distribution<double> noise;
+
+    std::vector<double> distances(steps);
+    double R{mean};
+    for (auto& distance : distances)
+    {
+        distance = R;
+        R += relaxationRate * (mean - R) * dt + spread * sqrt(2 * relaxationRate * dt) * noise(rng);
+        R = std::max(R, 0.);
+    }
+    return distances;
+}
+
+// Local stand-in for the ensemble reduction.
+std::function<void(const plugin::Matrix<double>&, plugin::Matrix<double>*)> makeLocalReduce(const std::string& name)
+{
+    if (name == "single")
+    {
+        return [](const plugin::Matrix<double>& send, plugin::Matrix<double>* receive)
+        {
+            std::copy(send.data(), send.data() + send.cols(), receive->data());
+        };
+    }
+    if (name.compare(0, 5, "flat:") == 0)
+    {
+        const double fraction = std::stod(name.substr(5));
+        if (fraction < 0 || fraction > 1)
+        {
+            throw gmxapi::ProtocolError("--reduce=flat:F requires 0 <= F <= 1");
+        }
+        return [fraction](const plugin::Matrix<double>& send, plugin::Matrix<double>* receive)
+        {
+            double total{0};
+            for (size_t i = 0;i < send.cols();++i)
+            {
+                total += send.data()[i];
+            }
+            const double flat = total / send.cols();
+            for (size_t i = 0;i < send.cols();++i)
+            {
+                receive->data()[i] = (1 - fraction) * send.data()[i] + fraction * flat;
+            }
+        };
+    }
+    throw gmxapi::ProtocolError("Unknown reduce " + name + ". Use 'single' or 'flat:F'.");
+}
+
+int replay(const Options& options)
+{
+    const auto nBins = static_cast<size_t>(getOption(options, "nbins", 50));
+    const double binWidth = getOption(options, "bin-width", 0.1);
+    const double gridOrigin = getOption(options, "grid-origin", 0.);
+    const double minDist = getOption(options, "min-dist", 1.0);
+    const double maxDist = getOption(options, "max-dist", 4.0);
+    const double dt = getOption(options, "dt", 0.002);
+
+    std::vector<double> experimental(nBins,
+                                     1. / nBins);
+    if (options.count("experimental"))
+    {
+        experimental = plugin::experimentalOnGrid(readColumn(options.at("experimental")),
+                                                  nBins,
+                                                  binWidth,
+                                                  gridOrigin);
+    }
+
+    auto params = plugin::makeEnsembleParams(nBins,
+                                             binWidth,
+                                             minDist,
+                                             maxDist,
+                                             experimental,
+                                             static_cast<unsigned int>(getOption(options, "nsamples", 50)),
+                                             getOption(options, "sample-period", 0.1),
+                                             static_cast<unsigned int>(getOption(options, "nwindows", 4)),
+                                             getOption(options, "k", 100.),
+                                             getOption(options, "sigma", 0.2));
+    params->timeStep = dt;
+    params->gridOrigin = gridOrigin;
+    params->sigmaCutoff = getOption(options, "sigma-cutoff", params->sigmaCutoff);
+    params->tablePointsPerBin = static_cast<unsigned int>(getOption(options,
+                                                                    "table-points-per-bin",
+                                                                    params->tablePointsPerBin));
+    if (options.count("gaussian-evaluation"))
+    {
+        const auto& evaluation = options.at("gaussian-evaluation");
+        if (evaluation == "recurrence")
+        {
+            params->gaussianEvaluation = plugin::GaussianEvaluation::Recurrence;
+        }
+        else if (evaluation != "direct")
+        {
+            throw gmxapi::ProtocolError("Unknown Gaussian evaluation " + evaluation + ". Use 'direct' or 'recurrence'.");
+        }
+    }
+    if (options.count("exp-accuracy"))
+    {
+        const auto& accuracy = options.at("exp-accuracy");
+        if (accuracy == "1e-7")
+        {
+            params->expAccuracy = plugin::ExpAccuracy::Relative1e7;
+        }
+        else if (accuracy == "1e-4")
+        {
+            params->expAccuracy = plugin::ExpAccuracy::Relative1e4;
+        }
+        else if (accuracy != "full")
+        {
+            throw gmxapi::ProtocolError("Unknown exp accuracy " + accuracy + ". Use 'full', '1e-7', or '1e-4'.");
+        }
+    }
+    params->blurTolerance = getOption(options, "blur-tolerance", params->blurTolerance);
+    if (options.count("blur"))
+    {
+        const auto& blur = options.at("blur");
+        if (blur == "exact")
+        {
+            params->blurMethod = plugin::BlurMethod::Exact;
+        }
+        else if (blur == "binned")
+        {
+            params->blurMethod = plugin::BlurMethod::Binned;
+        }
+        else if (blur != "auto")
+        {
+            throw gmxapi::ProtocolError("Unknown blur " + blur + ". Use 'auto', 'exact', or 'binned'.");
+        }
+    }
+    params->autotune = getOption(options, "autotune", 0.) != 0;
+    if (options.count("output"))
+    {
+        params->outputFile = options.at("output");
+    }
+
+    std::vector<double> distances;
+    if (options.count("input"))
+    {
+        distances = readColumn(options.at("input"));
+    }
+    else
+    {
+        distances = synthesize(static_cast<size_t>(getOption(options, "steps", 100000)),
+                               dt,
+                               minDist,
+                               maxDist,
+                               static_cast<unsigned int>(getOption(options, "seed", 20180324)));
+    }
+
+    const std::string reduceName = options.count("reduce") ? options.at("reduce") : "single";
+    unsigned long numReductions{0};
+    auto localReduce = makeLocalReduce(reduceName);
+    plugin::Resources resources{[&numReductions, &localReduce](const plugin::Matrix<double>& send,
+                                                               plugin::Matrix<double>* receive)
+                                {
+                                    ++numReductions;
+                                    localReduce(send,
+                                                receive);
+                                }};
+
+    using clock = std::chrono::steady_clock;
+    std::chrono::duration<double> callbackTime{0};
+    std::chrono::duration<double> calculateTime{0};
+    unsigned long numCallbacks{0};
+    double energy{0};
+
+    plugin::EnsemblePotential restraint{*params};
+    const Vector zerovec{0, 0, 0};
+    const auto start = clock::now();
+    for (size_t step = 0;step < distances.size();++step)
+    {
+        const double t = step * dt;
+        const Vector v{static_cast<real>(distances[step]), real(0), real(0)};
+
+        if (restraint.updateDue(t))
+        {
+            const auto callbackStart = clock::now();
+            restraint.callback(v,
+                               zerovec,
+                               t,
+                               resources);
+            callbackTime += clock::now() - callbackStart;
+            ++numCallbacks;
+        }
+
+        const auto calculateStart = clock::now();
+        energy += restraint.calculate(v,
+                                      zerovec,
+                                      t).energy;
+        calculateTime += clock::now() - calculateStart;
+    }
+    const std::chrono::duration<double> totalTime = clock::now() - start;
+
+    const size_t numSteps = distances.size();
+    std::cout << "{\n";
+    std::cout << "  \"steps\": " << numSteps << ",\n";
+    std::cout << "  \"dt\": " << dt << ",\n";
+    std::cout << "  \"reduce\": \"" << reduceName << "\",\n";
+    std::cout << "  \"window_updates\": " << numReductions << ",\n";
+    std::cout << "  \"mean_energy\": " << (numSteps > 0 ? energy / numSteps : 0.) << ",\n";
+    std::cout << "  \"seconds\": " << totalTime.count() << ",\n";
+    std::cout << "  \"simulated_ps_per_second\": " << numSteps * dt / totalTime.count() << ",\n";
+    std::cout << "  \"callback\": {\"calls\": " << numCallbacks << ", \"seconds\": " << callbackTime.count()
+              << ", \"ns_per_call\": " << (numCallbacks > 0 ? 1e9 * callbackTime.count() / numCallbacks : 0.) << "},\n";
+    std::cout << "  \"calculate\": {\"calls\": " << numSteps << ", \"seconds\": " << calculateTime.count()
+              << ", \"ns_per_call\": " << (numSteps > 0 ? 1e9 * calculateTime.count() / numSteps : 0.) << "},\n";
+    std::cout << "  \"grid_origin\": " << gridOrigin << ",\n";
+    std::cout << "  \"autotune\": \"" << restraint.autotuneReport().summary() << "\",\n";
+    std::cout << "  \"histogram\": [";
+    const auto& histogram = restraint.histogram();
+    for (size_t i = 0;i < histogram.size();++i)
+    {
+        std::cout << (i == 0 ? "" : ", ") << histogram[i];
+    }
+    std::cout << "]\n}\n";
+    return 0;
+}
+
+} // end anonymous namespace
+
+int main(int argc,
+         char* argv[])
+{
+    try
+    {
+        return replay(parseOptions(argc,
+                                   argv));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,101 @@
+//
+// Check that the window updates of the ensemble restraint do not allocate.
+//
+// This program replaces the global allocation functions to count heap allocations, so it is kept
+// separate from the other tests.
+//
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "ensemblepotential.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/// Number of heap allocations made by this program.
+std::atomic<unsigned long> numAllocations{0};
+
+void* countedAllocation(std::size_t size)
+{
+    ++numAllocations;
+    if (void* block = std::malloc(size ? size : 1))
+    {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+} // end anonymous namespace
+
+void* operator new(std::size_t size)
+{
+    return countedAllocation(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return countedAllocation(size);
+}
+
+void operator delete(void* block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete[](void* block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void* block,
+                     std::size_t) noexcept
+{
+    std::free(block);
+}
+
+void operator delete[](void* block,
+                       std::size_t) noexcept
+{
+    std::free(block);
+}
+
+namespace {
+
+TEST(EnsembleAllocations, SteadyState)
+{
+    auto params = plugin::makeEnsembleParams(70, 0.1, 1.0, 6.0, std::vector<double>(70, 0.01),
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             3, // nWindows
+                                             10., 0.2);
+    params->timeStep = 1.0;
+    params->tablePointsPerBin = 4;
+
+    plugin::EnsemblePotential restraint{*params};
+    std::vector<double> window(70);
+    auto run = [&](long long first, long long end)
+    {
+        for (long long step = first;step < end;++step)
+        {
+            const double t = step;
+            if (restraint.sample(3.0 + sin(0.3 * step), t))
+            {
+                restraint.blurWindow(window.data());
+                restraint.applyWindow(window.data(), t);
+            }
+        }
+    };
+    // The first updates fill both published copies of the bias.
+    run(0, 20);
+    const unsigned long before = numAllocations;
+    ASSERT_GT(before, 0u);
+    run(20, 100);
+    EXPECT_EQ(before, numAllocations.load());
+}
+
+} // end anonymous namespace
@@ -4,11 +4,26 @@
 
 #include "testingconfiguration.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "gmxapi/exceptions.h"
+
 #include "ensemblepotential.h"
+#include "ensemblerestraintset.h"
+#include "fixedensemblepotential.h"
+#include "harmonicpotential.h"
 #include "sessionresources.h"
+#include "snapshotbuffer.h"
+#include "threadensemble.h"
 
 #include <gtest/gtest.h>
 
@@ -36,12 +51,9 @@ TEST(EnsembleHistogramPotentialPlugin, ForceCalc)
     // store temporary values long enough for inspection
     Vector force{};
 
-    /*! We need to be able to mock up a Session or otherwise get a dummy SessionResources.
-    // Get a dummy EnsembleResources. We aren't testing that here.
-    auto dummyFunc = [](const plugin::Matrix<double>&, plugin::Matrix<double>*){
-        return;};
-    auto resource = std::make_shared<plugin::EnsembleResources>(dummyFunc);
-    */
+    // Stand in for an ensemble of one. We aren't testing the ensemble here.
+    plugin::ThreadEnsemble ensemble{1};
+    auto resource = ensemble.resources(0);
 
     // Define a reference distribution with a triangular peak at the 1.0 bin.
     const std::vector<double>
@@ -71,25 +83,1443 @@ TEST(EnsembleHistogramPotentialPlugin, ForceCalc)
     ASSERT_EQ(static_cast<real>(0.0), norm(calculateForce(e1, e2, 0.)));
     ASSERT_EQ(static_cast<real>(0.0), norm(calculateForce(e1, static_cast<real>(-1)*e1, 0.)));
 
-    /* In 0.0.7, we cannot have a SessionResource without a Session. We can't
-     * really do this mock-up test in the 0.0.7 infrastructure without some
-     * colossal kludges, so we'll remove this until the new SessionResources
-     * protocol is further along.
-     * See https://github.com/kassonlab/gmxapi/issues/77
-     * See https://github.com/kassonlab/gmxapi/issues/186
-
-    // Establish a history of the atoms being 2.0 apart.
-    restraint.callback(e1, static_cast<real>(3)*e1, 0.001, *resource);
+    // Establish a history of the atoms being 2.0 apart. The first two updates set the time step.
+    for (const double t : {0., 0.001, 0.002})
+    {
+        restraint.callback(e1, static_cast<real>(3)*e1, t, *resource);
+    }
 
     // Atoms should now be driven towards each other where the difference in experimental and historic distributions is greater.
-    force = calculateForce(e1, static_cast<real>(3)*e1, 0.001);
+    force = calculateForce(e1, static_cast<real>(3)*e1, 0.002);
     ASSERT_GT(force[0], 0.) << " where force is (" << force[0] << ", " << force[1] << ", " << force[2] << ")\n";
-    force = calculateForce(static_cast<real>(3)*e1, e1, 0.001);
+    force = calculateForce(static_cast<real>(3)*e1, e1, 0.002);
     ASSERT_LT(force[0], 0.) << " where force is (" << force[0] << ", " << force[1] << ", " << force[2] << ")\n";
 
     // When input vectors are equal, output vector is meaningless and magnitude is set to zero.
-    ASSERT_EQ(static_cast<real>(0.0), norm(calculateForce(e1, e1, 0.001)));
-    */
+    ASSERT_EQ(static_cast<real>(0.0), norm(calculateForce(e1, e1, 0.002)));
+}
+
+TEST(EnsembleHistogramPotentialPlugin, BiasTable)
+{
+    // Tabulate a Gaussian bias with the width used in production restraints.
+    const double sigma{0.2};
+    auto gaussian = [sigma](double R)
+    {
+        plugin::BiasPoint point;
+        const double x{R - 4.0};
+        point.energy = exp(-0.5 * x * x / (sigma * sigma));
+        point.force = point.energy * x / (sigma * sigma);
+        point.forceDerivative = point.energy * (1. - x * x / (sigma * sigma)) / (sigma * sigma);
+        return point;
+    };
+
+    plugin::BiasTable table{1.9, 6.0, 0.01};
+    ASSERT_FALSE(table.empty());
+    table.fill(gaussian);
+
+    // Check between nodes, where the interpolation error is largest.
+    double maxForceError{0};
+    double maxEnergyError{0};
+    for (double R = 1.9; R <= 6.0; R += 0.0037)
+    {
+        const auto exact = gaussian(R);
+        const auto interpolated = table.lookup(R);
+        maxForceError = std::max(maxForceError, std::abs(exact.force - interpolated.force));
+        maxEnergyError = std::max(maxEnergyError, std::abs(exact.energy - interpolated.energy));
+    }
+    // The peak force magnitude is about 3 and the peak energy is 1.
+    EXPECT_LT(maxForceError, 1e-5);
+    EXPECT_LT(maxEnergyError, 1e-6);
+
+    // Lookups outside of the table are clamped to the end points.
+    EXPECT_DOUBLE_EQ(table.lookup(1.0).energy, table.lookup(1.9).energy);
+    EXPECT_DOUBLE_EQ(table.lookup(7.0).force, table.lookup(6.0).force);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, WindowHistory)
+{
+    const size_t nbins{3};
+    plugin::WindowHistory history{4, nbins, 7};
+    ASSERT_EQ(0u, history.size());
+
+    // Push more windows than the history holds, with values that are inexact in binary.
+    for (int n = 1; n <= 23; ++n)
+    {
+        const std::vector<double> window{0.1 * n, -0.3 * n, 1.0 / n};
+        history.push(window.data());
+        ASSERT_EQ(std::min<size_t>(n, 4), history.size());
+        // The newest window is the last one pushed.
+        EXPECT_EQ(window[1], history.window(history.size() - 1)[1]);
+
+        // The running sum matches the sum of the stored windows.
+        std::vector<double> expected(nbins, 0.);
+        for (int m = std::max(1, n - 3); m <= n; ++m)
+        {
+            expected[0] += 0.1 * m;
+            expected[1] += -0.3 * m;
+            expected[2] += 1.0 / m;
+        }
+        for (size_t i = 0; i < nbins; ++i)
+        {
+            EXPECT_NEAR(expected[i], history.sum()[i], 1e-12) << "after " << n << " windows";
+        }
+    }
+}
+
+TEST(EnsembleHistogramPotentialPlugin, ReducedWindowHistory)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    const size_t nbins{20};
+    std::vector<double> experimental(nbins, 0.);
+    experimental[5] = 1.0;
+    auto params = plugin::makeEnsembleParams(nbins, 0.5, 1.0, 9.0, experimental,
+                                             2, // nSamples
+                                             1.0, // samplePeriod
+                                             2, // nWindows
+                                             10., 0.5);
+    params->timeStep = 1.0;
+
+    // The ensemble replaces the local window with a flat distribution.
+    const double flat{1. / nbins};
+    std::vector<double> local;
+    plugin::Resources resources{[&](const plugin::Matrix<double>& send, plugin::Matrix<double>* receive)
+                                {
+                                    local.assign(send.data(), send.data() + send.cols());
+                                    std::fill(receive->data(), receive->data() + receive->cols(), flat);
+                                }};
+
+    plugin::EnsemblePotential restraint{*params};
+    for (long long step = 0;step <= 2;++step)
+    {
+        restraint.callback(static_cast<real>(3.0) * e1, zerovec, step, resources);
+    }
+    ASSERT_EQ(nbins, local.size());
+    // The local window is concentrated near 3 nm, so it differs from the reduced window.
+    EXPECT_GT(local[6], 2 * flat);
+
+    // The applied histogram is the reduced window minus the experimental distribution.
+    const auto& histogram = restraint.histogram();
+    for (size_t i = 0;i < nbins;++i)
+    {
+        EXPECT_DOUBLE_EQ(flat - experimental[i], histogram[i]) << "bin " << i;
+    }
+}
+
+TEST(EnsembleHistogramPotentialPlugin, TabulatedForceCalc)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    auto params = plugin::makeEnsembleParams(10, // nbins
+                                             1.0, // binWidth
+                                             2.0, // minDist
+                                             8.0, // maxDist
+                                             {0, 1, 0, 0, 0, 0, 0, 0, 0, 0}, // experimental
+                                             1, // nSamples
+                                             0.001, // samplePeriod
+                                             1, // nWindows
+                                             100., // k
+                                             1.0 // sigma
+                                             );
+    params->tablePointsPerBin = 10;
+    plugin::EnsemblePotential restraint{*params};
+
+    // With the initial histogram (all zeros) the tabulated force is zero inside the flat bottom.
+    EXPECT_EQ(static_cast<real>(0.0), norm(restraint.calculate(static_cast<real>(4)*e1, zerovec, 0.).force));
+    // The flat-bottom boundaries do not use the table.
+    EXPECT_LT(restraint.calculate(static_cast<real>(10)*e1, zerovec, 0.).force[0], 0.);
+    EXPECT_GT(restraint.calculate(static_cast<real>(0.5)*e1, zerovec, 0.).force[0], 0.);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, TabulatedBiasError)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    const size_t nbins{40};
+    const double binWidth{0.1};
+    const double sigma{0.2};
+    const double k{10.};
+    const unsigned int tablePointsPerBin{4};
+    std::vector<double> experimental(nbins, 0.);
+    experimental[20] = experimental[21] = 5.;
+    auto params = plugin::makeEnsembleParams(nbins, binWidth, 1.0, 3.5, experimental,
+                                             5, // nSamples
+                                             1.0, // samplePeriod
+                                             2, // nWindows
+                                             k, sigma);
+    params->timeStep = 1.0;
+    plugin::EnsemblePotential direct{*params};
+    params->tablePointsPerBin = tablePointsPerBin;
+    plugin::EnsemblePotential tabulated{*params};
+
+    std::vector<double> window(nbins);
+    for (long long step = 0;step <= 20;++step)
+    {
+        const double t = step;
+        const double R = 2.0 + 0.8 * sin(0.7 * step);
+        for (plugin::EnsemblePotential* restraint : {&direct, &tabulated})
+        {
+            if (restraint->sample(R, t))
+            {
+                restraint->blurWindow(window.data());
+                restraint->applyWindow(window.data(), t);
+            }
+        }
+    }
+    double histogramNorm{0};
+    for (const auto value : direct.histogram())
+    {
+        histogramNorm += std::abs(value);
+    }
+    ASSERT_GT(histogramNorm, 0.);
+
+    // The n-th derivative of the bias energy is bounded by k sum|h| M_n / (sqrt(2 pi) sigma^(n + 1)),
+    // where M_n is the maximum of |He_n(u) exp(-u^2 / 2)|: 3 for n = 4 and about 5.78 for n = 5.
+    // The table interpolates the energy and force with an error of h^4 / 384 times the maximum of
+    // their fourth derivatives.
+    const double h = binWidth / tablePointsPerBin;
+    const double scale = k * histogramNorm / (sqrt(2 * M_PI) * sigma) * pow(h, 4) / 384;
+    const double energyBound = scale * 3. / pow(sigma, 4);
+    const double forceBound = scale * 5.8 / pow(sigma, 5);
+
+    for (double r = 1.0;r <= 3.5;r += 0.0037)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        const auto expected = direct.calculate(position, zerovec, 20.);
+        const auto actual = tabulated.calculate(position, zerovec, 20.);
+        // Allow for rounding to real.
+        EXPECT_NEAR(expected.force[0], actual.force[0], forceBound + 1e-6 * std::abs(expected.force[0])) << "r = " << r;
+        EXPECT_NEAR(expected.energy, actual.energy, energyBound + 1e-6 * std::abs(expected.energy)) << "r = " << r;
+    }
+}
+
+TEST(EnsembleHistogramPotentialPlugin, RestraintSet)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    auto params = plugin::makeEnsembleParams(10, // nbins
+                                             1.0, // binWidth
+                                             2.0, // minDist
+                                             8.0, // maxDist
+                                             {0, 0, 0, 0.5, 0.5, 0, 0, 0, 0, 0}, // experimental
+                                             2, // nSamples
+                                             1.0, // samplePeriod
+                                             2, // nWindows
+                                             10., // k
+                                             1.0 // sigma
+                                             );
+    auto otherParams = plugin::makeEnsembleParams(12,
+                                                  0.5,
+                                                  1.0,
+                                                  5.0,
+                                                  std::vector<double>(12, 0.1),
+                                                  2,
+                                                  1.0,
+                                                  3,
+                                                  20.,
+                                                  0.5);
+
+    plugin::EnsembleRestraintSet set;
+    ASSERT_EQ(0u, set.addRestraint(*params));
+    ASSERT_EQ(1u, set.addRestraint(*otherParams));
+    EXPECT_EQ(0u, set.offset(0));
+    EXPECT_EQ(10u, set.offset(1));
+
+    // A restraint with a different window schedule cannot join the set.
+    auto mismatched = *params;
+    mismatched.nSamples = 3;
+    EXPECT_THROW(set.addRestraint(mismatched), gmxapi::ProtocolError);
+    // The set exchanges its windows with a blocking reduction, so it cannot honor a reduction lag.
+    auto lagged = *params;
+    lagged.reduceLag = 1;
+    EXPECT_THROW(set.addRestraint(lagged), gmxapi::ProtocolError);
+    EXPECT_EQ(2u, set.size());
+
+    // Reference restraints updated one at a time.
+    plugin::EnsemblePotential first{*params};
+    plugin::EnsemblePotential second{*otherParams};
+
+    // Stand in for an ensemble of one, counting the reductions.
+    unsigned int numReductions{0};
+    std::function<void(const plugin::Matrix<double>&, plugin::Matrix<double>*)> reduce =
+        [&numReductions](const plugin::Matrix<double>& send, plugin::Matrix<double>* receive)
+        {
+            ++numReductions;
+            EXPECT_EQ(send.cols(), receive->cols());
+            std::copy(send.data(), send.data() + send.cols(), receive->data());
+        };
+    plugin::ResourcesHandle ensemble;
+    ensemble.reduce_ = &reduce;
+    ensemble.session_ = nullptr;
+
+    std::vector<double> window(12);
+    for (unsigned int step = 0;step <= 12;++step)
+    {
+        const double t = step;
+        const Vector v1 = static_cast<real>(3.0 + 0.25 * step) * e1;
+        const Vector v2 = static_cast<real>(2.0 + 0.1 * step) * e1;
+
+        if (first.sample(sqrt(dot(v1, v1)), t))
+        {
+            first.blurWindow(window.data());
+            first.applyWindow(window.data(), t);
+        }
+        if (second.sample(sqrt(dot(v2, v2)), t))
+        {
+            second.blurWindow(window.data());
+            second.applyWindow(window.data(), t);
+        }
+
+        // The set only reduces once the last restraint completes its window.
+        EXPECT_FALSE(set.sample(0, v1, zerovec, t));
+        if (set.sample(1, v2, zerovec, t))
+        {
+            set.exchangeWindows(ensemble, t);
+        }
+
+        for (const auto scale : {1.5, 2.5, 4.5, 7.5})
+        {
+            const Vector position = static_cast<real>(scale) * e1;
+            EXPECT_EQ(first.calculate(position, zerovec, t).force[0],
+                      set.calculate(0, position, zerovec, t).force[0]);
+            EXPECT_EQ(second.calculate(position, zerovec, t).force[0],
+                      set.calculate(1, position, zerovec, t).force[0]);
+        }
+    }
+    // Windows end at t = 2, 4, ..., 12 with a single reduction for both restraints.
+    EXPECT_EQ(6u, numReductions);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, StepSchedule)
+{
+    auto params = plugin::makeEnsembleParams(10, 1.0, 2.0, 8.0, std::vector<double>(10, 0.),
+                                             3, // nSamples
+                                             0.01, // samplePeriod
+                                             2, 1., 1.);
+    const double dt{0.002};
+    // Long simulation times, for which floating point times cannot be compared reliably.
+    const long long firstStep{1000000000};
+
+    for (const double timeStep : {dt, 0.})
+    {
+        params->timeStep = timeStep;
+        plugin::EnsemblePotential restraint{*params};
+        std::vector<double> window(10);
+        std::vector<long long> windowSteps;
+        unsigned int numDue{0};
+        for (long long step = firstStep;step < firstStep + 100;++step)
+        {
+            const double t = step * dt;
+            if (!restraint.updateDue(t))
+            {
+                continue;
+            }
+            ++numDue;
+            if (restraint.sample(3.0, t))
+            {
+                windowSteps.push_back(step);
+                restraint.blurWindow(window.data());
+                restraint.applyWindow(window.data(), t);
+            }
+        }
+        // Samples every 5 steps and windows every 15 steps, starting from the first step.
+        ASSERT_EQ(6u, windowSteps.size());
+        for (size_t i = 0;i < windowSteps.size();++i)
+        {
+            EXPECT_EQ(firstStep + 15 * static_cast<long long>(i + 1), windowSteps[i]);
+        }
+        // Only the 19 sampling steps need the callback, plus the first step (three, to infer and
+        // confirm the time step).
+        EXPECT_EQ(timeStep > 0 ? 20u : 22u, numDue);
+    }
+
+    // An inferred time step is rejected if the first updates are not evenly spaced.
+    params->timeStep = 0.;
+    plugin::EnsemblePotential irregular{*params};
+    EXPECT_FALSE(irregular.sample(3.0, firstStep * dt));
+    EXPECT_FALSE(irregular.sample(3.0, (firstStep + 2) * dt));
+    EXPECT_TRUE(irregular.updateDue((firstStep + 3) * dt));
+    EXPECT_THROW(irregular.sample(3.0, (firstStep + 3) * dt), gmxapi::ProtocolError);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, Checkpoint)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+    const std::string filename{"ensemblepotential_checkpoint_test.cpt"};
+
+    auto params = plugin::makeEnsembleParams(20, 0.5, 1.0, 9.0, std::vector<double>(20, 0.05),
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             3, // nWindows
+                                             10., 0.7);
+    params->timeStep = 0.5;
+    params->checkpointFile = filename;
+    params->checkpointInterval = 2;
+    plugin::EnsemblePotential original{*params};
+
+    auto distance = [](long long step) { return 3.0 + 2.0 * sin(0.1 * step); };
+    auto run = [&distance](plugin::EnsemblePotential* restraint, long long first, long long end)
+    {
+        std::vector<double> window(20);
+        for (long long step = first;step < end;++step)
+        {
+            const double t = 0.5 * step;
+            if (restraint->updateDue(t) && restraint->sample(distance(step), t))
+            {
+                restraint->blurWindow(window.data());
+                restraint->applyWindow(window.data(), t);
+            }
+        }
+    };
+    // Windows end every 8 steps. The checkpoint is written at the 8th window update, in step 64.
+    run(&original, 0, 70);
+
+    auto restartParams = *params;
+    restartParams.checkpointFile.clear();
+    restartParams.restartFile = filename;
+    plugin::EnsemblePotential restarted{restartParams};
+
+    // The simulation must resume in the window that was in progress, steps 64 to 71.
+    for (long long step : {50, 63, 72})
+    {
+        plugin::EnsemblePotential mismatched{restartParams};
+        EXPECT_TRUE(mismatched.updateDue(0.5 * step));
+        EXPECT_THROW(mismatched.sample(distance(step), 0.5 * step), gmxapi::ProtocolError) << "step " << step;
+    }
+    {
+        plugin::EnsemblePotential resumed{restartParams};
+        EXPECT_NO_THROW(resumed.sample(distance(64), 32.));
+    }
+
+    // The checkpoint keeps the count of window updates since the last checkpoint, so a restarted
+    // run writes its checkpoints at the same steps. After step 73, one update (at step 72) has
+    // been made since the checkpoint at step 64, so the next is due at the update in step 80.
+    run(&original, 70, 74);
+    const std::string intervalFilename{"ensemblepotential_checkpoint_interval_test.cpt"};
+    original.writeCheckpoint(intervalFilename);
+    auto continuedParams = *params;
+    continuedParams.restartFile = intervalFilename;
+    continuedParams.checkpointFile = intervalFilename;
+    {
+        plugin::EnsemblePotential continued{continuedParams};
+        run(&continued, 74, 81);
+    }
+    run(&original, 74, 81);
+    continuedParams.checkpointFile.clear();
+    plugin::EnsemblePotential fromInterval{continuedParams};
+    for (double r = 0.5;r < 10.;r += 0.37)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        EXPECT_EQ(original.calculate(position, zerovec, 40.5).force[0],
+                  fromInterval.calculate(position, zerovec, 40.5).force[0]);
+    }
+    std::remove(intervalFilename.c_str());
+
+    // Replay the steps after the checkpoint and continue through two more windows, keeping
+    // the window that was in progress at the checkpoint in the history.
+    run(&original, 81, 90);
+    run(&restarted, 65, 90);
+    for (double r = 0.5;r < 10.;r += 0.37)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        EXPECT_EQ(original.calculate(position, zerovec, 60.).force[0],
+                  restarted.calculate(position, zerovec, 60.).force[0]);
+    }
+
+    // A checkpoint cannot be used for a restraint with a different histogram.
+    restartParams.nBins = 10;
+    restartParams.experimental.resize(10);
+    EXPECT_THROW(plugin::EnsemblePotential{restartParams}, gmxapi::ProtocolError);
+
+    std::remove(filename.c_str());
+}
+
+TEST(EnsembleHistogramPotentialPlugin, BlockingReduceFallback)
+{
+    std::function<void(const plugin::Matrix<double>&, plugin::Matrix<double>*)> reduce =
+        [](const plugin::Matrix<double>& send, plugin::Matrix<double>* receive)
+        {
+            std::copy(send.data(), send.data() + send.cols(), receive->data());
+        };
+    plugin::ResourcesHandle ensemble;
+    ensemble.reduce_ = &reduce;
+    ensemble.session_ = nullptr;
+
+    plugin::Matrix<double> send(std::vector<double>{1., 2., 3.});
+    plugin::Matrix<double> receive(1, 3);
+    // Without a non-blocking reduce, the request is complete on return.
+    auto request = ensemble.ireduce(send, &receive);
+    EXPECT_TRUE(request.test());
+    EXPECT_EQ(3., receive.data()[2]);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, WindowOutput)
+{
+    const std::string filename{"ensemblepotential_window_test.dat"};
+
+    auto params = plugin::makeEnsembleParams(10, 0.5, 1.0, 9.0, std::vector<double>(10, 0.1),
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             2, // nWindows
+                                             10., 0.7);
+    params->timeStep = 0.5;
+    params->outputFile = filename;
+    {
+        plugin::EnsemblePotential restraint{*params};
+        std::vector<double> window(10);
+        // Windows end every 8 steps, in steps 8 through 40.
+        for (long long step = 0;step <= 40;++step)
+        {
+            const double t = 0.5 * step;
+            if (restraint.updateDue(t) && restraint.sample(3.0 + 0.1 * step, t))
+            {
+                restraint.blurWindow(window.data());
+                // Stand in for an ensemble of two, in which the other member has an empty window.
+                for (auto& value : window)
+                {
+                    value *= 0.5;
+                }
+                restraint.applyWindow(window.data(), t);
+            }
+        }
+        restraint.windowWriter()->flush();
+        EXPECT_EQ(0, restraint.windowWriter()->dropped());
+        EXPECT_EQ(5, restraint.windowWriter()->written());
+    }
+
+    plugin::WindowReader reader{filename};
+    ASSERT_EQ(5, reader.size());
+    for (uint64_t window = 0;window < reader.size();++window)
+    {
+        const auto record = reader.read(window);
+        EXPECT_EQ(window, record.window);
+        EXPECT_EQ(8 * (window + 1), record.step);
+        ASSERT_EQ(4, record.samples.size());
+        EXPECT_DOUBLE_EQ(3.0 + 0.1 * 8 * (window + 1), record.samples.back());
+        ASSERT_EQ(10, record.localHistogram.size());
+        ASSERT_EQ(10, record.reducedHistogram.size());
+        ASSERT_EQ(10, record.difference.size());
+        for (size_t i = 0;i < 10;++i)
+        {
+            EXPECT_DOUBLE_EQ(0.5 * record.localHistogram[i], record.reducedHistogram[i]);
+        }
+    }
+    EXPECT_THROW(reader.read(5), gmxapi::ProtocolError);
+
+    // A restart appends, and the windows written again supersede the earlier records.
+    {
+        plugin::WindowWriter writer{filename, 10, 4, true};
+        for (uint64_t window = 3;window < 7;++window)
+        {
+            plugin::WindowRecord record;
+            record.window = window;
+            record.step = 100 + window;
+            record.samples.assign(4, 1.0);
+            record.localHistogram.assign(10, 2.0);
+            record.reducedHistogram.assign(10, 3.0);
+            record.difference.assign(10, 4.0);
+            EXPECT_TRUE(writer.push(std::move(record)));
+        }
+        // Records must have the sizes of the file.
+        plugin::WindowRecord malformed;
+        malformed.samples.assign(3, 1.0);
+        EXPECT_THROW(writer.push(std::move(malformed)), gmxapi::ProtocolError);
+        writer.flush();
+        EXPECT_FALSE(writer.failed());
+    }
+    plugin::WindowReader appended{filename};
+    ASSERT_EQ(7, appended.size());
+    EXPECT_EQ(16, appended.read(1).step);
+    EXPECT_EQ(104, appended.read(4).step);
+    EXPECT_EQ(106, appended.read(6).step);
+    EXPECT_EQ(4.0, appended.read(6).difference.back());
+
+    // The files to append to must have the same sizes.
+    EXPECT_THROW(plugin::WindowWriter(filename, 11, 4, true), gmxapi::ProtocolError);
+
+    std::remove(filename.c_str());
+    std::remove((filename + ".index").c_str());
+}
+
+TEST(EnsembleHistogramPotentialPlugin, ResourcesWithoutSession)
+{
+    // Stand in for an ensemble of one.
+    plugin::Resources resources{[](const plugin::Matrix<double>& send, plugin::Matrix<double>* receive)
+                                {
+                                    std::copy(send.data(), send.data() + send.cols(), receive->data());
+                                }};
+
+    // The reduction is available without a Session, but stopping the simulation is not.
+    auto ensemble = resources.getHandle();
+    plugin::Matrix<double> send(std::vector<double>{1., 2., 3.});
+    plugin::Matrix<double> receive(1, 3);
+    ensemble.reduce(send, &receive);
+    EXPECT_EQ(2., receive.data()[1]);
+    EXPECT_THROW(ensemble.stop(), gmxapi::ProtocolError);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, ThreadEnsemble)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    auto params = plugin::makeEnsembleParams(20, 0.5, 1.0, 9.0, std::vector<double>(20, 0.05),
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             3, // nWindows
+                                             10., 0.7);
+    params->timeStep = 1.0;
+
+    plugin::ThreadEnsemble ensemble{4};
+    std::vector<plugin::PairHist> histograms(ensemble.size());
+    ensemble.run([&](size_t member, const plugin::Resources& resources)
+                 {
+                     plugin::EnsemblePotential restraint{*params};
+                     for (long long step = 0;step < 40;++step)
+                     {
+                         const double t = step;
+                         const Vector v = static_cast<real>(3.0 + 0.5 * member + 0.1 * sin(step)) * e1;
+                         if (restraint.updateDue(t))
+                         {
+                             restraint.callback(v, zerovec, t, resources);
+                         }
+                     }
+                     histograms[member] = restraint.histogram();
+                     if (member == 2)
+                     {
+                         resources.getHandle().stop();
+                     }
+                 });
+
+    // Every member applies the same ensemble average.
+    for (size_t member = 1;member < ensemble.size();++member)
+    {
+        EXPECT_EQ(histograms[0], histograms[member]);
+    }
+    // Windows end every 4 steps, in steps 4 through 36.
+    EXPECT_EQ(9u, ensemble.statistics().reductions);
+    EXPECT_TRUE(ensemble.stopRequested());
+
+    // A member that leaves early fails the ensemble instead of deadlocking it.
+    EXPECT_THROW(ensemble.run([&](size_t member, const plugin::Resources& resources)
+                              {
+                                  if (member > 0)
+                                  {
+                                      plugin::Matrix<double> send(std::vector<double>{1., 2.});
+                                      plugin::Matrix<double> receive(1, 2);
+                                      resources.getHandle().reduce(send, &receive);
+                                  }
+                              }),
+                 gmxapi::ProtocolError);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, ExperimentalSize)
+{
+    // The experimental distribution must have a value for each bin.
+    std::vector<double> experimental(70, 0.);
+    experimental[30] = experimental[31] = 0.5;
+    auto params = plugin::makeEnsembleParams(50, 0.1, 1.0, 4.0, experimental,
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             3, // nWindows
+                                             10., 0.2);
+    EXPECT_THROW(plugin::EnsemblePotential{*params}, gmxapi::ProtocolError);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, FixedBins)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    std::vector<double> experimental(70, 0.);
+    experimental[30] = experimental[31] = 0.5;
+    auto params = plugin::makeEnsembleParams(70, 0.1, 1.0, 6.0, experimental,
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             3, // nWindows
+                                             10., 0.2);
+    params->timeStep = 1.0;
+    params->gridOrigin = 0.5;
+
+    plugin::EnsemblePotential reference{*params};
+    plugin::FixedEnsemblePotential<70> fixed{*params};
+
+    auto compare = [&](double t)
+    {
+        for (double r = 0.5;r < 7.;r += 0.13)
+        {
+            const Vector position = static_cast<real>(r) * e1;
+            const auto expected = reference.calculate(position, zerovec, t);
+            const auto actual = fixed.calculate(position, zerovec, t);
+            EXPECT_NEAR(expected.force[0], actual.force[0], 1e-5 * std::abs(expected.force[0]) + 1e-6) << "r = " << r;
+            EXPECT_NEAR(expected.energy, actual.energy, 1e-5 * std::abs(expected.energy) + 1e-6) << "r = " << r;
+        }
+    };
+
+    std::vector<double> window(70);
+    real maxForce{0};
+    for (long long step = 0;step <= 24;++step)
+    {
+        const double t = step;
+        const double R = 3.0 + sin(0.3 * step);
+        if (reference.sample(R, t))
+        {
+            reference.blurWindow(window.data());
+            reference.applyWindow(window.data(), t);
+        }
+        if (fixed.sample(R, t))
+        {
+            fixed.blurWindow(window.data());
+            fixed.applyWindow(window.data(), t);
+            // The copy of the histogram follows each update.
+            compare(t);
+        }
+        maxForce = std::max(maxForce, std::abs(fixed.calculate(static_cast<real>(R) * e1, zerovec, t).force[0]));
+    }
+    EXPECT_GT(maxForce, 0.f);
+
+    // The bin count must match the template parameter.
+    EXPECT_THROW(plugin::FixedEnsemblePotential<50>{*params}, gmxapi::ProtocolError);
+
+    // Run-time bin counts are dispatched to the supported specializations only.
+    size_t dispatched{0};
+    EXPECT_TRUE(plugin::dispatchFixedBins(70, [&dispatched](auto nBins) { dispatched = nBins; }));
+    EXPECT_EQ(70u, dispatched);
+    EXPECT_FALSE(plugin::dispatchFixedBins(71, [&dispatched](auto nBins) { dispatched = nBins; }));
+}
+
+TEST(EnsembleHistogramPotentialPlugin, SinglePrecision)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    std::vector<double> experimental(70, 0.);
+    experimental[30] = experimental[31] = 0.5;
+    auto params = plugin::makeEnsembleParams(70, 0.1, 1.0, 6.0, experimental,
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             3, // nWindows
+                                             10., 0.2);
+    params->timeStep = 1.0;
+
+    plugin::EnsemblePotential reference{*params};
+    params->kernelPrecision = plugin::KernelPrecision::Single;
+    plugin::EnsemblePotential single{*params};
+
+    std::vector<double> window(70);
+    for (long long step = 0;step <= 24;++step)
+    {
+        const double t = step;
+        const double R = 3.0 + sin(0.3 * step);
+        for (plugin::EnsemblePotential* restraint : {&reference, &single})
+        {
+            if (restraint->sample(R, t))
+            {
+                restraint->blurWindow(window.data());
+                restraint->applyWindow(window.data(), t);
+            }
+        }
+    }
+
+    // Forces are compared to the largest force, since the bias force crosses zero.
+    double maxForce{0};
+    for (double r = 1.0;r < 6.;r += 0.05)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        maxForce = std::max(maxForce, static_cast<double>(std::abs(reference.calculate(position, zerovec, 24.).force[0])));
+    }
+    double maxError{0};
+    for (double r = 0.5;r < 7.;r += 0.05)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        const auto expected = reference.calculate(position, zerovec, 24.);
+        const auto actual = single.calculate(position, zerovec, 24.);
+        EXPECT_NEAR(expected.force[0], actual.force[0], 1e-5 * maxForce) << "r = " << r;
+        maxError = std::max(maxError, std::abs(expected.force[0] - actual.force[0]) / maxForce);
+    }
+    std::cout << "Single precision bias force error relative to the largest force: " << maxError << std::endl;
+}
+
+TEST(EnsembleHistogramPotentialPlugin, AlignedWindowStorage)
+{
+    plugin::AlignedArena arena{plugin::AlignedArena::bytesFor<double>(3) + plugin::AlignedArena::bytesFor<double>(10)};
+    plugin::Matrix<double> first(1, 3, &arena);
+    plugin::Matrix<double> second(2, 5, &arena);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(first.data()) % plugin::AlignedArena::alignment);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(second.data()) % plugin::AlignedArena::alignment);
+    EXPECT_EQ(0., second.data()[9]);
+    EXPECT_EQ(arena.capacity(), arena.used());
+    EXPECT_THROW(plugin::Matrix<double>(1, 1, &arena), gmxapi::ProtocolError);
+
+    // Assigning a matrix of the same size copies the values into the arena storage.
+    const double* storage = first.data();
+    const plugin::Matrix<double> values(std::vector<double>{1., 2., 3.});
+    first = values;
+    EXPECT_EQ(storage, first.data());
+    EXPECT_EQ(2., first.data()[1]);
+
+    // Copies own their values.
+    plugin::Matrix<double> copy{second};
+    copy.data()[0] = 4.;
+    EXPECT_EQ(0., second.data()[0]);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, ExponentialAveraging)
+{
+    // Same mean window age as a sliding window of 3, i.e. weight 1/2 after two windows.
+    plugin::ExponentialAverage average{3, 2};
+    EXPECT_DOUBLE_EQ(0.5, average.weight());
+    const double windows[4][2] = {{4., 0.}, {2., 2.}, {4., 2.}, {0., 2.}};
+    const double expected[4] = {4., 3., 3.5, 1.75};
+    for (int n = 0;n < 4;++n)
+    {
+        average.push(windows[n]);
+        EXPECT_DOUBLE_EQ(expected[n], average.mean()[0]) << "after " << n + 1 << " windows";
+    }
+    EXPECT_DOUBLE_EQ(1.75, average.mean()[1]);
+
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+    const std::string filename{"ensemblepotential_exponential_test.cpt"};
+    auto params = plugin::makeEnsembleParams(20, 0.5, 1.0, 9.0, std::vector<double>(20, 0.05),
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             1, // nWindows
+                                             10., 0.7);
+    params->timeStep = 1.0;
+    auto run = [](plugin::EnsemblePotential* restraint, long long first, long long end)
+    {
+        std::vector<double> window(20);
+        for (long long step = first;step < end;++step)
+        {
+            const double t = step;
+            if (restraint->sample(3.0 + 2.0 * sin(0.1 * step), t))
+            {
+                restraint->blurWindow(window.data());
+                restraint->applyWindow(window.data(), t);
+            }
+        }
+    };
+
+    // With one window, both averages use only the latest window.
+    plugin::EnsemblePotential sliding{*params};
+    params->averaging = plugin::WindowAveraging::Exponential;
+    plugin::EnsemblePotential exponential{*params};
+    run(&sliding, 0, 30);
+    run(&exponential, 0, 30);
+    for (size_t i = 0;i < 20;++i)
+    {
+        EXPECT_NEAR(sliding.histogram()[i], exponential.histogram()[i], 1e-15);
+    }
+
+    // The running average is checkpointed. The last checkpoint is written at the window update in step 28.
+    params->nWindows = 5;
+    params->checkpointFile = filename;
+    plugin::EnsemblePotential original{*params};
+    run(&original, 0, 30);
+    auto restartParams = *params;
+    restartParams.checkpointFile.clear();
+    restartParams.restartFile = filename;
+    plugin::EnsemblePotential restarted{restartParams};
+    run(&original, 30, 50);
+    run(&restarted, 29, 50);
+    for (double r = 0.5;r < 10.;r += 0.37)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        EXPECT_EQ(original.calculate(position, zerovec, 50.).force[0],
+                  restarted.calculate(position, zerovec, 50.).force[0]);
+    }
+    restartParams.averaging = plugin::WindowAveraging::Sliding;
+    EXPECT_THROW(plugin::EnsemblePotential{restartParams}, gmxapi::ProtocolError);
+
+    std::remove(filename.c_str());
+}
+
+TEST(EnsembleHistogramPotentialPlugin, BinnedBlur)
+{
+    const double sigma{0.2};
+    const double sigmaCutoff{5};
+    auto params = plugin::makeEnsembleParams(60, 0.1, 1.0, 5.0, std::vector<double>(60, 0.),
+                                             2000, // nSamples
+                                             1.0, // samplePeriod
+                                             2, // nWindows
+                                             10., sigma);
+    params->timeStep = 1.0;
+    params->gridOrigin = 0.5;
+    params->sigmaCutoff = sigmaCutoff;
+    params->blurMethod = plugin::BlurMethod::Exact;
+    plugin::EnsemblePotential exact{*params};
+    params->blurMethod = plugin::BlurMethod::Binned;
+    plugin::EnsemblePotential binned{*params};
+
+    // Samples spread over and beyond the grid, which spans [0.5, 6.4].
+    std::vector<double> exactWindow(60);
+    std::vector<double> binnedWindow(60);
+    for (long long step = 0;step <= 2000;++step)
+    {
+        const double R = 3.5 + 3.4 * sin(0.37 * step);
+        const bool complete = exact.sample(R, step);
+        ASSERT_EQ(complete, binned.sample(R, step));
+        if (complete)
+        {
+            exact.blurWindow(exactWindow.data());
+            binned.blurWindow(binnedWindow.data());
+        }
+    }
+
+    plugin::BinnedBlur blur{0.5, 0.1, 60, sigma, sigmaCutoff * sigma, 1e-5};
+    EXPECT_LE(blur.errorBound(), 1e-5 + exp(-sigmaCutoff * sigmaCutoff / 2));
+    const double tolerance = blur.errorBound() / sqrt(2 * M_PI * sigma * sigma);
+    double maxError{0};
+    for (size_t i = 0;i < exactWindow.size();++i)
+    {
+        EXPECT_NEAR(exactWindow[i], binnedWindow[i], tolerance) << "bin " << i;
+        maxError = std::max(maxError, std::abs(exactWindow[i] - binnedWindow[i]));
+    }
+    std::cout << "Binned blur with " << blur.subdivisions() << " subdivisions: max error " << maxError
+              << ", bound " << tolerance << std::endl;
+
+    // The binned blur only pays off for many samples per bin, and needs a kernel cutoff.
+    EXPECT_FALSE(blur.fasterThanExact(10));
+    EXPECT_TRUE(blur.fasterThanExact(100000));
+    params->sigmaCutoff = 0;
+    EXPECT_THROW(plugin::EnsemblePotential{*params}, gmxapi::ProtocolError);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, GaussianRecurrence)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    auto params = plugin::makeEnsembleParams(70, 0.1, 2.0, 6.0, std::vector<double>(70, 0.01),
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             3, // nWindows
+                                             10., 0.2);
+    params->timeStep = 1.0;
+    plugin::EnsemblePotential direct{*params};
+    params->gaussianEvaluation = plugin::GaussianEvaluation::Recurrence;
+    plugin::EnsemblePotential recurrence{*params};
+
+    std::vector<double> directWindow(70);
+    std::vector<double> recurrenceWindow(70);
+    for (long long step = 0;step <= 24;++step)
+    {
+        const double t = step;
+        const double R = 4.0 + 1.5 * sin(0.3 * step);
+        const bool complete = direct.sample(R, t);
+        ASSERT_EQ(complete, recurrence.sample(R, t));
+        if (complete)
+        {
+            direct.blurWindow(directWindow.data());
+            recurrence.blurWindow(recurrenceWindow.data());
+            for (size_t i = 0;i < directWindow.size();++i)
+            {
+                EXPECT_NEAR(directWindow[i], recurrenceWindow[i], 1e-12 * directWindow[i] + 1e-300);
+            }
+            // Apply the same window to both, so that the bias comparison below is independent of the blur.
+            direct.applyWindow(directWindow.data(), t);
+            recurrence.applyWindow(directWindow.data(), t);
+        }
+    }
+
+    for (double r = 0.5;r < 7.5;r += 0.07)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        const auto expected = direct.calculate(position, zerovec, 24.);
+        const auto actual = recurrence.calculate(position, zerovec, 24.);
+        EXPECT_NEAR(expected.force[0], actual.force[0], 1e-12 * (std::abs(expected.force[0]) + 1)) << "r = " << r;
+        EXPECT_NEAR(expected.energy, actual.energy, 1e-12 * (std::abs(expected.energy) + 1)) << "r = " << r;
+    }
+
+    params->kernelPrecision = plugin::KernelPrecision::Single;
+    EXPECT_THROW(plugin::EnsemblePotential{*params}, gmxapi::ProtocolError);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, Autotune)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+    const double sigma{0.2};
+
+    auto params = plugin::makeEnsembleParams(60, 0.1, 1.0, 5.0, std::vector<double>(60, 0.01),
+                                             400, // nSamples
+                                             1.0, // samplePeriod
+                                             2, // nWindows
+                                             10., sigma);
+    params->timeStep = 1.0;
+    params->sigmaCutoff = 5;
+    plugin::EnsemblePotential reference{*params};
+    EXPECT_TRUE(reference.autotuneReport().summary().empty());
+    params->autotune = true;
+    plugin::EnsemblePotential tuned{*params};
+
+    // Every applicable candidate is timed, and the fastest is chosen.
+    const auto& report = tuned.autotuneReport();
+    ASSERT_EQ(3u, report.blur.size());
+    ASSERT_EQ(2u, report.bias.size());
+    const auto chosen = [](const std::vector<plugin::AutotuneReport::Timing>& timings, const std::string& name)
+    {
+        return std::find_if(timings.begin(), timings.end(),
+                            [&name](const plugin::AutotuneReport::Timing& timing) { return timing.name == name; });
+    };
+    ASSERT_NE(report.blur.end(), chosen(report.blur, report.chosenBlur));
+    ASSERT_NE(report.bias.end(), chosen(report.bias, report.chosenBias));
+    for (const auto& timing : report.blur)
+    {
+        EXPECT_GT(timing.nanoseconds, 0.);
+        EXPECT_LE(chosen(report.blur, report.chosenBlur)->nanoseconds, timing.nanoseconds);
+    }
+    std::cout << report.summary() << std::endl;
+
+    // Whichever candidates win, the results agree within the accuracy of the binned blur.
+    plugin::BinnedBlur blur{0., 0.1, 60, sigma, 5 * sigma, params->blurTolerance};
+    const double tolerance = blur.errorBound() / sqrt(2 * M_PI * sigma * sigma);
+    std::vector<double> referenceWindow(60);
+    std::vector<double> tunedWindow(60);
+    for (long long step = 0;step <= 400;++step)
+    {
+        const double R = 3.0 + 2.5 * sin(0.37 * step);
+        const bool complete = reference.sample(R, step);
+        ASSERT_EQ(complete, tuned.sample(R, step));
+        if (complete)
+        {
+            reference.blurWindow(referenceWindow.data());
+            tuned.blurWindow(tunedWindow.data());
+            for (size_t i = 0;i < referenceWindow.size();++i)
+            {
+                EXPECT_NEAR(referenceWindow[i], tunedWindow[i], tolerance) << "bin " << i;
+            }
+            reference.applyWindow(referenceWindow.data(), step);
+            tuned.applyWindow(referenceWindow.data(), step);
+        }
+    }
+    for (double r = 0.5;r < 6.;r += 0.07)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        const auto expected = reference.calculate(position, zerovec, 400.);
+        const auto actual = tuned.calculate(position, zerovec, 400.);
+        EXPECT_NEAR(expected.force[0], actual.force[0], 1e-9 * (std::abs(expected.force[0]) + 1)) << "r = " << r;
+    }
+
+    // A requested bias table is a candidate, with its rebuild cost spread over the window.
+    params->tablePointsPerBin = 8;
+    plugin::EnsemblePotential tabulated{*params};
+    EXPECT_EQ(3u, tabulated.autotuneReport().bias.size());
+    EXPECT_EQ("table", tabulated.autotuneReport().bias.back().name);
+
+    // A restart reuses the decision saved in the checkpoint instead of timing the candidates again.
+    const std::string filename{"ensemblepotential_autotune_test.cpt"};
+    tabulated.writeCheckpoint(filename);
+    auto restartParams = *params;
+    restartParams.restartFile = filename;
+    plugin::EnsemblePotential restarted{restartParams};
+    const auto& restored = restarted.autotuneReport();
+    EXPECT_TRUE(restored.restored);
+    EXPECT_TRUE(restored.blur.empty());
+    EXPECT_TRUE(restored.bias.empty());
+    EXPECT_EQ(tabulated.autotuneReport().chosenBlur, restored.chosenBlur);
+    EXPECT_EQ(tabulated.autotuneReport().chosenBias, restored.chosenBias);
+    for (double r = 0.5;r < 6.;r += 0.07)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        EXPECT_EQ(tabulated.calculate(position, zerovec, 0.).force[0],
+                  restarted.calculate(position, zerovec, 0.).force[0]) << "r = " << r;
+    }
+
+    // Without a time step, the table cannot be timed against the direct sums and is kept.
+    auto untimedParams = *params;
+    untimedParams.timeStep = 0;
+    plugin::EnsemblePotential untimed{untimedParams};
+    EXPECT_EQ(2u, untimed.autotuneReport().bias.size());
+    EXPECT_EQ("table (untimed)", untimed.autotuneReport().chosenBias);
+
+    // The saved decision must be available with the parameters of the restart.
+    untimed.writeCheckpoint(filename);
+    restartParams.tablePointsPerBin = 0;
+    EXPECT_THROW(plugin::EnsemblePotential{restartParams}, gmxapi::ProtocolError);
+    // Unless the restart does not autotune, in which case its own parameters apply.
+    restartParams.autotune = false;
+    plugin::EnsemblePotential untuned{restartParams};
+    EXPECT_TRUE(untuned.autotuneReport().summary().empty());
+    std::remove(filename.c_str());
+}
+
+TEST(EnsembleHistogramPotentialPlugin, StepCache)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    std::vector<double> experimental(70, 0.);
+    experimental[30] = experimental[31] = 0.5;
+    auto params = plugin::makeEnsembleParams(70, 0.1, 1.0, 6.0, experimental,
+                                             2, // nSamples
+                                             1.0, // samplePeriod
+                                             2, // nWindows
+                                             10., 0.2);
+    params->timeStep = 1.0;
+    plugin::ThreadEnsemble referenceEnsemble{1};
+    plugin::ThreadEnsemble ensemble{1};
+    plugin::EnsemblePotential reference{*params};
+    plugin::EnsembleRestraint restraint{{0, 1}, *params, ensemble.resources(0)};
+
+    // As GROMACS calls them: evaluate() may run before and several times after update() in a step.
+    const long long numSteps{12};
+    for (long long step = 0;step < numSteps;++step)
+    {
+        const double t = step;
+        const Vector v = static_cast<real>(3.0 + sin(0.7 * step)) * e1;
+        const auto before = reference.calculate(v, zerovec, t);
+        EXPECT_EQ(before.force[0], restraint.evaluate(v, zerovec, t).force[0]) << "step " << step;
+
+        // The bias changes when a window completes, so the force cached before update() is not reused.
+        reference.callback(v, zerovec, t, *referenceEnsemble.resources(0));
+        restraint.update(v, zerovec, t);
+        const auto after = reference.calculate(v, zerovec, t);
+        for (int repeat = 0;repeat < 2;++repeat)
+        {
+            const auto actual = restraint.evaluate(v, zerovec, t);
+            EXPECT_EQ(after.force[0], actual.force[0]) << "step " << step;
+            EXPECT_EQ(after.energy, actual.energy) << "step " << step;
+        }
+        // Other positions at the same time are evaluated.
+        const Vector w = static_cast<real>(2.5) * e1;
+        EXPECT_EQ(reference.calculate(w, zerovec, t).force[0], restraint.evaluate(w, zerovec, t).force[0]);
+    }
+    EXPECT_EQ(static_cast<uint64_t>(4 * numSteps), restraint.evaluations());
+    // The second evaluation after update() is always a hit, and the first unless update() sampled the distance.
+    EXPECT_GE(restraint.cacheHits(), static_cast<uint64_t>(numSteps));
+    EXPECT_LT(restraint.cacheHits(), static_cast<uint64_t>(2 * numSteps));
+    // Every window update published a new bias.
+    EXPECT_GT(reference.biasGeneration(), static_cast<uint64_t>(numSteps / 4));
+
+    // A force computed with the previous bias can be stored after the update, by an evaluate() that
+    // overlapped it. It keeps its generation, so it is not returned for the new bias.
+    plugin::StepCache cache;
+    plugin::StepCache::Entry stale;
+    stale.R = 3.;
+    stale.hasResult = true;
+    stale.generation = 1;
+    stale.result.energy = 1.;
+    cache.store(e1, zerovec, 5., stale);
+    plugin::StepCache::Entry entry;
+    ASSERT_TRUE(cache.find(e1, zerovec, 5., 2, &entry));
+    EXPECT_FALSE(entry.hasResult);
+    EXPECT_EQ(3., entry.R);
+    ASSERT_TRUE(cache.find(e1, zerovec, 5., 1, &entry));
+    EXPECT_TRUE(entry.hasResult);
+    EXPECT_EQ(1., entry.result.energy);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, PairEvaluator)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    std::vector<double> experimental(70, 0.);
+    experimental[30] = experimental[31] = 0.5;
+    auto params = plugin::makeEnsembleParams(70, 0.1, 1.0, 6.0, experimental,
+                                             2, // nSamples
+                                             1.0, // samplePeriod
+                                             2, // nWindows
+                                             10., 0.2);
+    params->timeStep = 1.0;
+    plugin::ThreadEnsemble ensemble{1};
+
+    // Restraints of two types, in runs of different lengths.
+    std::vector<std::unique_ptr<gmx::IRestraintPotential>> restraints;
+    std::vector<plugin::PairEvaluator> evaluators;
+    for (size_t pair = 0;pair < 7;++pair)
+    {
+        if (pair % 3 == 2)
+        {
+            auto restraint = std::make_unique<plugin::HarmonicRestraint>(0,
+                                                                         1,
+                                                                         real(2.0),
+                                                                         real(10.0));
+            evaluators.push_back(restraint->pairEvaluator());
+            restraints.push_back(std::move(restraint));
+        }
+        else
+        {
+            auto restraint = std::make_unique<plugin::EnsembleRestraint>(std::vector<int>{0, 1},
+                                                                         *params,
+                                                                         ensemble.resources(0));
+            evaluators.push_back(restraint->pairEvaluator());
+            restraints.push_back(std::move(restraint));
+        }
+    }
+
+    std::vector<Vector> r1;
+    const std::vector<Vector> r2(restraints.size(), zerovec);
+    for (size_t pair = 0;pair < restraints.size();++pair)
+    {
+        r1.push_back(static_cast<real>(0.5 + pair) * e1);
+    }
+    std::vector<gmx::PotentialPointData> batch(restraints.size());
+    for (long long step = 0;step < 6;++step)
+    {
+        for (size_t pair = 0;pair < restraints.size();++pair)
+        {
+            restraints[pair]->update(r1[pair], r2[pair], step);
+        }
+        // Evaluate at a later time, so that the results are not served from the step cache.
+        plugin::evaluatePairs(evaluators.data(), r1.data(), r2.data(), restraints.size(), step + 0.5, batch.data());
+        for (size_t pair = 0;pair < restraints.size();++pair)
+        {
+            const auto single = evaluators[pair](r1[pair], r2[pair], step + 0.25);
+            const auto expected = restraints[pair]->evaluate(r1[pair], r2[pair], step + 0.75);
+            EXPECT_EQ(expected.force[0], single.force[0]) << "pair " << pair;
+            EXPECT_EQ(expected.force[0], batch[pair].force[0]) << "pair " << pair;
+            EXPECT_EQ(expected.energy, batch[pair].energy) << "pair " << pair;
+        }
+    }
+}
+
+TEST(EnsembleHistogramPotentialPlugin, GridOrigin)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    // Reference grid from zero distance, and a grid of the bins from 1.0 nm.
+    std::vector<double> experimental(70, 0.);
+    experimental[30] = experimental[31] = 0.5;
+    auto params = plugin::makeEnsembleParams(70, 0.1, 2.0, 6.0, experimental,
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             3, // nWindows
+                                             10., 0.2);
+    params->timeStep = 1.0;
+    plugin::EnsemblePotential reference{*params};
+
+    params->nBins = 60;
+    params->gridOrigin = 1.0;
+    params->experimental = plugin::experimentalOnGrid(experimental, 60, 0.1, 1.0);
+    ASSERT_EQ(60u, params->experimental.size());
+    EXPECT_EQ(0.5, params->experimental[20]);
+    plugin::EnsemblePotential offset{*params};
+    EXPECT_THROW(plugin::experimentalOnGrid(experimental, 60, 0.1, 1.05), gmxapi::ProtocolError);
+    EXPECT_THROW(plugin::experimentalOnGrid(experimental, 50, 0.1, 1.0), gmxapi::ProtocolError);
+
+    std::vector<double> window(70);
+    for (long long step = 0;step <= 24;++step)
+    {
+        const double t = step;
+        const double R = 4.0 + sin(0.3 * step);
+        for (plugin::EnsemblePotential* restraint : {&reference, &offset})
+        {
+            if (restraint->sample(R, t))
+            {
+                restraint->blurWindow(window.data());
+                restraint->applyWindow(window.data(), t);
+            }
+        }
+    }
+    for (size_t i = 0;i < 60;++i)
+    {
+        EXPECT_NEAR(reference.histogram()[i + 10], offset.histogram()[i], 1e-12) << "bin " << i;
+    }
+
+    // The bins below 1.0 nm are far from the flat-bottom interior, so they do not contribute to the force.
+    for (double r = 0.5;r < 7.;r += 0.13)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        const auto expected = reference.calculate(position, zerovec, 24.);
+        const auto actual = offset.calculate(position, zerovec, 24.);
+        EXPECT_NEAR(expected.force[0], actual.force[0], 1e-6 * std::abs(expected.force[0]) + 1e-6) << "r = " << r;
+    }
+}
+
+TEST(EnsembleHistogramPotentialPlugin, SigmaCutoff)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    // Grid points from 1.0 to 4.9 nm, with a cutoff short enough for the truncation to show.
+    const size_t nbins{40};
+    const double binWidth{0.1};
+    const double sigma{0.2};
+    const double k{10.};
+    const double sigmaCutoff{3.};
+    std::vector<double> experimental(nbins, 0.);
+    experimental[3] = experimental[36] = 0.5;
+    auto params = plugin::makeEnsembleParams(nbins, binWidth, 0.6, 5.4, experimental,
+                                             6, // nSamples
+                                             1.0, // samplePeriod
+                                             1, // nWindows
+                                             k, sigma);
+    params->timeStep = 1.0;
+    params->gridOrigin = 1.0;
+    params->blurMethod = plugin::BlurMethod::Exact;
+    plugin::EnsemblePotential full{*params};
+    params->sigmaCutoff = sigmaCutoff;
+    plugin::EnsemblePotential truncated{*params};
+
+    // Samples near and beyond both ends of the grid.
+    const std::vector<double> samples{0.7, 0.95, 1.02, 4.88, 4.95, 5.3};
+    std::vector<double> fullWindow(nbins);
+    std::vector<double> truncatedWindow(nbins);
+    for (long long step = 0;step <= 6;++step)
+    {
+        const double R = samples[std::max(step - 1, 0LL)];
+        const bool fullDone = full.sample(R, step);
+        ASSERT_EQ(fullDone, truncated.sample(R, step));
+        if (fullDone)
+        {
+            full.blurWindow(fullWindow.data());
+            truncated.blurWindow(truncatedWindow.data());
+            // Compare the bias for the same histogram.
+            full.applyWindow(fullWindow.data(), step);
+            truncated.applyWindow(fullWindow.data(), step);
+        }
+    }
+
+    // Each blurred value neglects terms smaller than exp(-c^2 / 2) of the normalized peak.
+    const double blurBound = exp(-0.5 * sigmaCutoff * sigmaCutoff) / (sqrt(2 * M_PI) * sigma);
+    double maxBlurError{0};
+    for (size_t i = 0;i < nbins;++i)
+    {
+        const double error = std::abs(fullWindow[i] - truncatedWindow[i]);
+        EXPECT_LE(error, blurBound) << "bin " << i;
+        maxBlurError = std::max(maxBlurError, error);
+    }
+    // The cutoff is in effect.
+    EXPECT_GT(maxBlurError, 0.);
+
+    double maxHistogram{0};
+    for (size_t i = 0;i < nbins;++i)
+    {
+        ASSERT_EQ(full.histogram()[i], truncated.histogram()[i]);
+        maxHistogram = std::max(maxHistogram, std::abs(full.histogram()[i]));
+    }
+    // The bound on the neglected bias force documented for sigmaCutoff.
+    const double forceBound = 2 * k * maxHistogram * exp(-0.5 * sigmaCutoff * sigmaCutoff)
+        * (sigmaCutoff + sigma / binWidth) / (sqrt(2 * M_PI) * sigma * sigma);
+    // Pair distances throughout the flat-bottom region, which extends beyond both ends of the grid.
+    for (double r = 0.6;r <= 5.4;r += 0.017)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        const auto expected = full.calculate(position, zerovec, 6.);
+        const auto actual = truncated.calculate(position, zerovec, 6.);
+        EXPECT_NEAR(expected.force[0], actual.force[0], forceBound) << "r = " << r;
+    }
+}
+
+TEST(EnsembleHistogramPotentialPlugin, SnapshotBuffer)
+{
+    // Readers must only ever see fully published states, in which every element is the same.
+    plugin::SnapshotBuffer<std::vector<int>> buffer;
+    buffer.back().assign(100, 0);
+    buffer.publish();
+
+    std::atomic<bool> done{false};
+    std::atomic<unsigned long> torn{0};
+    std::vector<std::thread> readers;
+    for (int thread = 0;thread < 3;++thread)
+    {
+        readers.emplace_back([&]()
+                             {
+                                 while (!done)
+                                 {
+                                     const auto snapshot = buffer.read();
+                                     const auto first = snapshot->front();
+                                     for (const auto value : *snapshot)
+                                     {
+                                         if (value != first)
+                                         {
+                                             ++torn;
+                                         }
+                                     }
+                                 }
+                             });
+    }
+    for (int generation = 1;generation < 2000;++generation)
+    {
+        buffer.back().assign(100, generation);
+        buffer.publish();
+    }
+    done = true;
+    for (auto& reader : readers)
+    {
+        reader.join();
+    }
+    EXPECT_EQ(0u, torn.load());
+    EXPECT_EQ(1999, buffer.read()->front());
+}
+
+TEST(EnsembleHistogramPotentialPlugin, ConcurrentCalculate)
+{
+    const Vector zerovec = {0, 0, 0};
+    const Vector e1{real(1), real(0), real(0)};
+
+    std::vector<double> experimental(70, 0.);
+    experimental[30] = experimental[31] = 0.5;
+    auto params = plugin::makeEnsembleParams(70, 0.1, 1.0, 6.0, experimental,
+                                             4, // nSamples
+                                             1.0, // samplePeriod
+                                             3, // nWindows
+                                             10., 0.2);
+    params->timeStep = 1.0;
+    params->tablePointsPerBin = 4;
+
+    plugin::EnsemblePotential reference{*params};
+    plugin::EnsemblePotential restraint{*params};
+
+    // Evaluate forces on other threads while the bias is updated.
+    std::atomic<bool> done{false};
+    std::atomic<unsigned long> invalid{0};
+    std::vector<std::thread> threads;
+    for (int thread = 0;thread < 3;++thread)
+    {
+        threads.emplace_back([&, thread]()
+                             {
+                                 double r{1.0 + 0.1 * thread};
+                                 while (!done)
+                                 {
+                                     const Vector position = static_cast<real>(r) * e1;
+                                     const auto force = restraint.calculate(position, zerovec, 0.).force[0];
+                                     if (!std::isfinite(force))
+                                     {
+                                         ++invalid;
+                                     }
+                                     r = r > 6.0 ? 1.0 : r + 0.37;
+                                 }
+                             });
+    }
+
+    std::vector<double> window(70);
+    for (long long step = 0;step <= 400;++step)
+    {
+        const double t = step;
+        const double R = 3.0 + sin(0.3 * step);
+        for (plugin::EnsemblePotential* potential : {&reference, &restraint})
+        {
+            if (potential->sample(R, t))
+            {
+                potential->blurWindow(window.data());
+                potential->applyWindow(window.data(), t);
+            }
+        }
+    }
+    done = true;
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(0u, invalid.load());
+
+    // The concurrent reads did not disturb the updates.
+    for (double r = 0.5;r < 7.;r += 0.13)
+    {
+        const Vector position = static_cast<real>(r) * e1;
+        const auto expected = reference.calculate(position, zerovec, 400.);
+        EXPECT_EQ(expected.force[0], restraint.calculate(position, zerovec, 400.).force[0]) << "r = " << r;
+    }
 }
 
 } // end anonymous namespace
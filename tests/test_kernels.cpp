@@ -0,0 +1,349 @@
+//
+// Check the vectorized Gaussian kernels against the scalar implementation.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "kernels.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+TEST(GaussianKernels, Selection)
+{
+    const auto available = plugin::availableGaussianKernels();
+    ASSERT_FALSE(available.empty());
+    EXPECT_EQ(plugin::SimdLevel::None, available.front()->level);
+
+    // The selected kernels must be runnable on this host.
+    const auto& selected = plugin::gaussianKernels();
+    bool found{false};
+    for (const auto kernels : available)
+    {
+        found = found || (kernels == &selected);
+    }
+    EXPECT_TRUE(found) << "selected " << selected.name;
+}
+
+TEST(GaussianKernels, Accumulate)
+{
+    const auto available = plugin::availableGaussianKernels();
+    const auto& reference = *available.front();
+
+    // Production grid: 70 bins of width 0.1 with sigma = 0.2. Use a grid size and offsets
+    // that exercise the remainder handling of every vector width.
+    const double sigma{0.2};
+    const double exponentScale{1. / (2 * sigma * sigma)};
+    const size_t nbins{71};
+    std::mt19937 rng{20180324};
+    std::uniform_real_distribution<double> position{-0.5, 7.6};
+
+    for (const auto kernels : available)
+    {
+        for (size_t first = 0; first < 9; ++first)
+        {
+            for (size_t end = nbins - 9; end <= nbins; ++end)
+            {
+                std::vector<double> expected(nbins, 1.0);
+                std::vector<double> actual(nbins, 1.0);
+                const double center{position(rng)};
+                reference.accumulate(center, 0.0, 0.1, 0.7, exponentScale, first, end, expected.data());
+                kernels->accumulate(center, 0.0, 0.1, 0.7, exponentScale, first, end, actual.data());
+                for (size_t i = 0; i < nbins; ++i)
+                {
+                    EXPECT_NEAR(expected[i], actual[i], 1e-14 * std::abs(expected[i]) + 1e-300)
+                        << kernels->name << " bin " << i << " range [" << first << ", " << end << ")";
+                }
+            }
+        }
+    }
+}
+
+TEST(GaussianKernels, Moments)
+{
+    const auto available = plugin::availableGaussianKernels();
+    const auto& reference = *available.front();
+
+    const double sigma{0.2};
+    const double exponentScale{1. / (2 * sigma * sigma)};
+    const size_t nbins{70};
+    std::mt19937 rng{20180324};
+    std::uniform_real_distribution<double> position{1.9, 6.0};
+    std::uniform_real_distribution<double> weight{-1., 1.};
+
+    std::vector<double> weights(nbins);
+    for (auto& w : weights)
+    {
+        w = weight(rng);
+    }
+
+    for (const auto kernels : available)
+    {
+        for (size_t first = 0; first < 9; ++first)
+        {
+            const double center{position(rng)};
+            double expected[3];
+            double actual[3];
+            reference.moments(weights.data(), 0.0, 0.1, center, exponentScale, first, nbins - first, expected);
+            kernels->moments(weights.data(), 0.0, 0.1, center, exponentScale, first, nbins - first, actual);
+            // The sums have cancellations, so compare to the scale of the sum of magnitudes.
+            double scale[3] = {0, 0, 0};
+            for (size_t i = first; i < nbins - first; ++i)
+            {
+                const double x{i * 0.1 - center};
+                const double g{std::abs(weights[i]) * exp(-exponentScale * x * x)};
+                scale[0] += g;
+                scale[1] += g * std::abs(x);
+                scale[2] += g * x * x;
+            }
+            for (int m = 0; m < 3; ++m)
+            {
+                EXPECT_NEAR(expected[m], actual[m], 1e-14 * scale[m]) << kernels->name << " moment " << m;
+            }
+        }
+    }
+}
+
+TEST(GaussianKernels, FixedMoments)
+{
+    const double sigma{0.2};
+    const double exponentScale{1. / (2 * sigma * sigma)};
+    std::mt19937 rng{20180324};
+    std::uniform_real_distribution<double> position{1.9, 6.0};
+    std::uniform_real_distribution<double> weight{-1., 1.};
+
+    const size_t nbins[] = {50, 70, 100, 200};
+    static_assert(sizeof(nbins) / sizeof(nbins[0]) == plugin::numFixedBinCounts, "Test every fixed bin count.");
+    for (size_t index = 0; index < plugin::numFixedBinCounts; ++index)
+    {
+        ASSERT_EQ(index, plugin::fixedBinCountIndex(nbins[index]));
+        // The fixed-size kernels read the padding, which must be zero.
+        const size_t padded{plugin::paddedBinCount(nbins[index])};
+        ASSERT_EQ(0u, padded % 8);
+        std::vector<double> weights(padded, 0.);
+        for (size_t i = 0; i < nbins[index]; ++i)
+        {
+            weights[i] = weight(rng);
+        }
+
+        for (const auto accuracy : {plugin::ExpAccuracy::Full, plugin::ExpAccuracy::Relative1e7, plugin::ExpAccuracy::Relative1e4})
+        {
+            for (const auto kernels : plugin::availableGaussianKernels(accuracy))
+            {
+                const double center{position(rng)};
+                double expected[3];
+                double actual[3];
+                kernels->moments(weights.data(), 0.5, 0.1, center, exponentScale, 0, nbins[index], expected);
+                kernels->fixedMoments[index](weights.data(), 0.5, 0.1, center, exponentScale, actual);
+                double scale[3] = {0, 0, 0};
+                for (size_t i = 0; i < nbins[index]; ++i)
+                {
+                    const double x{0.5 + i * 0.1 - center};
+                    const double g{std::abs(weights[i]) * exp(-exponentScale * x * x)};
+                    scale[0] += g;
+                    scale[1] += g * std::abs(x);
+                    scale[2] += g * x * x;
+                }
+                for (int m = 0; m < 3; ++m)
+                {
+                    EXPECT_NEAR(expected[m], actual[m], 1e-14 * scale[m]) << kernels->name << " nbins " << nbins[index] << " moment " << m;
+                }
+            }
+        }
+    }
+    EXPECT_EQ(plugin::numFixedBinCounts, plugin::fixedBinCountIndex(71));
+}
+
+TEST(GaussianKernels, ExpAccuracy)
+{
+    // The kernels evaluate exp(-a x^2) for arguments from zero down to -sigmaCutoff^2 / 2 with a
+    // cutoff, and down to the clamp at -708 (-60 in single precision) without one. Grid points at
+    // multiples of a power of two with a = 1 make every argument exact, so the error is that of exp().
+    const double dx{1. / 4096};
+    const size_t nbins = static_cast<size_t>(std::sqrt(708.) / dx);
+    const float dxFloat{1.f / 512};
+    const size_t nbinsFloat = static_cast<size_t>(std::sqrt(60.) / dxFloat);
+
+    const std::vector<std::pair<plugin::ExpAccuracy, double>> bounds{{plugin::ExpAccuracy::Full, 1e-14},
+                                                                     {plugin::ExpAccuracy::Relative1e7, 1e-7},
+                                                                     {plugin::ExpAccuracy::Relative1e4, 1e-4}};
+    for (const auto& bound : bounds)
+    {
+        for (const auto kernels : plugin::availableGaussianKernels(bound.first))
+        {
+            EXPECT_EQ(bound.first, kernels->accuracy);
+
+            std::vector<double> grid(nbins, 0.);
+            kernels->accumulate(0., 0., dx, 1., 1., 0, nbins, grid.data());
+            double maxError{0};
+            double worstArgument{0};
+            for (size_t i = 0;i < nbins;++i)
+            {
+                const double argument{-(i * dx) * (i * dx)};
+                const double error{std::abs(grid[i] / std::exp(argument) - 1)};
+                if (error > maxError)
+                {
+                    maxError = error;
+                    worstArgument = argument;
+                }
+            }
+            EXPECT_LE(maxError, bound.second) << kernels->name << " at exp(" << worstArgument << ")";
+
+            // Single precision terms also carry their rounding error, so the bound is at least 1e-6.
+            std::vector<float> floatGrid(nbinsFloat, 0.f);
+            kernels->accumulateFloat(0., 0., dxFloat, 1., 1., 0, nbinsFloat, floatGrid.data());
+            double maxFloatError{0};
+            for (size_t i = 0;i < nbinsFloat;++i)
+            {
+                const double argument{-(i * dxFloat) * (i * dxFloat)};
+                maxFloatError = std::max(maxFloatError, std::abs(floatGrid[i] / std::exp(argument) - 1));
+            }
+            EXPECT_LE(maxFloatError, std::max(bound.second, 1e-6)) << kernels->name << " single precision";
+
+            std::cout << kernels->name << " exp accuracy bound " << bound.second << ": max relative error "
+                      << maxError << " over [-708, 0], single precision " << maxFloatError << " over [-60, 0]"
+                      << std::endl;
+        }
+    }
+}
+
+TEST(GaussianKernels, Recurrence)
+{
+    const auto& reference = *plugin::availableGaussianKernels().front();
+
+    // Narrow and wide kernels, with centers inside the grid, near its ends, and far outside, where
+    // the terms underflow in the direct evaluation.
+    const size_t nbins{1000};
+    std::mt19937 rng{20180324};
+    std::uniform_real_distribution<double> weight{-1., 1.};
+    std::vector<double> weights(nbins);
+    for (auto& w : weights)
+    {
+        w = weight(rng);
+    }
+
+    for (const double sigma : {0.05, 0.2, 2.0})
+    {
+        const double exponentScale{1. / (2 * sigma * sigma)};
+        for (const double center : {-30.0, -0.04, 0.0, 3.3333, 42.17, 99.95, 130.0})
+        {
+            for (const size_t first : {size_t{0}, size_t{3}, size_t{500}})
+            {
+                const size_t end{nbins - first / 2};
+                std::vector<double> expected(nbins, 1.);
+                std::vector<double> actual(nbins, 1.);
+                reference.accumulate(center, 0.0, 0.1, 0.5, exponentScale, first, end, expected.data());
+                plugin::recurrenceAccumulate(center, 0.0, 0.1, 0.5, exponentScale, first, end, actual.data());
+                for (size_t i = 0;i < nbins;++i)
+                {
+                    // The error of a term grows with the square of its distance from the start.
+                    ASSERT_NEAR(expected[i], actual[i], 1e-10 * std::abs(expected[i] - 1.) + 1e-290)
+                        << "sigma " << sigma << " center " << center << " bin " << i;
+                }
+
+                double expectedSums[3];
+                double actualSums[3];
+                reference.moments(weights.data(), 0.0, 0.1, center, exponentScale, first, end, expectedSums);
+                plugin::recurrenceMoments(weights.data(), 0.0, 0.1, center, exponentScale, first, end, actualSums);
+                double scale[3] = {0, 0, 0};
+                for (size_t i = first;i < end;++i)
+                {
+                    const double x{i * 0.1 - center};
+                    const double g{std::abs(weights[i]) * exp(-exponentScale * x * x)};
+                    scale[0] += g;
+                    scale[1] += g * std::abs(x);
+                    scale[2] += g * x * x;
+                }
+                for (int m = 0;m < 3;++m)
+                {
+                    EXPECT_NEAR(expectedSums[m], actualSums[m], 1e-10 * scale[m] + 1e-290)
+                        << "sigma " << sigma << " center " << center << " moment " << m;
+                }
+            }
+        }
+    }
+
+    // An empty range is left untouched.
+    double grid{1.};
+    plugin::recurrenceAccumulate(1.0, 0.0, 0.1, 1.0, 1.0, 5, 5, &grid);
+    EXPECT_EQ(1., grid);
+}
+
+TEST(GaussianKernels, SinglePrecision)
+{
+    const auto available = plugin::availableGaussianKernels();
+    const auto& reference = *available.front();
+
+    const double sigma{0.2};
+    const double exponentScale{1. / (2 * sigma * sigma)};
+    const size_t nbins{71};
+    std::mt19937 rng{20180324};
+    std::uniform_real_distribution<double> position{1.9, 6.0};
+    std::uniform_real_distribution<double> weight{-1., 1.};
+
+    std::vector<double> weights(nbins);
+    for (auto& w : weights)
+    {
+        w = weight(rng);
+    }
+    const std::vector<float> floatWeights(weights.begin(), weights.end());
+
+    // Report the accuracy relative to the double precision scalar kernels, so that changes to the
+    // single precision kernels can be judged against the precision of GROMACS mixed precision forces.
+    std::cout << "Single precision error relative to double precision:" << std::endl;
+    for (const auto kernels : available)
+    {
+        double accumulateError{0};
+        double momentError[3] = {0, 0, 0};
+        for (size_t first = 0; first < 17; ++first)
+        {
+            const size_t end{nbins - first};
+            const double center{position(rng)};
+
+            std::vector<double> expected(nbins, 0.);
+            std::vector<float> actual(nbins, 0.f);
+            reference.accumulate(center, 0.0, 0.1, 0.7, exponentScale, first, end, expected.data());
+            kernels->accumulateFloat(center, 0.0, 0.1, 0.7, exponentScale, first, end, actual.data());
+            const double peak{*std::max_element(expected.begin(), expected.end())};
+            for (size_t i = 0; i < nbins; ++i)
+            {
+                // Relative to the peak value, since float underflows in the tails.
+                const double error{std::abs(expected[i] - actual[i]) / peak};
+                EXPECT_LT(error, 1e-5) << kernels->name << " bin " << i;
+                accumulateError = std::max(accumulateError, error);
+            }
+
+            double expectedSums[3];
+            double actualSums[3];
+            reference.moments(weights.data(), 0.0, 0.1, center, exponentScale, first, end, expectedSums);
+            kernels->momentsFloat(floatWeights.data(), 0.0, 0.1, center, exponentScale, first, end, actualSums);
+            double scale[3] = {0, 0, 0};
+            for (size_t i = first; i < end; ++i)
+            {
+                const double x{i * 0.1 - center};
+                const double g{std::abs(weights[i]) * exp(-exponentScale * x * x)};
+                scale[0] += g;
+                scale[1] += g * std::abs(x);
+                scale[2] += g * x * x;
+            }
+            for (int m = 0; m < 3; ++m)
+            {
+                const double error{std::abs(expectedSums[m] - actualSums[m]) / scale[m]};
+                EXPECT_LT(error, 1e-5) << kernels->name << " moment " << m;
+                momentError[m] = std::max(momentError[m], error);
+            }
+        }
+        std::cout << "  " << kernels->name
+                  << ": blur " << accumulateError
+                  << ", moments " << momentError[0] << " " << momentError[1] << " " << momentError[2]
+                  << std::endl;
+    }
+}
+
+} // end anonymous namespace
@@ -0,0 +1,91 @@
+/*! \file
+ * \brief Test the MPI ensemble reduction.
+ *
+ * Run with any number of MPI ranks, or as a single process.
+ */
+
+#include <cmath>
+
+#include <mpi.h>
+
+#include "gmxapi/exceptions.h"
+
+#include "mpireduce.h"
+#include "sessionresources.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+TEST(MpiReduce, Mean)
+{
+    int rank{0};
+    int size{0};
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    auto reduce = plugin::makeMpiReduce(MPI_Comm_c2f(MPI_COMM_WORLD));
+
+    plugin::Matrix<double> send(2, 3);
+    plugin::Matrix<double> receive(2, 3);
+    for (size_t i = 0;i < 6;++i)
+    {
+        send.data()[i] = i + rank;
+    }
+    // Copies of the function object share the communicator.
+    auto copy = reduce;
+    for (const auto& function : {reduce, copy})
+    {
+        function(send, &receive);
+        for (size_t i = 0;i < 6;++i)
+        {
+            EXPECT_DOUBLE_EQ(i + 0.5 * (size - 1), receive.data()[i]);
+        }
+    }
+
+    plugin::Matrix<double> wrongSize(1, 4);
+    EXPECT_THROW(reduce(send, &wrongSize), gmxapi::ProtocolError);
+}
+
+TEST(MpiReduce, NonBlocking)
+{
+    int rank{0};
+    int size{0};
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    auto ireduce = plugin::makeMpiIreduce(MPI_Comm_c2f(MPI_COMM_WORLD));
+
+    plugin::Matrix<double> send(1, 5);
+    plugin::Matrix<double> receive(1, 5);
+    for (size_t i = 0;i < 5;++i)
+    {
+        send.data()[i] = i * (rank + 1);
+    }
+    auto request = ireduce(send, &receive);
+    request.wait();
+    // Completion is sticky.
+    EXPECT_TRUE(request.test());
+    for (size_t i = 0;i < 5;++i)
+    {
+        EXPECT_DOUBLE_EQ(i * 0.5 * (size + 1), receive.data()[i]);
+    }
+
+    // Polling also completes the reduction.
+    request = ireduce(send, &receive);
+    while (!request.test())
+    {}
+    EXPECT_DOUBLE_EQ(4 * 0.5 * (size + 1), receive.data()[4]);
+}
+
+} // end anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    int provided{0};
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    ::testing::InitGoogleTest(&argc, argv);
+    const int result = RUN_ALL_TESTS();
+    MPI_Finalize();
+    return result;
+}